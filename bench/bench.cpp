@@ -0,0 +1,321 @@
+#include <jcfp/jcfp.hpp>
+#include <jcfp/pipeline.hpp>
+#include <jcfp/sink.hpp>
+#include <jcfp/synthetic.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+ * Benchmark harness. Runs every benchmark over a corpus of classes until
+ * `--min-time` seconds have passed, and prints the results as JSON:
+ *
+ *     bench [--min-time SECONDS] [--filter NAME] <class files or directories...>
+ *     bench [--min-time SECONDS] [--filter NAME] --synthetic COUNT [--seed SEED]
+ *
+ * The synthetic corpus is made of COUNT classes of random shapes (see
+ * `random_shape`), the same ones for the same seed.
+ *
+ * Allocations are counted through the global `operator new`, so they
+ * include everything the library allocates while running a benchmark.
+ */
+
+using namespace jcfp;
+
+static std::atomic<size_t> allocation_count = 0;
+static std::atomic<size_t> allocation_bytes = 0;
+
+void *operator new(size_t size)
+{
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        if (void *ptr = std::malloc(size ? size : 1))
+                return ptr;
+        throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+        return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+
+struct Corpus {
+        std::vector<std::string> paths;
+        std::vector<std::vector<u1>> classes;
+        size_t bytes = 0;
+};
+
+struct Result {
+        std::string name;
+        size_t passes;
+        double seconds;
+        size_t allocations;
+        size_t allocated_bytes;
+};
+
+// Runs `pass` (one pass over the whole corpus) until `min_time` seconds have passed
+template <typename F>
+static Result run(const std::string &name, double min_time, F &&pass)
+{
+        using Clock = std::chrono::steady_clock;
+
+        pass(); // Warm up
+
+        size_t allocations = allocation_count.load(std::memory_order_relaxed);
+        size_t allocated_bytes = allocation_bytes.load(std::memory_order_relaxed);
+        size_t passes = 0;
+        auto start = Clock::now();
+        double seconds;
+        do {
+                pass();
+                ++passes;
+                seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (seconds < min_time);
+
+        return Result {
+                name, passes, seconds,
+                allocation_count.load(std::memory_order_relaxed) - allocations,
+                allocation_bytes.load(std::memory_order_relaxed) - allocated_bytes
+        };
+}
+
+static bool load_class(const std::filesystem::path &path, Corpus &corpus)
+{
+        std::ifstream file(path, std::ios::binary);
+        std::vector<u1> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file.good() && !file.eof()) {
+                std::cerr << "Failed to read '" << path.string() << "'" << std::endl;
+                return false;
+        }
+
+        corpus.bytes += bytes.size();
+        corpus.paths.push_back(path.string());
+        corpus.classes.push_back(std::move(bytes));
+        return true;
+}
+
+static bool load_corpus(const std::vector<std::string> &inputs, Corpus &corpus)
+{
+        for (auto &input : inputs) {
+                if (!std::filesystem::is_directory(input)) {
+                        if (!load_class(input, corpus))
+                                return false;
+                        continue;
+                }
+
+                for (auto &entry : std::filesystem::recursive_directory_iterator(input)) {
+                        if (entry.is_regular_file() && entry.path().extension() == ".class" && !load_class(entry.path(), corpus))
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+static bool generate_corpus(size_t count, uint64_t seed, Corpus &corpus)
+{
+        for (size_t i = 0; i < count; ++i) {
+                std::string name = "synthetic/Class" + std::to_string(i);
+                auto classfile = generate_class(name, random_shape(seed + i));
+                if (!classfile.has_value()) {
+                        std::cerr << "Failed to generate '" << name << "'" << std::endl;
+                        return false;
+                }
+
+                auto bytes = classfile.value().encode();
+                corpus.bytes += bytes.size();
+                corpus.paths.push_back(name);
+                corpus.classes.push_back(std::move(bytes));
+        }
+
+        return true;
+}
+
+static std::vector<ClassFile> parse_corpus(const Corpus &corpus, const ParseOptions &options = ParseOptions())
+{
+        std::vector<ClassFile> classes;
+        classes.reserve(corpus.classes.size());
+        for (size_t i = 0; i < corpus.classes.size(); ++i) {
+                auto classfile = ClassFile::parse(corpus.classes[i], options);
+                if (!classfile.has_value()) {
+                        std::cerr << "Failed to parse '" << corpus.paths[i] << "'" << std::endl;
+                        std::exit(1);
+                }
+                classes.push_back(std::move(classfile.value()));
+        }
+
+        return classes;
+}
+
+// Stands for a transform that reads the whole class and touches the constant pool
+struct TouchPass : public Pass {
+        size_t seen = 0;
+
+        u4 interests() const override { return INTEREST_CONSTANTS | INTEREST_MEMBERS | INTEREST_ATTRIBUTES | INTEREST_BYTECODE; }
+        void on_constant(PassContext &, u2, ConstantPoolEntry &) override { ++seen; }
+        void on_field(PassContext &, FieldInfo &) override { ++seen; }
+        void on_method(PassContext &, MethodInfo &) override { ++seen; }
+        void on_attribute(PassContext &, AttributeInfo &) override { ++seen; }
+        void on_instruction(PassContext &, std::span<u1>, size_t, Opcode) override { ++seen; }
+        void end_class(PassContext &context) override { context.classfile.constant_pool.mark_dirty(); }
+};
+
+static void print_json(const Corpus &corpus, double min_time, const std::vector<Result> &results)
+{
+        double megabytes = corpus.bytes / (1024.0 * 1024.0);
+        size_t class_count = corpus.classes.size();
+
+        printf("{\n");
+        printf("  \"corpus\": { \"classes\": %zu, \"bytes\": %zu },\n", class_count, corpus.bytes);
+        printf("  \"min_time\": %g,\n", min_time);
+        printf("  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+                auto &result = results[i];
+                double classes = static_cast<double>(result.passes) * class_count;
+                printf("    { \"name\": \"%s\", \"passes\": %zu, \"seconds\": %.6f, "
+                       "\"mb_per_s\": %.3f, \"classes_per_s\": %.1f, "
+                       "\"allocations_per_class\": %.2f, \"allocated_bytes_per_class\": %.1f }%s\n",
+                       result.name.c_str(), result.passes, result.seconds,
+                       megabytes * result.passes / result.seconds, classes / result.seconds,
+                       result.allocations / classes, result.allocated_bytes / classes,
+                       i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n");
+        printf("}\n");
+}
+
+int main(int argc, char **argv)
+{
+        double min_time = 1.0;
+        std::string filter;
+        size_t synthetic = 0;
+        uint64_t seed = 0;
+        std::vector<std::string> inputs;
+        for (int i = 1; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--min-time" && i + 1 < argc) {
+                        min_time = std::atof(argv[++i]);
+                } else if (arg == "--filter" && i + 1 < argc) {
+                        filter = argv[++i];
+                } else if (arg == "--synthetic" && i + 1 < argc) {
+                        synthetic = std::strtoull(argv[++i], nullptr, 10);
+                } else if (arg == "--seed" && i + 1 < argc) {
+                        seed = std::strtoull(argv[++i], nullptr, 10);
+                } else if (arg.starts_with("--")) {
+                        std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                        return 1;
+                } else {
+                        inputs.push_back(arg);
+                }
+        }
+
+        if (inputs.empty() && synthetic == 0) {
+                std::cerr << "Usage: " << argv[0] << " [--min-time SECONDS] [--filter NAME] <class files or directories...>" << std::endl;
+                std::cerr << "       " << argv[0] << " [--min-time SECONDS] [--filter NAME] --synthetic COUNT [--seed SEED]" << std::endl;
+                return 1;
+        }
+
+        Corpus corpus;
+        if (!load_corpus(inputs, corpus) || !generate_corpus(synthetic, seed, corpus))
+                return 1;
+        if (corpus.classes.empty()) {
+                std::cerr << "No classes found" << std::endl;
+                return 1;
+        }
+
+        std::vector<Result> results;
+        auto bench = [&](const std::string &name, auto &&pass) {
+                if (filter.empty() || name.find(filter) != std::string::npos)
+                        results.push_back(run(name, min_time, pass));
+        };
+
+        bench("parse", [&]() {
+                for (auto &bytes : corpus.classes)
+                        ClassFile::parse(bytes);
+        });
+
+        ParseOptions lazy_options;
+        lazy_options.flags = PARSE_ALL | PARSE_LAZY_CONSTANT_POOL | PARSE_RETAIN_SOURCE;
+        bench("parse_lazy", [&]() {
+                for (auto &bytes : corpus.classes)
+                        ClassFile::parse(bytes, lazy_options);
+        });
+
+        // Modified classes are encoded entry by entry, the unmodified ones are copied
+        std::vector<ClassFile> classes = parse_corpus(corpus);
+        bench("encode", [&]() {
+                for (auto &classfile : classes) {
+                        CountingSink sink;
+                        classfile.encode(sink);
+                }
+        });
+
+        std::vector<ClassFile> retained = parse_corpus(corpus, lazy_options);
+        bench("encode_unmodified", [&]() {
+                for (auto &classfile : retained) {
+                        CountingSink sink;
+                        classfile.encode(sink);
+                }
+        });
+
+        // Every index of the class is shifted, then shifted back
+        ConstantPoolEntry entry = ConstantPoolEntry(ConstantPoolEntry::IntegerInfo { 0 });
+        bench("relocate", [&]() {
+                for (auto &classfile : classes) {
+                        classfile.constant_pool.insert_entry(1, entry);
+                        classfile.relocate(+1, 1);
+                        classfile.constant_pool.remove_entry(1);
+                        classfile.relocate(-1, 1);
+                }
+        });
+
+        bench("constant_pool_insert_remove", [&]() {
+                for (auto &classfile : classes) {
+                        classfile.constant_pool.insert_entry(1, entry);
+                        classfile.constant_pool.remove_entry(1);
+                }
+        });
+
+        bench("attribute_lookup", [&]() {
+                for (auto &classfile : classes) {
+                        classfile.find_attribute("SourceFile");
+                        classfile.find_attribute("Missing");
+                }
+        });
+
+        // Five passes, fused into one traversal and one compaction, or run one by one
+        constexpr size_t pipeline_passes = 5;
+        Pipeline fused_pipeline;
+        std::vector<Pipeline> separate_pipelines(pipeline_passes);
+        for (size_t i = 0; i < pipeline_passes; ++i) {
+                fused_pipeline.add<TouchPass>();
+                separate_pipelines[i].add<TouchPass>();
+        }
+        std::vector<ClassFile> transformed = parse_corpus(corpus);
+        bench("pipeline_fused", [&]() {
+                for (auto &classfile : transformed)
+                        fused_pipeline.run(classfile);
+        });
+
+        bench("pipeline_separate", [&]() {
+                for (auto &classfile : transformed) {
+                        for (auto &pipeline : separate_pipelines)
+                                pipeline.run(classfile);
+                }
+        });
+
+        print_json(corpus, min_time, results);
+        return 0;
+}
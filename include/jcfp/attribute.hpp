@@ -19,9 +19,11 @@
 #include <vector>
 #include <variant>
 #include <string>
+#include <span>
 #include "utils.hpp"
 #include "basetypes.hpp"
 #include "error.hpp"
+#include "memory_usage.hpp"
 
 namespace jcfp {
 	class AttributeInfo {
@@ -32,14 +34,36 @@ namespace jcfp {
 	public:
 		AttributeInfo() {}
 		AttributeInfo(u2 attribute_name_index, std::vector<u1> info) :
-			attribute_name_index(attribute_name_index), info(info) {}
+			attribute_name_index(attribute_name_index), info(std::move(info)) {}
 	public:
 		static AttributeInfo parse(BufReader &reader);
 		static AttributeInfo parse(const u1 *bytes, size_t max_length=0);
 		static inline AttributeInfo parse(const std::vector<u1> &bytes) { return parse(bytes.data(), bytes.size()); }
+		static void skip(BufReader &reader);
 		std::vector<u1> encode();
-		void encode(ByteStream &stream);
+
+		template <Sink S>
+		inline void encode(S &stream) const
+		{
+			write_be(stream, this->attribute_name_index);
+
+			u4 attribute_length = this->info.size();
+			write_be(stream, attribute_length);
+			stream.write_bytes(this->info.data(), this->info.size());
+		}
 		void relocate(int diff, u2 from);
+
+		inline MemoryUsage memory_usage() const
+		{
+			MemoryUsage usage;
+			usage.add(&MemoryUsage::attribute_blobs, this->info);
+			return usage;
+		}
+
+		inline void shrink_to_fit()
+		{
+			this->info.shrink_to_fit();
+		}
 	};
 
 	class SourceFileAttr : public AttributeInfo {
@@ -64,6 +88,61 @@ namespace jcfp {
 			constant_pool.replace_entry(this->sourcefile_index, info);
 		}
 	};
+
+	class CodeAttr : public AttributeInfo {
+	public:
+		typedef struct {
+			u2 start_pc;
+			u2 end_pc;
+			u2 handler_pc;
+			u2 catch_type;
+		} ExceptionTableEntry;
+
+		u2 max_stack;
+		u2 max_locals;
+		// u4 code_length;
+		// u1 code[code_length];
+		u4 code_offset; // Offset of the bytecode inside `info`
+		u4 code_length;
+		std::vector<ExceptionTableEntry> exception_table;
+		std::vector<AttributeInfo> attributes;
+	public:
+		CodeAttr(const AttributeInfo &attribute_info) // throws std::out_of_range
+			: AttributeInfo(attribute_info)
+		{
+			// A reader with no length is not bounds checked
+			if (this->info.empty())
+				throw std::out_of_range("Empty Code attribute");
+
+			BufReader reader = BufReader(this->info.data(), this->info.size());
+			this->max_stack = reader.read_be<u2>();
+			this->max_locals = reader.read_be<u2>();
+			this->code_length = reader.read_be<u4>();
+			this->code_offset = reader.pos();
+			reader.skip(this->code_length);
+
+			u2 exception_table_length = reader.read_be<u2>();
+			this->exception_table.reserve(exception_table_length);
+			for (u2 i = 0; i < exception_table_length; ++i) {
+				ExceptionTableEntry entry;
+				entry.start_pc = reader.read_be<u2>();
+				entry.end_pc = reader.read_be<u2>();
+				entry.handler_pc = reader.read_be<u2>();
+				entry.catch_type = reader.read_be<u2>();
+				this->exception_table.push_back(entry);
+			}
+
+			u2 attributes_count = reader.read_be<u2>();
+			this->attributes.reserve(attributes_count);
+			for (u2 i = 0; i < attributes_count; ++i)
+				this->attributes.push_back(AttributeInfo::parse(reader));
+		}
+
+		inline std::span<const u1> code() const
+		{
+			return { this->info.data() + this->code_offset, this->code_length };
+		}
+	};
 }
 
 #endif
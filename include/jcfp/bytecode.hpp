@@ -16,6 +16,9 @@
 #ifndef _JCFP_BYTECODE_HPP_
 #define _JCFP_BYTECODE_HPP_
 
+#include <span>
+#include "basetypes.hpp"
+
 namespace jcfp {
 	enum class Opcode {
 		OP_nop                 = 0,
@@ -222,6 +225,32 @@ namespace jcfp {
 		OP_jsr_w               = 201,
 		OP_MAX                 = 201
 	};
+
+	/*
+	 * Length of the instruction at `pc` (opcode and operands included), or
+	 * 0 if the opcode is invalid or the instruction is truncated.
+	 */
+	size_t instruction_length(std::span<const u1> code, size_t pc);
+
+	/*
+	 * Calls `f(pc, opcode)` for every instruction in `code`, in order.
+	 * Returns false if the bytecode is malformed (the instructions before
+	 * the bad one were still visited).
+	 */
+	template <typename F>
+	bool for_each_instruction(std::span<const u1> code, F &&f)
+	{
+		for (size_t pc = 0; pc < code.size();) {
+			size_t length = instruction_length(code, pc);
+			if (length == 0)
+				return false;
+
+			f(pc, static_cast<Opcode>(code[pc]));
+			pc += length;
+		}
+
+		return true;
+	}
 }
 
 #endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_CLASS_HIERARCHY_HPP_
+#define _JCFP_CLASS_HIERARCHY_HPP_
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "jcfp.hpp"
+#include "interner.hpp"
+
+namespace jcfp {
+	/*
+	 * Superclass and interface graph of a batch of classes.
+	 *
+	 * Every class name seen (defined in the batch, or only referenced as a
+	 * supertype, like `java/lang/Object` usually is) gets a dense ClassId.
+	 * The direct supertypes and subtypes are stored as CSR arrays (one
+	 * offsets array, one flat array of ids).
+	 *
+	 * Subtype checks are constant time for classes, using the DFS interval
+	 * of each class in the superclass tree, and a binary search in the
+	 * sorted transitive interfaces of the class otherwise.
+	 *
+	 * Classes that are part of a superclass cycle (malformed input) are
+	 * only subtypes of themselves.
+	 */
+	class ClassHierarchy {
+	public:
+		using ClassId = u4;
+		static constexpr ClassId npos = static_cast<ClassId>(-1);
+	private:
+		std::unique_ptr<StringInterner> owned_interner;
+		std::vector<const std::string *> names;
+		std::unordered_map<std::string_view, ClassId> ids;
+
+		std::vector<u1> loaded;
+		std::vector<u1> interface_flags;
+		std::vector<ClassId> super_classes;
+
+		// CSR adjacency, see `supertypes` and `subtypes`
+		std::vector<u4> supertype_offsets;
+		std::vector<ClassId> supertype_ids;
+		std::vector<u4> subtype_offsets;
+		std::vector<ClassId> subtype_ids;
+
+		// Sorted transitive interfaces of each class
+		std::vector<u4> interface_offsets;
+		std::vector<ClassId> interface_ids;
+
+		// Pre/post order of each class in the superclass tree
+		std::vector<u4> enter;
+		std::vector<u4> leave;
+	public:
+		/*
+		 * Indexes `classes`, decoding their names on `threads` threads. If a
+		 * class is defined more than once, the first definition wins. The
+		 * names are stored in `interner` (usually the one used for parsing),
+		 * or in an interner owned by the hierarchy.
+		 */
+		static ClassHierarchy build(std::span<ClassFile> classes, StringInterner *interner = nullptr, unsigned threads = 0);
+	public:
+		inline size_t size() const
+		{
+			return this->names.size();
+		}
+
+		inline std::optional<ClassId> find(std::string_view name) const
+		{
+			auto it = this->ids.find(name);
+			if (it == this->ids.end())
+				return {};
+			return it->second;
+		}
+
+		inline const std::string &name(ClassId id) const
+		{
+			return *this->names[id];
+		}
+
+		// Returns false for classes that are only referenced by the batch
+		inline bool is_loaded(ClassId id) const
+		{
+			return this->loaded[id];
+		}
+
+		// Unloaded classes count as interfaces if something implements them
+		inline bool is_interface(ClassId id) const
+		{
+			return this->interface_flags[id];
+		}
+
+		// Returns `npos` for roots (and unloaded classes)
+		inline ClassId super_class(ClassId id) const
+		{
+			return this->super_classes[id];
+		}
+
+		// Direct superclass (if any) followed by the direct interfaces
+		inline std::span<const ClassId> supertypes(ClassId id) const
+		{
+			return { this->supertype_ids.data() + this->supertype_offsets[id], this->supertype_ids.data() + this->supertype_offsets[id + 1] };
+		}
+
+		// Classes that directly extend or implement `id`
+		inline std::span<const ClassId> subtypes(ClassId id) const
+		{
+			return { this->subtype_ids.data() + this->subtype_offsets[id], this->subtype_ids.data() + this->subtype_offsets[id + 1] };
+		}
+
+		// Every interface implemented by `id`, directly or not, sorted by id
+		inline std::span<const ClassId> all_interfaces(ClassId id) const
+		{
+			return { this->interface_ids.data() + this->interface_offsets[id], this->interface_ids.data() + this->interface_offsets[id + 1] };
+		}
+
+		// Returns true if `a` is `b`, or extends or implements it (directly or not)
+		bool is_subtype(ClassId a, ClassId b) const;
+
+		/*
+		 * Returns the most specific class that both `a` and `b` are subtypes
+		 * of, following the superclass chains (so interfaces only have their
+		 * superclass, usually `java/lang/Object`, in common). Returns nothing
+		 * if the chains never meet, e.g. because a superclass is missing.
+		 */
+		std::optional<ClassId> common_super_class(ClassId a, ClassId b) const;
+	};
+}
+
+#endif
@@ -19,9 +19,13 @@
 #include <vector>
 #include <variant>
 #include <string>
+#include <memory>
+#include <optional>
 #include "utils.hpp"
 #include "basetypes.hpp"
 #include "error.hpp"
+#include "interner.hpp"
+#include "memory_usage.hpp"
 
 namespace jcfp {
 	class ConstantPoolEntry {
@@ -48,9 +52,45 @@ namespace jcfp {
 			Utf8               = 1,
 			MethodHandle       = 15,
 			MethodType         = 16,
+			Dynamic            = 17,
 			InvokeDynamic      = 18,
+			Module             = 19,
+			Package            = 20,
 		};
 
+		/*
+		 * Size of each entry in the ClassFile (including the tag byte), indexed by tag.
+		 * Utf8 entries are followed by `length` more bytes. Invalid tags have a size of 0.
+		 */
+		static constexpr u1 entry_size_table[] = {
+			0, // 0
+			3, // Utf8 (tag + length)
+			0, // 2
+			5, // Integer
+			5, // Float
+			9, // Long
+			9, // Double
+			3, // Class
+			3, // String
+			5, // Fieldref
+			5, // Methodref
+			5, // InterfaceMethodref
+			5, // NameAndType
+			0, // 13
+			0, // 14
+			4, // MethodHandle
+			3, // MethodType
+			5, // Dynamic
+			5, // InvokeDynamic
+			3, // Module
+			3, // Package
+		};
+
+		static constexpr u1 entry_size(u1 tag)
+		{
+			return tag < sizeof(entry_size_table) ? entry_size_table[tag] : 0;
+		}
+
 		typedef struct {} EmptyInfo;
 
 		typedef struct {
@@ -109,7 +149,7 @@ namespace jcfp {
 		typedef struct {
 			// u2 length;
 			// u1 bytes[];
-			std::string bytes;
+			Utf8String bytes;
 		} Utf8Info;
 
 		typedef struct {
@@ -121,10 +161,23 @@ namespace jcfp {
 			u2 descriptor_index;
 		} MethodTypeInfo;
 
+		typedef struct {
+			u2 bootstrap_method_attr_index;
+			u2 name_and_type_index;
+		} DynamicInfo;
+
 		typedef struct {
 			u2 bootstrap_method_attr_index;
 			u2 name_and_type_index;
 		} InvokeDynamicInfo;
+
+		typedef struct {
+			u2 name_index;
+		} ModuleInfo;
+
+		typedef struct {
+			u2 name_index;
+		} PackageInfo;
 	public:
 		using EntryVariant = std::variant<
 			EmptyInfo,
@@ -146,14 +199,24 @@ namespace jcfp {
 			Utf8Info,
 			MethodHandleInfo,
 			MethodTypeInfo,
-			InvokeDynamicInfo
+			DynamicInfo,
+			InvokeDynamicInfo,
+			ModuleInfo,
+			PackageInfo
 		>;
 		Tag tag;
 		EntryVariant info;
+
+		/*
+		 * Offset of the entry in the raw bytes of a lazy ConstantPool, if it has
+		 * not been decoded yet (see `ConstantPool::parse_lazy`). Otherwise, 0.
+		 */
+		u4 raw_offset = 0;
 	public:
 		ConstantPoolEntry() : tag(Tag::Empty) {}
-		ConstantPoolEntry(EntryVariant info) : info(info) {
-			Tag tag_table[] = {
+		ConstantPoolEntry(EntryVariant info) : info(std::move(info)) {
+			// Maps each alternative of `EntryVariant` to its tag
+			static constexpr Tag tag_table[] = {
 				Tag::Empty,
 
 				Tag::Class,
@@ -172,10 +235,15 @@ namespace jcfp {
 				Tag::NameAndType,
 				Tag::Utf8,
 				Tag::MethodHandle,
-				Tag::InvokeDynamic
+				Tag::MethodType,
+				Tag::Dynamic,
+				Tag::InvokeDynamic,
+				Tag::Module,
+				Tag::Package
 			};
+			static_assert(sizeof(tag_table) / sizeof(tag_table[0]) == std::variant_size_v<EntryVariant>);
 
-			this->tag = tag_table[info.index()];
+			this->tag = tag_table[this->info.index()];
 		}
 
 		ConstantPoolEntry(ClassInfo info) : tag(Tag::Class), info(info) {}
@@ -192,15 +260,21 @@ namespace jcfp {
 		ConstantPoolEntry(DoubleInfo info) : tag(Tag::Double), info(info) {}
 
 		ConstantPoolEntry(NameAndTypeInfo info) : tag(Tag::NameAndType), info(info) {}
-		ConstantPoolEntry(Utf8Info info) : tag(Tag::Utf8), info(info) {}
+		ConstantPoolEntry(Utf8Info info) : tag(Tag::Utf8), info(std::move(info)) {}
 		ConstantPoolEntry(MethodHandleInfo info) : tag(Tag::MethodHandle), info(info) {}
+		ConstantPoolEntry(MethodTypeInfo info) : tag(Tag::MethodType), info(info) {}
+		ConstantPoolEntry(DynamicInfo info) : tag(Tag::Dynamic), info(info) {}
 		ConstantPoolEntry(InvokeDynamicInfo info) : tag(Tag::InvokeDynamic), info(info) {}
+		ConstantPoolEntry(ModuleInfo info) : tag(Tag::Module), info(info) {}
+		ConstantPoolEntry(PackageInfo info) : tag(Tag::Package), info(info) {}
 	public:
-		static std::expected<ConstantPoolEntry, Error> parse(BufReader &reader);
+		// Utf8 constants are added to `interner` (if any) instead of being copied
+		static std::expected<ConstantPoolEntry, Error> parse(BufReader &reader, StringInterner *interner = nullptr);
 		static std::expected<ConstantPoolEntry, Error> parse(const u1 *bytes, size_t max_length=0);
 		static inline std::expected<ConstantPoolEntry, Error> parse(const std::vector<u1> &bytes) { return parse(bytes.data(), bytes.size()); }
 		std::vector<u1> encode();
-		void encode(ByteStream &stream);
+		template <Sink S>
+		void encode(S &stream) const;
 		std::string to_string();
 
 		template <typename T>
@@ -209,7 +283,13 @@ namespace jcfp {
 			return std::get<T>(this->info);
 		}
 
-		inline bool is_wide_entry()
+		template <typename T>
+		inline const T &get() const
+		{
+			return std::get<T>(this->info);
+		}
+
+		inline bool is_wide_entry() const
 		{
 			return tag == Tag::Double || tag == Tag::Long;
 		}
@@ -220,15 +300,43 @@ namespace jcfp {
 	private:
 		/* Modifying the entries directly could cause issues, use the helper functions */
 		std::vector<ConstantPoolEntry> entries;
+
+		/* Raw bytes of the constant pool (starting at `constant_pool_count`), kept for lazy pools */
+		std::shared_ptr<const std::vector<u1>> raw;
+
+		/* Set by every helper that changes the entries, see `mark_dirty` */
+		bool modified = false;
+
+		/* Used to decode the Utf8 entries of lazy pools */
+		StringInterner *interner = nullptr;
 	public:
 		ConstantPool() {}
-		ConstantPool(std::vector<ConstantPoolEntry> entries) : entries(entries) {}
+		ConstantPool(std::vector<ConstantPoolEntry> entries) : entries(std::move(entries)) {}
 	public:
-		static std::expected<ConstantPool, Error> parse(BufReader &reader);
+		static std::expected<ConstantPool, Error> parse(BufReader &reader, StringInterner *interner = nullptr);
+
+		/*
+		 * Only records the tag and the offset of each entry. Entries are decoded
+		 * on first access through `get_entry`, `get` or `get_entries`, and the
+		 * ones never decoded are encoded by copying their original bytes.
+		 *
+		 * NOTE: Decoding modifies the pool, so a lazy pool must not be read
+		 *       from multiple threads without synchronization.
+		 */
+		static std::expected<ConstantPool, Error> parse_lazy(BufReader &reader, StringInterner *interner = nullptr);
+
+		/*
+		 * Walks the constant pool without decoding it, validating every tag.
+		 * Returns the offset of each entry (relative to `reader.data()`), indexed
+		 * by constant pool index. The unusable indices (0 and the ones after wide
+		 * entries) have an offset of 0.
+		 */
+		static std::expected<std::vector<u4>, Error> scan(BufReader &reader);
 		static std::expected<ConstantPool, Error> parse(const u1 *bytes, size_t max_length=0);
 		static inline std::expected<ConstantPool, Error> parse(const std::vector<u1> &bytes) { return parse(bytes.data(), bytes.size()); }
 		std::vector<u1> encode();
-		void encode(ByteStream &stream);
+		template <Sink S>
+		void encode(S &stream) const;
 	public:
 		/*
 		 * The constant pool entries are defined as:
@@ -237,32 +345,126 @@ namespace jcfp {
 		 *
 		 * Iteration goes from 1 to count - 1
 		 */
-		inline u2 count() {
+		inline u2 count() const {
 			return entries.size();
 		}
 
+		// Heap bytes used by the entries and their Utf8 strings, and by the raw bytes of a lazy pool
+		MemoryUsage memory_usage() const;
+
+		// Releases the capacity the entries and their Utf8 strings don't use
+		void shrink_to_fit();
+
 		/* Helper functions */
 		inline ConstantPoolEntry::Tag get_tag(u2 index) {
 			return entries[index].tag;
 		}
 
 		inline ConstantPoolEntry &get_entry(u2 index) {
+			if (entries[index].raw_offset != 0)
+				this->decode_entry(index);
 			return entries[index];
 		}
 
 		inline std::vector<ConstantPoolEntry> &get_entries() {
+			if (this->raw)
+				this->decode_all();
 			return this->entries;
 		}
 
 		template <typename T>
 		inline T &get(u2 index)
 		{
-			return entries[index].get<T>();
+			return this->get_entry(index).get<T>();
+		}
+
+		/*
+		 * The helper functions keep track of whether the pool was modified,
+		 * which lets a ClassFile copy an unmodified pool from its original
+		 * bytes when encoding. If you modify an entry in place (through
+		 * `get_entry` or `get`), call `mark_dirty`.
+		 */
+		inline void mark_dirty() {
+			this->modified = true;
+		}
+
+		inline bool is_modified() const {
+			return this->modified;
+		}
+
+		// Returns the Utf8 entry at `index`, or nullptr if there is no such entry
+		inline const std::string *find_utf8(u2 index) {
+			if (index == 0 || index >= entries.size() || entries[index].tag != ConstantPoolEntry::Tag::Utf8)
+				return nullptr;
+			return &this->get<ConstantPoolEntry::Utf8Info>(index).bytes.str();
+		}
+
+		// Returns the name of the Class entry at `index`, or nullptr if there is no such entry
+		inline const std::string *find_class_name(u2 index) {
+			if (index == 0 || index >= entries.size() || entries[index].tag != ConstantPoolEntry::Tag::Class)
+				return nullptr;
+			return this->find_utf8(this->get<ConstantPoolEntry::ClassInfo>(index).name_index);
+		}
+
+		struct MemberRef {
+			const std::string *class_name;
+			const std::string *name;
+			const std::string *descriptor;
+		};
+
+		/*
+		 * Returns the names of the Fieldref, Methodref or InterfaceMethodref
+		 * at `index`, or nothing if there is no such (valid) entry
+		 */
+		inline std::optional<MemberRef> find_member_ref(u2 index) {
+			using Tag = ConstantPoolEntry::Tag;
+			if (index == 0 || index >= entries.size())
+				return {};
+
+			u2 class_index;
+			u2 name_and_type_index;
+			switch (entries[index].tag) {
+			case Tag::Fieldref:
+				class_index = this->get<ConstantPoolEntry::FieldrefInfo>(index).class_index;
+				name_and_type_index = this->get<ConstantPoolEntry::FieldrefInfo>(index).name_and_type_index;
+				break;
+			case Tag::Methodref:
+				class_index = this->get<ConstantPoolEntry::MethodrefInfo>(index).class_index;
+				name_and_type_index = this->get<ConstantPoolEntry::MethodrefInfo>(index).name_and_type_index;
+				break;
+			case Tag::InterfaceMethodref:
+				class_index = this->get<ConstantPoolEntry::InterfaceMethodrefInfo>(index).class_index;
+				name_and_type_index = this->get<ConstantPoolEntry::InterfaceMethodrefInfo>(index).name_and_type_index;
+				break;
+			default:
+				return {};
+			}
+
+			if (name_and_type_index == 0 || name_and_type_index >= entries.size() ||
+			    entries[name_and_type_index].tag != Tag::NameAndType)
+				return {};
+
+			auto &name_and_type = this->get<ConstantPoolEntry::NameAndTypeInfo>(name_and_type_index);
+			MemberRef member_ref = {
+				this->find_class_name(class_index),
+				this->find_utf8(name_and_type.name_index),
+				this->find_utf8(name_and_type.descriptor_index)
+			};
+			if (!member_ref.class_name || !member_ref.name || !member_ref.descriptor)
+				return {};
+
+			return member_ref;
+		}
+
+		// Returns true if the entry still has to be decoded from the raw bytes
+		inline bool is_lazy_entry(u2 index) {
+			return entries[index].raw_offset != 0;
 		}
 
 		inline u2 push_entry(ConstantPoolEntry entry) {
 			u2 next_index = entries.size();
 
+			this->modified = true;
 			entries.push_back(entry);
 			if (entry.is_wide_entry()) {
 				entries.push_back(ConstantPoolEntry());
@@ -277,8 +479,9 @@ namespace jcfp {
 						    // will be skipped
 			}
 
-			ConstantPoolEntry last_entry = entries.back();
+			ConstantPoolEntry last_entry = this->get_entry(entries.size() - 1);
 			entries.pop_back();
+			this->modified = true;
 
 			return last_entry;
 		}
@@ -290,6 +493,7 @@ namespace jcfp {
 			// this->relocate(diff, index);
 
 			// Insert entry
+			this->modified = true;
 			if (entry.is_wide_entry())
 				entries.insert(entries.begin() + index, ConstantPoolEntry());
 			entries.insert(entries.begin() + index, entry);
@@ -305,11 +509,12 @@ namespace jcfp {
 				--index;
 
 			// Relocate references to indices >= index
-			ConstantPoolEntry entry = entries[index];
+			ConstantPoolEntry entry = this->get_entry(index);
 			// int diff = entry.is_wide_entry() ? -2 : -1;
 			// this->relocate(diff, index);
 
 			// Remove entry
+			this->modified = true;
 			entries.erase(entries.begin() + index);
 			if (entry.is_wide_entry()) {
 				entries.erase(entries.begin() + index);
@@ -327,6 +532,7 @@ namespace jcfp {
 			int diff = 0;
 			auto old_entry = entries[index];
 			entries[index] = entry;
+			this->modified = true;
 			if (entry.is_wide_entry() && !old_entry.is_wide_entry()) {
 				this->insert_entry(index + 1, ConstantPoolEntry());
 				++diff;
@@ -339,7 +545,144 @@ namespace jcfp {
 		}
 
 		void relocate(int diff, u2 from);
+	private:
+		void decode_entry(u2 index);
+		void decode_all();
 	};
+
+	template <Sink S>
+	void ConstantPoolEntry::encode(S &stream) const
+	{
+		if (this->tag == Tag::Empty)
+			return;
+
+		write_be(stream, this->tag);
+
+		switch (this->tag) {
+		case Tag::Class: {
+			const ClassInfo &info = this->get<ClassInfo>();
+			write_be(stream, info.name_index);
+			break;
+		}
+		case Tag::Fieldref: {
+			const FieldrefInfo &info = this->get<FieldrefInfo>();
+			write_be(stream, info.class_index);
+			write_be(stream, info.name_and_type_index);
+			break;
+		}
+		case Tag::Methodref: {
+			const MethodrefInfo &info = this->get<MethodrefInfo>();
+			write_be(stream, info.class_index);
+			write_be(stream, info.name_and_type_index);
+			break;
+		}
+		case Tag::InterfaceMethodref: {
+			const InterfaceMethodrefInfo &info = this->get<InterfaceMethodrefInfo>();
+			write_be(stream, info.class_index);
+			write_be(stream, info.name_and_type_index);
+			break;
+		}
+		case Tag::String: {
+			const StringInfo &info = this->get<StringInfo>();
+			write_be(stream, info.string_index);
+			break;
+		}
+		case Tag::Integer: {
+			const IntegerInfo &info = this->get<IntegerInfo>();
+			write_be(stream, info.bytes);
+			break;
+		}
+		case Tag::Float: {
+			const FloatInfo &info = this->get<FloatInfo>();
+			write_be(stream, info.bytes);
+			break;
+		}
+		case Tag::Long: {
+			const LongInfo &info = this->get<LongInfo>();
+			write_be(stream, info.high_bytes);
+			write_be(stream, info.low_bytes);
+			break;
+		}
+		case Tag::Double: {
+			const DoubleInfo &info = this->get<DoubleInfo>();
+			write_be(stream, info.high_bytes);
+			write_be(stream, info.low_bytes);
+			break;
+		}
+		case Tag::NameAndType: {
+			const NameAndTypeInfo &info = this->get<NameAndTypeInfo>();
+			write_be(stream, info.name_index);
+			write_be(stream, info.descriptor_index);
+			break;
+		}
+		case Tag::Utf8: {
+			const Utf8Info &info = this->get<Utf8Info>();
+
+			u2 length = info.bytes.size();
+			write_be(stream, length);
+			stream.write_bytes(reinterpret_cast<const u1 *>(info.bytes.data()), length);
+			break;
+		}
+		case Tag::MethodHandle: {
+			const MethodHandleInfo &info = this->get<MethodHandleInfo>();
+			write_be(stream, info.reference_kind);
+			write_be(stream, info.reference_index);
+			break;
+		}
+		case Tag::MethodType: {
+			const MethodTypeInfo &info = this->get<MethodTypeInfo>();
+			write_be(stream, info.descriptor_index);
+			break;
+		}
+		case Tag::Dynamic: {
+			const DynamicInfo &info = this->get<DynamicInfo>();
+			write_be(stream, info.bootstrap_method_attr_index);
+			write_be(stream, info.name_and_type_index);
+			break;
+		}
+		case Tag::InvokeDynamic: {
+			const InvokeDynamicInfo &info = this->get<InvokeDynamicInfo>();
+			write_be(stream, info.bootstrap_method_attr_index);
+			write_be(stream, info.name_and_type_index);
+
+			break;
+		}
+		case Tag::Module: {
+			const ModuleInfo &info = this->get<ModuleInfo>();
+			write_be(stream, info.name_index);
+			break;
+		}
+		case Tag::Package: {
+			const PackageInfo &info = this->get<PackageInfo>();
+			write_be(stream, info.name_index);
+			break;
+		}
+		default:
+			ERR("Failed to encode tag '%u' (unknown)", this->tag);
+			break;
+		}
+	}
+
+	template <Sink S>
+	void ConstantPool::encode(S &stream) const
+	{
+		u2 constant_pool_count = this->count();
+		write_be(stream, constant_pool_count);
+
+		for (auto &entry : this->entries) {
+			if (entry.raw_offset == 0) {
+				entry.encode(stream);
+				continue;
+			}
+
+			// Untouched lazy entry, copy it as is
+			const u1 *bytes = &this->raw->data()[entry.raw_offset];
+			size_t size = ConstantPoolEntry::entry_size(entry.tag);
+			if (entry.tag == ConstantPoolEntry::Tag::Utf8)
+				size += (bytes[1] << 8) | bytes[2];
+			stream.write_bytes(bytes, size);
+		}
+	}
 }
 
 #endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_DIFF_HPP_
+#define _JCFP_DIFF_HPP_
+
+#include <expected>
+#include <span>
+#include <vector>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	/*
+	 * Delta between two versions of a class, to be applied with `patch`
+	 * on the old bytes to get the new ones back exactly.
+	 *
+	 * Both classes are split into their parts (constant pool entries,
+	 * members, attributes, ...). Constant pool entries are matched by
+	 * content, fields and methods by name and descriptor, and attributes by
+	 * name. Unchanged parts are copied from the old class, and only the
+	 * changed bytes of a matched part are sent, so editing a method body
+	 * costs about the size of the edit.
+	 *
+	 * Format (integers are LEB128 varints unless noted):
+	 *   u4 magic ('JCFD', big endian)
+	 *   old_length, u8 old_hash (FNV-1a of the old bytes, little endian)
+	 *   new_length
+	 *   operations, until the end of the delta:
+	 *     (length << 1) | 0, zigzag(offset - end of the previous copy): copy from the old class
+	 *     (length << 1) | 1, bytes[length]:                             literal bytes
+	 */
+	std::expected<std::vector<u1>, Error> diff(const u1 *old_bytes, size_t old_length,
+						   const u1 *new_bytes, size_t new_length);
+
+	inline std::expected<std::vector<u1>, Error> diff(const std::vector<u1> &old_bytes, const std::vector<u1> &new_bytes)
+	{
+		return diff(old_bytes.data(), old_bytes.size(), new_bytes.data(), new_bytes.size());
+	}
+
+	// Encodes both classes first, see above
+	std::expected<std::vector<u1>, Error> diff(ClassFile &old_class, ClassFile &new_class);
+
+	/*
+	 * Applies a delta made by `diff`. Fails if the delta is malformed, or
+	 * if it was made for other bytes than `old_bytes`.
+	 */
+	std::expected<std::vector<u1>, Error> patch(const u1 *old_bytes, size_t old_length, std::span<const u1> delta);
+
+	inline std::expected<std::vector<u1>, Error> patch(const std::vector<u1> &old_bytes, std::span<const u1> delta)
+	{
+		return patch(old_bytes.data(), old_bytes.size(), delta);
+	}
+}
+
+#endif
@@ -5,6 +5,9 @@ namespace jcfp {
 	enum class ErrorKind {
 		Unknown,
 		WrongMagic, /* The ClassFile's `magic` is wrong  */
+		InvalidTag, /* A constant pool entry has an unknown tag */
+		Unsupported, /* The input needs a feature this library (or build) does not support */
+		Malformed, /* A structure is truncated, or references something that does not exist */
 	};
 
 	struct Error {
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_EVENT_PARSER_HPP_
+#define _JCFP_EVENT_PARSER_HPP_
+
+#include <span>
+#include <expected>
+#include "jcfp.hpp"
+
+/*
+ * Push-style ClassFile parser. Instead of building a ClassFile, it walks
+ * the bytes and calls back into a handler for every element it finds.
+ *
+ * The handler may implement any subset of:
+ *
+ *     void on_header(const ClassHeader &header);
+ *     void on_constant(u2 index, const ConstantPoolEntry &entry);
+ *     void on_class(const ClassInfoHeader &info);
+ *     void on_field(u2 index, const MemberHeader &field);
+ *     void on_method(u2 index, const MemberHeader &method);
+ *     void on_attribute(AttributeOwner owner, u2 name_index, std::span<const u1> info);
+ *     void on_end(size_t length);
+ *
+ * Missing callbacks are not called. The handler type is a template
+ * parameter, so the callbacks can be inlined into the parsing loop.
+ */
+
+namespace jcfp {
+	typedef struct {
+		u4 magic;
+		u2 minor_version;
+		MajorVersion major_version;
+		u2 constant_pool_count;
+	} ClassHeader;
+
+	typedef struct {
+		AccessFlags access_flags;
+		u2 this_class;
+		u2 super_class;
+		std::span<const u1> interfaces; // u2 interfaces[interfaces_count] (big endian)
+	} ClassInfoHeader;
+
+	typedef struct {
+		AccessFlags access_flags;
+		u2 name_index;
+		u2 descriptor_index;
+		u2 attributes_count;
+	} MemberHeader;
+
+	typedef struct {
+		enum Kind { Class, Field, Method } kind;
+		u2 index; // Index of the field/method, unused for Class
+	} AttributeOwner;
+
+	namespace detail {
+		template <typename Handler>
+		inline void emit_attributes(BufReader &reader, const u1 *bytes, u2 attributes_count,
+					    AttributeOwner owner, Handler &handler)
+		{
+			for (u2 i = 0; i < attributes_count; ++i) {
+				u2 attribute_name_index = reader.read_be<u2>();
+				u4 attribute_length = reader.read_be<u4>();
+				const u1 *info = &bytes[reader.pos()];
+				reader.skip(attribute_length);
+
+				if constexpr (requires { handler.on_attribute(owner, attribute_name_index, std::span<const u1>()); })
+					handler.on_attribute(owner, attribute_name_index, std::span<const u1>(info, attribute_length));
+			}
+		}
+
+		template <typename Handler>
+		inline void emit_members(BufReader &reader, const u1 *bytes, AttributeOwner::Kind kind, Handler &handler)
+		{
+			u2 members_count = reader.read_be<u2>();
+			for (u2 i = 0; i < members_count; ++i) {
+				MemberHeader member;
+				member.access_flags = reader.read_be<AccessFlags>();
+				member.name_index = reader.read_be<u2>();
+				member.descriptor_index = reader.read_be<u2>();
+				member.attributes_count = reader.read_be<u2>();
+
+				if (kind == AttributeOwner::Field) {
+					if constexpr (requires { handler.on_field(i, member); })
+						handler.on_field(i, member);
+				} else {
+					if constexpr (requires { handler.on_method(i, member); })
+						handler.on_method(i, member);
+				}
+
+				emit_attributes(reader, bytes, member.attributes_count, AttributeOwner { kind, i }, handler);
+			}
+		}
+	}
+
+	// Performs the same checks as `ClassFile::parse`. Truncated input throws std::out_of_range.
+	template <typename Handler>
+	std::expected<void, Error> parse_events(const u1 *bytes, size_t max_length, Handler &handler)
+	{
+		BufReader reader = BufReader(bytes, max_length);
+
+		ClassHeader header;
+		header.magic = reader.read_be<u4>();
+		if (header.magic != JCFP_CLASSFILE_MAGIC)
+			return std::unexpected(Error { ErrorKind::WrongMagic, reader.prev_pos() });
+		header.minor_version = reader.read_be<u2>();
+		header.major_version = static_cast<MajorVersion>(reader.read_be<u2>());
+		header.constant_pool_count = reader.read_be<u2>();
+		if constexpr (requires { handler.on_header(header); })
+			handler.on_header(header);
+
+		for (u2 i = 1; i < header.constant_pool_count; ++i) {
+			auto result = ConstantPoolEntry::parse(reader);
+			if (!result.has_value())
+				return std::unexpected(result.error());
+
+			auto &entry = result.value();
+			if constexpr (requires { handler.on_constant(i, entry); })
+				handler.on_constant(i, entry);
+
+			// 8-byte constants take up two entries, see `ConstantPool::parse`
+			if (entry.is_wide_entry())
+				++i;
+		}
+
+		ClassInfoHeader info;
+		info.access_flags = reader.read_be<AccessFlags>();
+		info.this_class = reader.read_be<u2>();
+		info.super_class = reader.read_be<u2>();
+		u2 interfaces_count = reader.read_be<u2>();
+		info.interfaces = std::span<const u1>(&bytes[reader.pos()], interfaces_count * sizeof(u2));
+		reader.skip(info.interfaces.size());
+		if constexpr (requires { handler.on_class(info); })
+			handler.on_class(info);
+
+		detail::emit_members(reader, bytes, AttributeOwner::Field, handler);
+		detail::emit_members(reader, bytes, AttributeOwner::Method, handler);
+
+		u2 attributes_count = reader.read_be<u2>();
+		detail::emit_attributes(reader, bytes, attributes_count, AttributeOwner { AttributeOwner::Class, 0 }, handler);
+
+		if constexpr (requires { handler.on_end(reader.pos()); })
+			handler.on_end(reader.pos());
+
+		return {};
+	}
+}
+
+#endif
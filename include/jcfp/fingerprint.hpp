@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_FINGERPRINT_HPP_
+#define _JCFP_FINGERPRINT_HPP_
+
+#include <expected>
+#include <vector>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	enum FingerprintFlags : u4 {
+		FINGERPRINT_ALL          = 0,
+
+		/* Skips SourceFile and the debug attributes (see `debug_attributes`) */
+		FINGERPRINT_IGNORE_DEBUG = 1 << 0,
+
+		/*
+		 * Only the API seen by other classes: the class header, the public
+		 * and protected members (in any order), and their ConstantValue,
+		 * Exceptions and Signature attributes. Method bodies are ignored.
+		 */
+		FINGERPRINT_ABI          = 1 << 1,
+	};
+
+	/*
+	 * Structural hash of a class. Every constant pool index is replaced by
+	 * the hash of the entry it points to (recursively), so the result does
+	 * not depend on the order of the constant pool, nor on unused or
+	 * duplicate entries. Everything else is hashed in order.
+	 *
+	 * Works straight on the bytes, without building a ClassFile. The result
+	 * is stable across runs and platforms, so it can be stored (e.g. as a
+	 * build cache key).
+	 *
+	 * NOTE: The bodies of attributes with an unknown layout (see
+	 *       `find_references`) are hashed as they are, so the result depends
+	 *       on the order of the entries they reference.
+	 */
+	std::expected<uint64_t, Error> fingerprint(const u1 *bytes, size_t length, u4 flags = FINGERPRINT_ALL);
+
+	inline std::expected<uint64_t, Error> fingerprint(const std::vector<u1> &bytes, u4 flags = FINGERPRINT_ALL)
+	{
+		return fingerprint(bytes.data(), bytes.size(), flags);
+	}
+
+	// Encodes the class first, see above
+	std::expected<uint64_t, Error> fingerprint(ClassFile &classfile, u4 flags = FINGERPRINT_ALL);
+}
+
+#endif
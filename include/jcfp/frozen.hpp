@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_FROZEN_HPP_
+#define _JCFP_FROZEN_HPP_
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	/*
+	 * Immutable value shared between copies. `edit` gives a mutable
+	 * reference, copying the value first if any other copy still uses it,
+	 * so the value seen by the other copies never changes.
+	 *
+	 * Copies can be made, read and dropped from any thread. A single Cow
+	 * must not be edited while another thread is using that same Cow.
+	 */
+	template <typename T>
+	class Cow {
+	private:
+		std::shared_ptr<T> value;
+	public:
+		Cow(T value) : value(std::make_shared<T>(std::move(value))) {}
+	public:
+		inline const T &operator*() const
+		{
+			return *this->value;
+		}
+
+		inline const T *operator->() const
+		{
+			return this->value.get();
+		}
+
+		inline T &edit()
+		{
+			if (this->value.use_count() != 1)
+				this->value = std::make_shared<T>(std::as_const(*this->value));
+			else
+				// Other copies that were just dropped must be done reading
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+			return *this->value;
+		}
+
+		inline bool is_shared_with(const Cow &other) const
+		{
+			return this->value == other.value;
+		}
+	};
+
+	/*
+	 * ClassFile whose sections (the constant pool, each field, each method
+	 * and each class attribute) are shared between copies, see Cow. Copying
+	 * it only copies the header and the lists of sections, and a section is
+	 * copied on its first `edit`, so a transform that changes one method
+	 * leaves the rest shared with the original.
+	 *
+	 * A const FrozenClassFile never changes, and can be read and copied by
+	 * many threads at once without locks.
+	 *
+	 * NOTE: Same as in ClassFile, sections modified in place must be marked
+	 *       with `mark_dirty` to stop being copied from the original bytes.
+	 */
+	class FrozenClassFile {
+	public:
+		u4 magic;
+		u2 minor_version;
+		MajorVersion major_version;
+		Cow<ConstantPool> constant_pool;
+		AccessFlags access_flags;
+		u2 this_class;
+		u2 super_class;
+		std::vector<u2> interfaces;
+		std::vector<Cow<FieldInfo>> fields;
+		std::vector<Cow<MethodInfo>> methods;
+		std::vector<Cow<AttributeInfo>> attributes;
+
+		// See ClassFile, the original bytes are never modified
+		std::shared_ptr<const std::vector<u1>> source;
+		SourceRange constant_pool_source = {};
+		SourceRange attributes_source = {};
+	private:
+		FrozenClassFile(ClassFile &classfile);
+	public:
+		// A lazy constant pool is decoded, since reading it would modify it
+		static FrozenClassFile freeze(ClassFile classfile);
+
+		// Copies every section into a regular ClassFile
+		ClassFile thaw() const;
+
+		std::vector<u1> encode() const;
+		template <Sink S>
+		void encode(S &stream) const;
+	public:
+		// The edit functions mark what they return as modified, so it gets encoded again
+		inline ConstantPool &edit_constant_pool()
+		{
+			ConstantPool &constant_pool = this->constant_pool.edit();
+			constant_pool.mark_dirty();
+			return constant_pool;
+		}
+
+		inline FieldInfo &edit_field(size_t index)
+		{
+			FieldInfo &field = this->fields[index].edit();
+			field.mark_dirty();
+			return field;
+		}
+
+		inline MethodInfo &edit_method(size_t index)
+		{
+			MethodInfo &method = this->methods[index].edit();
+			method.mark_dirty();
+			return method;
+		}
+
+		inline AttributeInfo &edit_attribute(size_t index)
+		{
+			this->attributes_source = {};
+			return this->attributes[index].edit();
+		}
+
+		// Call after adding or removing class attributes
+		inline void mark_attributes_dirty()
+		{
+			this->attributes_source = {};
+		}
+
+		inline bool is_unmodified(const SourceRange &range) const
+		{
+			return range.is_in(this->source);
+		}
+	};
+
+	template <Sink S>
+	void FrozenClassFile::encode(S &stream) const
+	{
+		LOG("Encoding FrozenClassFile to bytes...");
+		JCFP_TRACE_BEGIN(encode_trace, TracePhase::Encode, trace_sink_size(stream));
+
+		auto encode_source = [&](const SourceRange &range) {
+			stream.write_bytes(&this->source->data()[range.offset], range.length);
+		};
+
+		write_be(stream, this->magic);
+		write_be(stream, this->minor_version);
+		write_be(stream, this->major_version);
+
+		if (this->is_unmodified(this->constant_pool_source) && !this->constant_pool->is_modified())
+			encode_source(this->constant_pool_source);
+		else
+			this->constant_pool->encode(stream);
+
+		write_be(stream, this->access_flags);
+		write_be(stream, this->this_class);
+		write_be(stream, this->super_class);
+
+		u2 interfaces_count = static_cast<u2>(this->interfaces.size());
+		write_be(stream, interfaces_count);
+		for (auto &interface : this->interfaces) {
+			write_be(stream, interface);
+		}
+
+		u2 fields_count = static_cast<u2>(this->fields.size());
+		write_be(stream, fields_count);
+		for (auto &field : this->fields) {
+			if (this->is_unmodified(field->source))
+				encode_source(field->source);
+			else
+				field->encode(stream);
+		}
+
+		u2 methods_count = static_cast<u2>(this->methods.size());
+		write_be(stream, methods_count);
+		for (auto &method : this->methods) {
+			if (this->is_unmodified(method->source))
+				encode_source(method->source);
+			else
+				method->encode(stream);
+		}
+
+		if (this->is_unmodified(this->attributes_source)) {
+			encode_source(this->attributes_source);
+		} else {
+			u2 attributes_count = static_cast<u2>(this->attributes.size());
+			write_be(stream, attributes_count);
+			for (auto &attribute : this->attributes) {
+				attribute->encode(stream);
+			}
+		}
+
+		JCFP_TRACE_END(encode_trace, trace_sink_size(stream));
+		LOG("FrozenClassFile encoding finished successfully");
+	}
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_INCREMENTAL_PARSER_HPP_
+#define _JCFP_INCREMENTAL_PARSER_HPP_
+
+#include <span>
+#include <vector>
+#include <expected>
+#include <optional>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	enum class FeedStatus {
+		NeedMoreData, /* The class is not complete yet, keep feeding */
+		Done,         /* The class is complete, get it with `take` */
+	};
+
+	/*
+	 * Resumable ClassFile parser. The class is fed in chunks of any size,
+	 * and every complete element (constant pool entry, member header,
+	 * attribute) is consumed as soon as it is available. Only an incomplete
+	 * element is kept between calls to `feed`, and attribute bodies are
+	 * copied (or skipped) directly from the chunks.
+	 *
+	 * The resulting ClassFile is the same as the one from `ClassFile::parse`
+	 * with the same options, and the input is checked the same way.
+	 * PARSE_LAZY_CONSTANT_POOL and PARSE_RETAIN_SOURCE need the whole class
+	 * in memory, so they are not supported: `feed` fails with
+	 * `ErrorKind::Unsupported` if they are set.
+	 */
+	class IncrementalParser {
+	private:
+		enum class State {
+			Header,
+			ConstantPoolEntry,
+			ClassInfo,
+			Interfaces,
+			MembersCount,
+			MemberHeader,
+			AttributesCount,
+			AttributeHeader,
+			AttributeBody,
+			Done,
+		};
+
+		enum class Section { Fields, Methods, Class };
+
+		ParseOptions options;
+		State state = State::Header;
+		Section section = Section::Fields;
+		std::vector<u1> pending;
+		size_t offset = 0; // Bytes consumed so far
+
+		u2 constant_pool_count = 0;
+		u2 constant_pool_index = 1;
+		std::vector<ConstantPoolEntry> entries;
+		u2 interfaces_count = 0;
+		u2 members_left = 0;
+		u2 attributes_left = 0;
+		u4 body_left = 0;
+		bool keep_member = false;
+		bool keep_attribute = false;
+
+		u4 magic = 0;
+		u2 minor_version = 0;
+		MajorVersion major_version = static_cast<MajorVersion>(0);
+		ConstantPool constant_pool;
+		AccessFlags access_flags = static_cast<AccessFlags>(0);
+		u2 this_class = 0;
+		u2 super_class = 0;
+		std::vector<u2> interfaces;
+		std::vector<FieldInfo> fields;
+		std::vector<MethodInfo> methods;
+		std::vector<AttributeInfo> attributes;
+
+		MethodInfo member = {};
+		AttributeInfo attribute;
+	public:
+		IncrementalParser(const ParseOptions &options = ParseOptions()) : options(options) {}
+	public:
+		std::expected<FeedStatus, Error> feed(std::span<const u1> chunk);
+		inline std::expected<FeedStatus, Error> feed(const u1 *bytes, size_t size) { return feed(std::span<const u1>(bytes, size)); }
+
+		// Returns the parsed ClassFile once `feed` has returned `FeedStatus::Done`
+		std::optional<ClassFile> take();
+
+		inline bool done()
+		{
+			return this->state == State::Done;
+		}
+
+		// Bytes consumed from the input so far
+		inline size_t pos()
+		{
+			return this->offset;
+		}
+	private:
+		std::expected<size_t, Error> process(const u1 *bytes, size_t size);
+		std::expected<void, Error> step(BufReader &reader);
+		void end_constant_pool();
+		void end_interfaces();
+		void end_section();
+		void end_member();
+		void end_attribute();
+	};
+}
+
+#endif
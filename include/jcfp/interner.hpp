@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_INTERNER_HPP_
+#define _JCFP_INTERNER_HPP_
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace jcfp {
+	/*
+	 * Bytes of a Utf8 constant. Either owns its string, or points to an
+	 * immutable copy owned by a StringInterner, which must outlive it.
+	 * Assigning a new string always makes it owned again.
+	 */
+	class Utf8String {
+	private:
+		std::string owned;
+		const std::string *interned = nullptr;
+	public:
+		Utf8String() {}
+		Utf8String(std::string str) : owned(std::move(str)) {}
+		Utf8String(const char *str) : owned(str) {}
+		explicit Utf8String(const std::string *interned) : interned(interned) {}
+	public:
+		inline const std::string &str() const
+		{
+			return this->interned ? *this->interned : this->owned;
+		}
+
+		inline operator const std::string &() const
+		{
+			return this->str();
+		}
+
+		inline size_t size() const
+		{
+			return this->str().size();
+		}
+
+		inline const char *data() const
+		{
+			return this->str().data();
+		}
+
+		inline bool is_interned() const
+		{
+			return this->interned != nullptr;
+		}
+
+		// The string owned by this one, if any (interned strings belong to their interner)
+		inline const std::string *owned_str() const
+		{
+			return this->interned ? nullptr : &this->owned;
+		}
+
+		inline void shrink_to_fit()
+		{
+			this->owned.shrink_to_fit();
+		}
+
+		friend inline bool operator==(const Utf8String &lhs, const Utf8String &rhs)
+		{
+			// Interned strings are unique, so comparing the pointers is enough
+			if (lhs.interned && lhs.interned == rhs.interned)
+				return true;
+			return lhs.str() == rhs.str();
+		}
+
+		friend inline bool operator==(const Utf8String &lhs, std::string_view rhs)
+		{
+			return std::string_view(lhs.str()) == rhs;
+		}
+
+		friend inline bool operator==(const Utf8String &lhs, const std::string &rhs)
+		{
+			return lhs.str() == rhs;
+		}
+
+		friend inline bool operator==(const Utf8String &lhs, const char *rhs)
+		{
+			return lhs.str() == rhs;
+		}
+	};
+
+	/*
+	 * Thread-safe string pool, shared between the classes parsed with it
+	 * (see `ParseOptions::interner`), so that identical Utf8 constants are
+	 * only stored once. Strings are never removed, and their addresses
+	 * stay valid for the lifetime of the interner.
+	 *
+	 * The table is split into shards with their own lock, so parallel
+	 * parsers rarely wait on each other.
+	 */
+	class StringInterner {
+	private:
+		static constexpr size_t shard_count = 64;
+
+		struct Hash {
+			using is_transparent = void;
+			inline size_t operator()(std::string_view str) const
+			{
+				return std::hash<std::string_view>{}(str);
+			}
+		};
+
+		struct Shard {
+			std::mutex mutex;
+			std::unordered_set<std::string, Hash, std::equal_to<>> strings;
+		};
+
+		std::array<Shard, shard_count> shards;
+	public:
+		StringInterner() {}
+		StringInterner(const StringInterner &) = delete;
+		StringInterner &operator=(const StringInterner &) = delete;
+	public:
+		// Returns the unique copy of `str`, adding it if needed
+		const std::string *intern(std::string_view str);
+
+		inline Utf8String make(std::string_view str)
+		{
+			return Utf8String(this->intern(str));
+		}
+
+		// Number of unique strings
+		size_t size();
+	};
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_JAR_WRITER_HPP_
+#define _JCFP_JAR_WRITER_HPP_
+
+#include <bit>
+#include <string>
+#include <vector>
+#include <optional>
+#include <expected>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	/*
+	 * Writes a JAR (ZIP) archive. Entries are encoded, checksummed and
+	 * compressed in parallel, then the local headers and the central
+	 * directory are written in the order the entries were added. All
+	 * timestamps are fixed, so the same entries always produce the same
+	 * archive.
+	 *
+	 * Deflate needs the library to be built with zlib (JCFP_HAVE_ZLIB).
+	 * ZIP64 is not supported.
+	 */
+	class JarWriter {
+	public:
+		enum class Compression {
+			Store,   /* No compression, fastest */
+			Deflate, /* Entries that don't shrink are stored anyway */
+		};
+	private:
+		struct Entry {
+			std::string name;
+			std::optional<ClassFile> classfile; // Encoded when the archive is written
+			std::vector<u1> data;               // Compressed data, once prepared
+			u4 crc32 = 0;
+			u4 size = 0;
+			u2 method = 0;
+		};
+
+		// What `prepare` computes for an entry, applied only once every entry fits
+		struct Prepared {
+			std::optional<std::vector<u1>> data; // Replaces `Entry::data` if set
+			uint64_t size = 0;
+			u4 crc32 = 0;
+			u2 method = 0;
+		};
+
+		Compression compression;
+		unsigned threads;
+		std::vector<Entry> entries;
+	public:
+		JarWriter(Compression compression = Compression::Deflate, unsigned threads = 0)
+			: compression(compression), threads(threads) {}
+	public:
+		// Adds an already encoded class (or any other file)
+		inline void add(std::string name, std::vector<u1> data)
+		{
+			this->entries.push_back(Entry { std::move(name), {}, std::move(data) });
+		}
+
+		inline void add(std::string name, ClassFile classfile)
+		{
+			this->entries.push_back(Entry { std::move(name), std::move(classfile), {} });
+		}
+
+		inline size_t count()
+		{
+			return this->entries.size();
+		}
+
+		std::expected<std::vector<u1>, Error> finish();
+
+		/*
+		 * Writes the archive and clears the writer. On failure, nothing is
+		 * written and the entries are left as they were added.
+		 */
+		template <Sink S>
+		std::expected<void, Error> finish(S &sink);
+	private:
+		std::expected<void, Error> prepare();
+	};
+
+	namespace detail {
+		template <Sink S, typename T>
+		inline void write_le(S &sink, T value)
+		{
+			if constexpr (std::endian::native == std::endian::big && sizeof(T) > 1)
+				value = std::byteswap(value);
+			sink.write_bytes(reinterpret_cast<const u1 *>(&value), sizeof(T));
+		}
+	}
+
+	template <Sink S>
+	std::expected<void, Error> JarWriter::finish(S &sink)
+	{
+		using detail::write_le;
+
+		// MS-DOS time and date of 1980-01-01 00:00:00, the earliest representable
+		constexpr u2 dos_time = 0;
+		constexpr u2 dos_date = (1 << 5) | 1;
+		constexpr u2 utf8_names = 1 << 11;
+
+		auto result = this->prepare();
+		if (!result.has_value())
+			return result;
+
+		std::vector<u4> offsets;
+		offsets.reserve(this->entries.size());
+		u4 offset = 0;
+
+		for (auto &entry : this->entries) {
+			offsets.push_back(offset);
+
+			write_le<S, u4>(sink, 0x04034b50); // Local file header signature
+			write_le<S, u2>(sink, entry.method == 8 ? 20 : 10); // Version needed to extract
+			write_le<S, u2>(sink, utf8_names);
+			write_le<S, u2>(sink, entry.method);
+			write_le<S, u2>(sink, dos_time);
+			write_le<S, u2>(sink, dos_date);
+			write_le<S, u4>(sink, entry.crc32);
+			write_le<S, u4>(sink, entry.data.size());
+			write_le<S, u4>(sink, entry.size);
+			write_le<S, u2>(sink, entry.name.size());
+			write_le<S, u2>(sink, 0); // Extra field length
+			sink.write_bytes(reinterpret_cast<const u1 *>(entry.name.data()), entry.name.size());
+			sink.write_bytes(entry.data.data(), entry.data.size());
+
+			offset += 30 + entry.name.size() + entry.data.size();
+		}
+
+		u4 central_directory_offset = offset;
+		for (size_t i = 0; i < this->entries.size(); ++i) {
+			auto &entry = this->entries[i];
+
+			write_le<S, u4>(sink, 0x02014b50); // Central directory file header signature
+			write_le<S, u2>(sink, 20); // Version made by
+			write_le<S, u2>(sink, entry.method == 8 ? 20 : 10);
+			write_le<S, u2>(sink, utf8_names);
+			write_le<S, u2>(sink, entry.method);
+			write_le<S, u2>(sink, dos_time);
+			write_le<S, u2>(sink, dos_date);
+			write_le<S, u4>(sink, entry.crc32);
+			write_le<S, u4>(sink, entry.data.size());
+			write_le<S, u4>(sink, entry.size);
+			write_le<S, u2>(sink, entry.name.size());
+			write_le<S, u2>(sink, 0); // Extra field length
+			write_le<S, u2>(sink, 0); // File comment length
+			write_le<S, u2>(sink, 0); // Disk number start
+			write_le<S, u2>(sink, 0); // Internal file attributes
+			write_le<S, u4>(sink, 0); // External file attributes
+			write_le<S, u4>(sink, offsets[i]);
+			sink.write_bytes(reinterpret_cast<const u1 *>(entry.name.data()), entry.name.size());
+
+			offset += 46 + entry.name.size();
+		}
+
+		write_le<S, u4>(sink, 0x06054b50); // End of central directory signature
+		write_le<S, u2>(sink, 0); // Number of this disk
+		write_le<S, u2>(sink, 0); // Disk where the central directory starts
+		write_le<S, u2>(sink, this->entries.size());
+		write_le<S, u2>(sink, this->entries.size());
+		write_le<S, u4>(sink, offset - central_directory_offset);
+		write_le<S, u4>(sink, central_directory_offset);
+		write_le<S, u2>(sink, 0); // Comment length
+
+		this->entries.clear();
+		return {};
+	}
+}
+
+#endif
@@ -17,34 +17,184 @@
 #define _JCFP_HPP_
 
 #include <vector>
+#include <memory>
 #include <expected>
 #include <optional>
+#include <string>
 #include "basetypes.hpp"
 #include "constant_pool.hpp"
 #include "attribute.hpp"
 #include "error.hpp"
+#include "trace.hpp"
 
 #define JCFP_CLASSFILE_MAGIC 0xCAFEBABE
 #define JCFP_RELOCATE_INDEX(index, diff, from) { if (index >= from) index += diff; }
 
 namespace jcfp {
-	typedef struct {
+	/*
+	 * Range of bytes in the original ClassFile, see PARSE_RETAIN_SOURCE.
+	 * The range remembers the bytes it belongs to, so a member moved to
+	 * another class (or kept after its class forgot the original bytes)
+	 * is encoded again instead of being copied from the wrong buffer.
+	 */
+	struct SourceRange {
+		u4 offset = 0;
+		u4 length = 0;
+		std::weak_ptr<const std::vector<u1>> buffer = {};
+
+		inline bool valid() const
+		{
+			return this->length > 0;
+		}
+
+		// True if the range is valid and points into `source`
+		inline bool is_in(const std::shared_ptr<const std::vector<u1>> &source) const
+		{
+			return source && this->valid() && !this->buffer.owner_before(source) && !source.owner_before(this->buffer);
+		}
+	};
+
+	struct FieldInfo {
 		AccessFlags access_flags;
 		u2 name_index;
 		u2 descriptor_index;
 		// u2 attributes_count;
 		// attribute_info attributes[attributes_count];
 		std::vector<AttributeInfo> attributes;
-	} FieldInfo;
 
-	typedef struct {
+		// Original bytes of the whole field, if unmodified
+		SourceRange source = {};
+
+		// Call after modifying the field, so it gets encoded again
+		inline void mark_dirty()
+		{
+			this->source = {};
+		}
+
+		template <Sink S>
+		inline void encode(S &stream) const
+		{
+			write_be(stream, this->access_flags);
+			write_be(stream, this->name_index);
+			write_be(stream, this->descriptor_index);
+
+			u2 attributes_count = static_cast<u2>(this->attributes.size());
+			write_be(stream, attributes_count);
+			for (auto &attribute : this->attributes) {
+				attribute.encode(stream);
+			}
+		}
+
+		inline MemoryUsage memory_usage() const
+		{
+			MemoryUsage usage;
+			usage.add(&MemoryUsage::structure, this->attributes);
+			for (auto &attribute : this->attributes)
+				usage += attribute.memory_usage();
+			return usage;
+		}
+
+		inline void shrink_to_fit()
+		{
+			this->attributes.shrink_to_fit();
+			for (auto &attribute : this->attributes)
+				attribute.shrink_to_fit();
+		}
+	};
+
+	struct MethodInfo {
 		AccessFlags access_flags;
 		u2 name_index;
 		u2 descriptor_index;
 		// u2 attributes_count;
 		// attribute_info attributes[attributes_count];
 		std::vector<AttributeInfo> attributes;
-	} MethodInfo;
+
+		// Original bytes of the whole method, if unmodified
+		SourceRange source = {};
+
+		// Call after modifying the method, so it gets encoded again
+		inline void mark_dirty()
+		{
+			this->source = {};
+		}
+
+		template <Sink S>
+		inline void encode(S &stream) const
+		{
+			write_be(stream, this->access_flags);
+			write_be(stream, this->name_index);
+			write_be(stream, this->descriptor_index);
+
+			u2 attributes_count = static_cast<u2>(this->attributes.size());
+			write_be(stream, attributes_count);
+			for (auto &attribute : this->attributes) {
+				attribute.encode(stream);
+			}
+		}
+
+		inline MemoryUsage memory_usage() const
+		{
+			MemoryUsage usage;
+			usage.add(&MemoryUsage::structure, this->attributes);
+			for (auto &attribute : this->attributes)
+				usage += attribute.memory_usage();
+			return usage;
+		}
+
+		inline void shrink_to_fit()
+		{
+			this->attributes.shrink_to_fit();
+			for (auto &attribute : this->attributes)
+				attribute.shrink_to_fit();
+		}
+	};
+
+	/*
+	 * Sections of the ClassFile that are parsed. The header (magic, versions,
+	 * access flags, this/super class, interfaces) and the constant pool are
+	 * always parsed. Everything else can be excluded, in which case it is
+	 * skipped by length instead of being copied.
+	 *
+	 * NOTE: Excluded sections are left empty in the resulting ClassFile,
+	 *       so encoding it will not reproduce the original class.
+	 */
+	enum ParseFlags : u4 {
+		PARSE_CONSTANT_POOL     = 0,
+		PARSE_FIELDS            = 1 << 0,
+		PARSE_METHODS           = 1 << 1,
+		PARSE_FIELD_ATTRIBUTES  = 1 << 2,
+		PARSE_METHOD_ATTRIBUTES = 1 << 3,
+		PARSE_CLASS_ATTRIBUTES  = 1 << 4,
+
+		PARSE_ATTRIBUTES = PARSE_FIELD_ATTRIBUTES | PARSE_METHOD_ATTRIBUTES | PARSE_CLASS_ATTRIBUTES,
+		PARSE_ALL        = PARSE_FIELDS | PARSE_METHODS | PARSE_ATTRIBUTES,
+
+		/* Decode constant pool entries on first access (see `ConstantPool::parse_lazy`) */
+		PARSE_LAZY_CONSTANT_POOL = 1 << 5,
+
+		/* Keep the original bytes, so unmodified sections are copied when encoding */
+		PARSE_RETAIN_SOURCE      = 1 << 6,
+	};
+
+	struct ParseOptions {
+		u4 flags = PARSE_ALL;
+
+		// If not empty, only attributes with these names are kept
+		// (on the levels enabled by `flags`), the rest are skipped.
+		std::vector<std::string> attribute_names = {};
+
+		// If set, Utf8 constants are shared through this interner instead of
+		// being copied into every class. It must outlive the parsed classes.
+		StringInterner *interner = nullptr;
+
+		inline bool has(u4 flag) const
+		{
+			return (this->flags & flag) == flag;
+		}
+
+		bool wants_attribute(ConstantPool &constant_pool, u2 attribute_name_index) const;
+	};
 
 	class ClassFile {
 	public:
@@ -69,6 +219,19 @@ namespace jcfp {
 		// u2 attributes_count;
 		// attribute_info attributes[attributes_count];
 		std::vector<AttributeInfo> attributes;
+
+		/*
+		 * Original bytes of the ClassFile (see PARSE_RETAIN_SOURCE) and the
+		 * ranges of the sections that were not modified since parsing.
+		 * `encode` copies those ranges instead of encoding them again.
+		 *
+		 * The constant pool tracks its own changes, as does `relocate`.
+		 * Anything modified in place must be marked with `mark_dirty`
+		 * (in the ClassFile, its constant pool, or a field/method).
+		 */
+		std::shared_ptr<const std::vector<u1>> source;
+		SourceRange constant_pool_source = {};
+		SourceRange attributes_source = {}; // Class attributes, including the count
 	public:
 		ClassFile(u4 magic,
 			  u2 minor_version,
@@ -82,18 +245,58 @@ namespace jcfp {
 			  std::vector<MethodInfo> methods,
 			  std::vector<AttributeInfo> attributes)
 		: magic(magic), minor_version(minor_version), major_version(major_version),
-		  constant_pool(constant_pool), access_flags(access_flags), this_class(this_class),
-		  super_class(super_class), interfaces(interfaces), fields(fields), methods(methods),
-		  attributes(attributes)
+		  constant_pool(std::move(constant_pool)), access_flags(access_flags), this_class(this_class),
+		  super_class(super_class), interfaces(std::move(interfaces)), fields(std::move(fields)),
+		  methods(std::move(methods)), attributes(std::move(attributes))
 		{}
 	public:
-		static std::expected<ClassFile, Error> parse(const u1 *bytes, size_t max_length);
-		static inline std::expected<ClassFile, Error> parse(const std::vector<u1> &bytes) { return parse(bytes.data(), bytes.size()); }
+		static std::expected<ClassFile, Error> parse(const u1 *bytes, size_t max_length, const ParseOptions &options = ParseOptions());
+		static inline std::expected<ClassFile, Error> parse(const std::vector<u1> &bytes, const ParseOptions &options = ParseOptions()) { return parse(bytes.data(), bytes.size(), options); }
 		static inline std::expected<ClassFile, Error> parse(const u1 *bytes) { return parse(bytes, 0); }
 		std::vector<u1> encode();
-		void encode(ByteStream &stream);
+		template <Sink S>
+		void encode(S &stream);
 		void relocate(int diff, u2 from);
 	public:
+		// Call after modifying the class attributes
+		inline void mark_attributes_dirty()
+		{
+			this->attributes_source = {};
+		}
+
+		inline bool is_unmodified(const SourceRange &range)
+		{
+			return range.is_in(this->source);
+		}
+
+		template <Sink S>
+		inline void encode_source(const SourceRange &range, S &stream)
+		{
+			stream.write_bytes(&this->source->data()[range.offset], range.length);
+		}
+
+		/*
+		 * Heap bytes used by the class, see MemoryUsage. The original bytes
+		 * (see PARSE_RETAIN_SOURCE) are counted in full, even if they are
+		 * shared with copies of the class.
+		 */
+		MemoryUsage memory_usage() const;
+
+		// Releases the capacity that is reserved but not used, everywhere in the class
+		void shrink_to_fit();
+
+		// Forgets the original bytes, everything is encoded again
+		inline void mark_dirty()
+		{
+			this->source = nullptr;
+			this->constant_pool.mark_dirty();
+			this->attributes_source = {};
+			for (auto &field : this->fields)
+				field.mark_dirty();
+			for (auto &method : this->methods)
+				method.mark_dirty();
+		}
+
 		inline std::vector<std::string> get_attribute_names()
 		{
 			std::vector<std::string> attrs;
@@ -116,6 +319,72 @@ namespace jcfp {
 			return {};
 		}
 	};
+
+	template <Sink S>
+	void ClassFile::encode(S &stream)
+	{
+		LOG("Encoding ClassFile to bytes...");
+		JCFP_TRACE_BEGIN(encode_trace, TracePhase::Encode, trace_sink_size(stream));
+
+		write_be(stream, this->magic);
+		write_be(stream, this->minor_version);
+		write_be(stream, this->major_version);
+
+		LOG("Encoding constant pool...");
+		if (this->is_unmodified(this->constant_pool_source) && !this->constant_pool.is_modified())
+			this->encode_source(this->constant_pool_source, stream);
+		else
+			constant_pool.encode(stream);
+
+		write_be(stream, this->access_flags);
+		write_be(stream, this->this_class);
+		write_be(stream, this->super_class);
+
+		LOG("Encoding interfaces...");
+		u2 interfaces_count = static_cast<u2>(this->interfaces.size());
+		write_be(stream, interfaces_count);
+		for (auto &interface : this->interfaces) {
+			write_be(stream, interface);
+		}
+
+		LOG("Encoding fields...");
+		u2 fields_count = static_cast<u2>(this->fields.size());
+		write_be(stream, fields_count);
+		for (auto &field : this->fields) {
+			if (this->is_unmodified(field.source)) {
+				this->encode_source(field.source, stream);
+				continue;
+			}
+
+			field.encode(stream);
+		}
+
+		LOG("Encoding methods...");
+		u2 methods_count = static_cast<u2>(this->methods.size());
+		write_be(stream, methods_count);
+		for (auto &method : this->methods) {
+			if (this->is_unmodified(method.source)) {
+				this->encode_source(method.source, stream);
+				continue;
+			}
+
+			method.encode(stream);
+		}
+
+		LOG("Encoding attributes...");
+		if (this->is_unmodified(this->attributes_source)) {
+			this->encode_source(this->attributes_source, stream);
+		} else {
+			u2 attributes_count = static_cast<u2>(this->attributes.size());
+			write_be(stream, attributes_count);
+			for (auto &attribute : this->attributes) {
+				attribute.encode(stream);
+			}
+		}
+
+		JCFP_TRACE_END(encode_trace, trace_sink_size(stream));
+		LOG("ClassFile encoding finished successfully");
+	}
 }
 
 #endif
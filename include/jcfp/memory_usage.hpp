@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_MEMORY_USAGE_HPP_
+#define _JCFP_MEMORY_USAGE_HPP_
+
+#include <string>
+#include <vector>
+
+namespace jcfp {
+	/*
+	 * Heap bytes owned by a structure (not counting the structure itself),
+	 * by category. Allocator overhead is not included.
+	 */
+	struct MemoryUsage {
+		size_t constant_pool_entries = 0;
+		size_t utf8_payloads = 0;   // Owned Utf8 strings (interned ones belong to their StringInterner)
+		size_t attribute_blobs = 0; // Attribute bodies
+		size_t structure = 0;       // Arrays of interfaces, members and attributes
+		size_t source = 0;          // Original bytes kept by lazy pools and PARSE_RETAIN_SOURCE (may be shared)
+		size_t slack = 0;           // Capacity reserved but unused by all of the above
+
+		inline size_t total() const
+		{
+			return this->constant_pool_entries + this->utf8_payloads + this->attribute_blobs +
+			       this->structure + this->source + this->slack;
+		}
+
+		inline MemoryUsage &operator+=(const MemoryUsage &other)
+		{
+			this->constant_pool_entries += other.constant_pool_entries;
+			this->utf8_payloads += other.utf8_payloads;
+			this->attribute_blobs += other.attribute_blobs;
+			this->structure += other.structure;
+			this->source += other.source;
+			this->slack += other.slack;
+			return *this;
+		}
+
+		// Adds the storage of `vector` to `category`, and its unused capacity to `slack`
+		template <typename T>
+		inline void add(size_t MemoryUsage::*category, const std::vector<T> &vector)
+		{
+			this->*category += vector.size() * sizeof(T);
+			this->slack += (vector.capacity() - vector.size()) * sizeof(T);
+		}
+
+		// Same as `add` for a string, which only uses the heap when it is too long to be stored inline
+		inline void add(size_t MemoryUsage::*category, const std::string &str)
+		{
+			const char *data = str.data();
+			const char *object = reinterpret_cast<const char *>(&str);
+			if (data >= object && data < object + sizeof(str))
+				return;
+
+			this->*category += str.size() + 1;
+			this->slack += str.capacity() - str.size();
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_PARALLEL_HPP_
+#define _JCFP_PARALLEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jcfp {
+	// Number of threads used when 0 is requested
+	inline unsigned default_thread_count()
+	{
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	/*
+	 * Calls `f(i)` for every `i` in [0, count), spread across `threads`
+	 * workers (the calling thread included). Indices are handed out one at
+	 * a time, so uneven jobs (e.g. classes of very different sizes) still
+	 * balance. If any call throws, the first exception is rethrown after
+	 * every worker has stopped.
+	 */
+	template <typename F>
+	void parallel_for(size_t count, F &&f, unsigned threads = 0)
+	{
+		if (threads == 0)
+			threads = default_thread_count();
+		threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+		if (threads <= 1) {
+			for (size_t i = 0; i < count; ++i)
+				f(i);
+			return;
+		}
+
+		std::atomic<size_t> next = 0;
+		std::exception_ptr exception;
+		std::mutex exception_mutex;
+
+		auto worker = [&]() {
+			try {
+				for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+					f(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(exception_mutex);
+				if (!exception)
+					exception = std::current_exception();
+				next = count; // Stop handing out work
+			}
+		};
+
+		{
+			std::vector<std::jthread> workers;
+			workers.reserve(threads - 1);
+			for (unsigned i = 1; i < threads; ++i)
+				workers.emplace_back(worker);
+			worker();
+		}
+
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_PIPELINE_HPP_
+#define _JCFP_PIPELINE_HPP_
+
+#include <bitset>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include "jcfp.hpp"
+#include "bytecode.hpp"
+#include "event_parser.hpp"
+
+namespace jcfp {
+	/* What a Pass wants to be called for, see Pass::interests */
+	enum PassInterest : u4 {
+		INTEREST_CONSTANTS  = 1 << 0, // on_constant
+		INTEREST_MEMBERS    = 1 << 1, // on_field, on_method
+		INTEREST_ATTRIBUTES = 1 << 2, // on_attribute, for the names in `attribute_names`
+		INTEREST_BYTECODE   = 1 << 3, // on_instruction, for the opcodes in `opcodes`
+	};
+
+	/*
+	 * State of a Pipeline run, given to every hook. The "current item" is
+	 * the constant, member or attribute the hook was called for (the
+	 * `Code` attribute for on_instruction).
+	 */
+	class PassContext {
+	public:
+		ClassFile &classfile;
+		AttributeOwner owner = { AttributeOwner::Class, 0 }; // Owner of the current attribute or instruction
+	private:
+		bool removed = false;
+		bool dirty = false;
+		std::optional<Error> error;
+
+		friend class Pipeline;
+	public:
+		PassContext(ClassFile &classfile) : classfile(classfile) {}
+	public:
+		/*
+		 * Removes the current member or attribute once every pass has seen it
+		 * (the following passes are still called for it). Constants and
+		 * instructions can't be removed this way, unused constants are removed
+		 * at the end of the run.
+		 */
+		inline void remove()
+		{
+			this->removed = true;
+		}
+
+		inline bool is_removed() const
+		{
+			return this->removed;
+		}
+
+		// Call after modifying the current item in place (see ClassFile::mark_dirty)
+		inline void mark_dirty()
+		{
+			this->dirty = true;
+		}
+
+		// Stops the run, which returns `error`. The class is left partially transformed.
+		inline void fail(Error error)
+		{
+			if (!this->error)
+				this->error = error;
+		}
+	};
+
+	/*
+	 * A transform run by a Pipeline. It is only called for what it declares
+	 * in `interests`, which are read once when the pass is added.
+	 *
+	 * Passes must not call `relocate`, nor remove or reorder constant pool
+	 * entries: the pipeline compacts the constant pool once, after every
+	 * pass ran. New entries can be added with `push_entry`, and entries that
+	 * are not used anymore are removed by the compaction.
+	 */
+	class Pass {
+	public:
+		virtual ~Pass() = default;
+
+		virtual u4 interests() const = 0;
+
+		// Attribute names for INTEREST_ATTRIBUTES, all of them if empty
+		virtual std::vector<std::string> attribute_names() const { return {}; }
+
+		// Opcodes for INTEREST_BYTECODE, all of them by default
+		virtual std::bitset<256> opcodes() const { return std::bitset<256>().set(); }
+	public:
+		virtual void begin_class(PassContext &) {}
+		virtual void on_constant(PassContext &, u2 /* index */, ConstantPoolEntry &) {}
+		virtual void on_field(PassContext &, FieldInfo &) {}
+		virtual void on_method(PassContext &, MethodInfo &) {}
+		virtual void on_attribute(PassContext &, AttributeInfo &) {}
+
+		// `code` is the bytecode inside the current `Code` attribute, which can be patched in place
+		virtual void on_instruction(PassContext &, std::span<u1> /* code */, size_t /* pc */, Opcode) {}
+		virtual void end_class(PassContext &) {}
+	};
+
+	/*
+	 * Runs many passes over a class in a single traversal: the constant
+	 * pool, then each field and method (header, attributes, and bytecode of
+	 * its `Code` attribute), then the class attributes. Every item is given
+	 * to the interested passes in the order they were added, so a pass sees
+	 * the changes made by the previous ones to that item.
+	 *
+	 * Sections that no pass is interested in are not visited. Afterwards,
+	 * the constant pool is compacted once (see `compact_constant_pool`)
+	 * instead of once per transform.
+	 *
+	 * NOTE: The pipeline owns its passes and calls them without locking,
+	 *       so a Pipeline must not run on multiple threads at once.
+	 */
+	class Pipeline {
+	private:
+		struct Stage {
+			std::unique_ptr<Pass> pass;
+			u4 interests;
+			std::vector<std::string> attribute_names;
+			std::bitset<256> opcodes;
+		};
+
+		std::vector<Stage> stages;
+		u4 interests = 0;
+	public:
+		Pipeline &add(std::unique_ptr<Pass> pass);
+
+		template <typename T, typename... Args>
+		inline Pipeline &add(Args &&...args)
+		{
+			return this->add(std::make_unique<T>(std::forward<Args>(args)...));
+		}
+
+		/*
+		 * Runs every pass on `classfile`, and returns the number of constant
+		 * pool entries the compaction removed. The compaction is skipped if
+		 * the class was not modified.
+		 */
+		std::expected<size_t, Error> run(ClassFile &classfile);
+	private:
+		bool wants_attribute(const Stage &stage, ConstantPool &constant_pool, u2 attribute_name_index) const;
+		template <typename Member>
+		bool visit_member(PassContext &context, Member &member, AttributeOwner owner) const;
+		void visit_attributes(PassContext &context, std::vector<AttributeInfo> &attributes, bool &modified) const;
+		void visit_code(PassContext &context, AttributeInfo &attribute) const;
+	};
+
+	// Removes the attributes with the given names, at every level (e.g. the debug attributes)
+	class StripAttributesPass : public Pass {
+	private:
+		std::vector<std::string> names;
+	public:
+		StripAttributesPass(std::vector<std::string> names) : names(std::move(names)) {}
+	public:
+		u4 interests() const override { return INTEREST_ATTRIBUTES; }
+		std::vector<std::string> attribute_names() const override { return this->names; }
+		void on_attribute(PassContext &context, AttributeInfo &) override { context.remove(); }
+	};
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_REFERENCE_GRAPH_HPP_
+#define _JCFP_REFERENCE_GRAPH_HPP_
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "jcfp.hpp"
+#include "interner.hpp"
+
+namespace jcfp {
+	/*
+	 * Member and class references of a batch of classes.
+	 *
+	 * Symbols are classes (`java/lang/Object`), fields (`Owner.name:I`) and
+	 * methods (`Owner.name:()V`), each with a dense SymbolId. There are two
+	 * graphs, both stored as CSR arrays in both directions:
+	 *
+	 *   - Member references: method -> field or method it uses. Taken from the
+	 *     invoke and field instructions of the `Code` attributes. A class
+	 *     parsed without its `Code` attributes falls back to its Fieldref,
+	 *     Methodref and InterfaceMethodref constants, with the class itself
+	 *     as the referencing symbol.
+	 *   - Class references: class -> every class named by its Class constants.
+	 *
+	 * Each class is scanned in parallel, and the edges are merged with
+	 * atomic counters, without locks. Duplicate edges are removed, and the
+	 * edges of each symbol are sorted by id.
+	 */
+	class ReferenceGraph {
+	public:
+		using SymbolId = u4;
+
+		enum class SymbolKind : u1 {
+			Class,
+			Field,
+			Method,
+		};
+
+		struct Adjacency {
+			std::vector<u4> offsets;
+			std::vector<SymbolId> targets;
+
+			inline std::span<const SymbolId> operator[](SymbolId id) const
+			{
+				return { this->targets.data() + this->offsets[id], this->targets.data() + this->offsets[id + 1] };
+			}
+		};
+	private:
+		std::unique_ptr<StringInterner> owned_interner;
+		std::vector<const std::string *> names;
+		std::vector<SymbolKind> kinds;
+		std::unordered_map<std::string_view, SymbolId> ids;
+
+		Adjacency member_references;
+		Adjacency member_referrers;
+		Adjacency class_references;
+		Adjacency class_referrers;
+	public:
+		/*
+		 * Scans `classes` on `threads` threads. If a class is defined more
+		 * than once, only the first definition is scanned. The symbol names
+		 * are stored in `interner`, or in an interner owned by the graph.
+		 */
+		static ReferenceGraph build(std::span<ClassFile> classes, StringInterner *interner = nullptr, unsigned threads = 0);
+	public:
+		inline size_t size() const
+		{
+			return this->names.size();
+		}
+
+		inline size_t edge_count() const
+		{
+			return this->member_references.targets.size() + this->class_references.targets.size();
+		}
+
+		inline std::optional<SymbolId> find(std::string_view name) const
+		{
+			auto it = this->ids.find(name);
+			if (it == this->ids.end())
+				return {};
+			return it->second;
+		}
+
+		inline const std::string &name(SymbolId id) const
+		{
+			return *this->names[id];
+		}
+
+		inline SymbolKind kind(SymbolId id) const
+		{
+			return this->kinds[id];
+		}
+
+		// Fields and methods used by a method (or by a class, see above)
+		inline std::span<const SymbolId> callees(SymbolId id) const
+		{
+			return this->member_references[id];
+		}
+
+		// Methods (or classes) that use a field or method
+		inline std::span<const SymbolId> callers(SymbolId id) const
+		{
+			return this->member_referrers[id];
+		}
+
+		inline std::span<const SymbolId> referenced_classes(SymbolId id) const
+		{
+			return this->class_references[id];
+		}
+
+		inline std::span<const SymbolId> referencing_classes(SymbolId id) const
+		{
+			return this->class_referrers[id];
+		}
+	};
+}
+
+#endif
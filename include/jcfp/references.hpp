@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_REFERENCES_HPP_
+#define _JCFP_REFERENCES_HPP_
+
+#include <expected>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	/* Position of a constant pool index inside the body of an attribute */
+	struct ReferenceSite {
+		u4 offset; // Relative to the start of `AttributeInfo::info`
+		u1 width;  // 1 for the operand of `ldc`, 2 otherwise (big endian)
+		bool descriptor = false; // Utf8 descriptor of an annotation (type, enum type or class literal)
+	};
+
+	/*
+	 * Maps every old constant pool index to its new one. Its size is the
+	 * old `constant_pool_count`, and removed entries map to 0.
+	 */
+	using RemapTable = std::vector<u2>;
+
+	/*
+	 * Finds every constant pool index stored in the body of `attribute`,
+	 * including the bytecode, exception table and nested attributes of a
+	 * `Code` attribute. The attribute's own name index is not included, and
+	 * neither are the 0 indices (meaning "none").
+	 *
+	 * Returns Unsupported for attributes with an unknown layout, since they
+	 * may hold indices that can't be found, and Malformed if the body is
+	 * truncated.
+	 */
+	std::expected<std::vector<ReferenceSite>, Error> find_references(ConstantPool &constant_pool, const AttributeInfo &attribute);
+
+	// Returns the Utf8 constant at `index`, or nothing if there is none
+	using Utf8Lookup = std::function<std::optional<std::string_view>(u2 index)>;
+
+	/*
+	 * Same as above, for an attribute body that is not part of a ClassFile
+	 * (e.g. while streaming over the original bytes). The names of the
+	 * attributes are read through `utf8`.
+	 */
+	std::expected<std::vector<ReferenceSite>, Error> find_references(const Utf8Lookup &utf8, u2 attribute_name_index, std::span<const u1> body);
+
+	/*
+	 * Every constant pool index used outside of the constant pool: the class
+	 * header, the fields and methods, and every attribute (see
+	 * `find_references`). May contain duplicates.
+	 */
+	std::expected<std::vector<u2>, Error> find_references(ClassFile &classfile);
+
+	/*
+	 * Marks every constant pool entry used by the class, directly or through
+	 * other entries. The result is indexed by constant pool index.
+	 */
+	std::expected<std::vector<bool>, Error> find_used_entries(ClassFile &classfile);
+
+	/*
+	 * Rewrites the constant pool indices of an attribute, given its sites.
+	 * Fails without modifying anything if an `ldc` operand does not fit in
+	 * a byte anymore, or if an index is not in the table.
+	 */
+	std::expected<void, Error> remap_references(AttributeInfo &attribute, std::span<const ReferenceSite> sites, const RemapTable &table);
+
+	/*
+	 * Rewrites every constant pool index of the class, including the ones
+	 * inside the constant pool entries. The entries themselves are not
+	 * moved. Fails without modifying anything if an index can't be remapped.
+	 */
+	std::expected<void, Error> remap_references(ClassFile &classfile, const RemapTable &table);
+
+	/*
+	 * Removes the constant pool entries the class does not use, merges the
+	 * duplicate entries into their first occurrence, and renumbers the rest
+	 * with a single remap of every reference. Returns the number of entries
+	 * removed.
+	 */
+	std::expected<size_t, Error> compact_constant_pool(ClassFile &classfile);
+
+	/*
+	 * Copies constant pool entries from `source` into `target`, along with
+	 * every entry they reference (e.g. Methodref -> Class -> Utf8). Entries
+	 * that already exist in `target` are reused instead of copied.
+	 *
+	 * The entries of `target` are indexed once, and the imported ones are
+	 * remembered, so a single importer can move many attributes between
+	 * the same two classes. `target` must not be modified by other means
+	 * while the importer is in use.
+	 *
+	 * Dynamic and InvokeDynamic entries point into the `BootstrapMethods`
+	 * attribute of their class. An importer made from two ClassFiles copies
+	 * the bootstrap methods they use too (reusing the equal ones), one made
+	 * from two ConstantPools returns Unsupported for them.
+	 */
+	class ConstantPoolImporter {
+	private:
+		static constexpr u2 visiting = 0xFFFF;
+		static constexpr size_t none = static_cast<size_t>(-1);
+
+		ConstantPool &target;
+		ConstantPool &source;
+		ClassFile *target_class = nullptr;
+		ClassFile *source_class = nullptr;
+		std::unordered_map<std::string, u2> target_entries;
+		RemapTable table;
+
+		// Indexed on the first Dynamic or InvokeDynamic entry
+		bool bootstrap_indexed = false;
+		size_t source_bootstrap_attribute = none;
+		std::vector<size_t> source_bootstrap_offsets;
+		size_t target_bootstrap_attribute = none;
+		std::unordered_map<std::string, u2> target_bootstrap_methods;
+		std::unordered_map<u2, u2> bootstrap_table;
+	public:
+		ConstantPoolImporter(ConstantPool &target, ConstantPool &source);
+		ConstantPoolImporter(ClassFile &target, ClassFile &source);
+	public:
+		// Imports the entry at `index` of `source`, returning its index in `target`
+		std::expected<u2, Error> import(u2 index);
+
+		/*
+		 * Rewrites an attribute of the source class (e.g. a `Code`
+		 * attribute) so it can be used in the target class, importing
+		 * every entry it references. The attribute is not modified on
+		 * error, though the entries imported so far are left in `target`.
+		 */
+		std::expected<void, Error> import_attribute(AttributeInfo &attribute);
+
+		// Maps the indices of `source` to the ones of `target` (0 for the entries not imported)
+		inline const RemapTable &get_table() const
+		{
+			return this->table;
+		}
+	private:
+		std::expected<u2, Error> add(ConstantPoolEntry entry, u2 index);
+		std::expected<void, Error> index_bootstrap_methods();
+		std::expected<u2, Error> import_bootstrap_method(u2 index);
+	};
+
+	/*
+	 * Copies the entries at `indices` of `source` into `target` with a new
+	 * ConstantPoolImporter, and returns its table.
+	 */
+	std::expected<RemapTable, Error> import_from(ConstantPool &target, ConstantPool &source, std::span<const u2> indices);
+
+	// Imports a single attribute with a new ConstantPoolImporter, see above
+	std::expected<void, Error> import_attribute(ConstantPool &target, ConstantPool &source, AttributeInfo &attribute);
+	std::expected<void, Error> import_attribute(ClassFile &target, ClassFile &source, AttributeInfo &attribute);
+
+	// Calls `f(u2 &index)` on every constant pool index stored in the entry
+	template <typename F>
+	void for_each_reference(ConstantPoolEntry &entry, F &&f)
+	{
+		using Entry = ConstantPoolEntry;
+
+		switch (entry.tag) {
+		case Entry::Tag::Class:
+			f(entry.get<Entry::ClassInfo>().name_index);
+			break;
+		case Entry::Tag::Fieldref:
+			f(entry.get<Entry::FieldrefInfo>().class_index);
+			f(entry.get<Entry::FieldrefInfo>().name_and_type_index);
+			break;
+		case Entry::Tag::Methodref:
+			f(entry.get<Entry::MethodrefInfo>().class_index);
+			f(entry.get<Entry::MethodrefInfo>().name_and_type_index);
+			break;
+		case Entry::Tag::InterfaceMethodref:
+			f(entry.get<Entry::InterfaceMethodrefInfo>().class_index);
+			f(entry.get<Entry::InterfaceMethodrefInfo>().name_and_type_index);
+			break;
+		case Entry::Tag::String:
+			f(entry.get<Entry::StringInfo>().string_index);
+			break;
+		case Entry::Tag::NameAndType:
+			f(entry.get<Entry::NameAndTypeInfo>().name_index);
+			f(entry.get<Entry::NameAndTypeInfo>().descriptor_index);
+			break;
+		case Entry::Tag::MethodHandle:
+			f(entry.get<Entry::MethodHandleInfo>().reference_index);
+			break;
+		case Entry::Tag::MethodType:
+			f(entry.get<Entry::MethodTypeInfo>().descriptor_index);
+			break;
+		case Entry::Tag::Dynamic:
+			// The bootstrap method index points to the BootstrapMethods attribute
+			f(entry.get<Entry::DynamicInfo>().name_and_type_index);
+			break;
+		case Entry::Tag::InvokeDynamic:
+			f(entry.get<Entry::InvokeDynamicInfo>().name_and_type_index);
+			break;
+		case Entry::Tag::Module:
+			f(entry.get<Entry::ModuleInfo>().name_index);
+			break;
+		case Entry::Tag::Package:
+			f(entry.get<Entry::PackageInfo>().name_index);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+#endif
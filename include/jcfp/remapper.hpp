@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_REMAPPER_HPP_
+#define _JCFP_REMAPPER_HPP_
+
+#include <array>
+#include <expected>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "jcfp.hpp"
+#include "pipeline.hpp"
+
+namespace jcfp {
+	/*
+	 * Renaming table for classes, packages and members. Names are internal
+	 * names (`java/lang/Object`), members are given as
+	 * `Owner.name:descriptor` with the old names, like in the Shrinker.
+	 */
+	class Mapping {
+	private:
+		struct Hash {
+			using is_transparent = void;
+			inline size_t operator()(std::string_view str) const
+			{
+				return std::hash<std::string_view>{}(str);
+			}
+		};
+
+		using Table = std::unordered_map<std::string, std::string, Hash, std::equal_to<>>;
+
+		Table classes;
+		std::vector<std::pair<std::string, std::string>> packages;
+		Table members;
+	public:
+		inline void add_class(std::string name, std::string new_name)
+		{
+			this->classes.insert_or_assign(std::move(name), std::move(new_name));
+		}
+
+		// Moves every class starting with `prefix` (e.g. `com/google/`) that has no class mapping
+		inline void add_package(std::string prefix, std::string new_prefix)
+		{
+			this->packages.emplace_back(std::move(prefix), std::move(new_prefix));
+		}
+
+		inline void add_member(std::string symbol, std::string new_name)
+		{
+			this->members.insert_or_assign(std::move(symbol), std::move(new_name));
+		}
+	public:
+		// New name of a class, or `name` itself. The longest matching package wins.
+		std::string map_class(std::string_view name) const;
+
+		// New name of a member, or nullptr if it is not renamed
+		const std::string *map_member(std::string_view owner, std::string_view name, std::string_view descriptor) const;
+
+		inline bool renames_members() const
+		{
+			return !this->members.empty();
+		}
+	};
+
+	/*
+	 * Rewrites classes according to a Mapping: class names (including the
+	 * ones in array types), descriptors, member names and references, the
+	 * `Signature`, `LocalVariableTable`, `LocalVariableTypeTable` and
+	 * `EnclosingMethod` attributes, the record components (descriptors and
+	 * signatures), and the types and class literals of annotations.
+	 *
+	 * Utf8 entries are never modified in place. References to renamed
+	 * entries are pointed to new (or already existing) entries instead, so
+	 * a Utf8 shared between a class name and a string literal keeps its
+	 * value for the literal. The old entries are removed afterwards if they
+	 * are not used anymore (see Pipeline).
+	 *
+	 * Member references are only renamed when their owner is the class
+	 * given in the mapping (inherited members must be mapped in every
+	 * subclass), and string literals, annotation element names and the
+	 * simple names of InnerClasses are left as is.
+	 *
+	 * Every descriptor and signature is parsed once: the results are cached
+	 * in a thread-safe table, shared by all the classes remapped with this
+	 * Remapper.
+	 */
+	class Remapper {
+	private:
+		static constexpr size_t shard_count = 64;
+
+		struct Hash {
+			using is_transparent = void;
+			inline size_t operator()(std::string_view str) const
+			{
+				return std::hash<std::string_view>{}(str);
+			}
+		};
+
+		struct Shard {
+			std::mutex mutex;
+			std::unordered_map<std::string, std::string, Hash, std::equal_to<>> descriptors;
+		};
+
+		const Mapping &mapping;
+		std::array<Shard, shard_count> shards;
+	public:
+		Remapper(const Mapping &mapping) : mapping(mapping) {}
+		Remapper(const Remapper &) = delete;
+		Remapper &operator=(const Remapper &) = delete;
+	public:
+		inline const Mapping &get_mapping() const
+		{
+			return this->mapping;
+		}
+
+		// A class name as stored in a Class entry (an internal name or an array descriptor)
+		std::string map_class_name(std::string_view name);
+
+		/*
+		 * A field or method descriptor, or a generic signature. Malformed
+		 * ones are left as is. The result stays valid for the lifetime of
+		 * the Remapper.
+		 */
+		const std::string &map_descriptor(std::string_view descriptor);
+
+		std::expected<void, Error> remap(ClassFile &classfile);
+
+		// Remaps a whole classpath in parallel. Fails with the first error, after every class was processed.
+		std::expected<void, Error> remap(std::vector<ClassFile> &classes, unsigned threads = 0);
+	};
+
+	// Remapper as a Pass, to be fused with other transforms (see Pipeline)
+	class RemapPass : public Pass {
+	private:
+		Remapper &remapper;
+
+		std::string this_name;
+		std::vector<u2> class_names; // Original name of each Class entry, by constant pool index
+		std::unordered_map<std::string, u2> utf8_indices;
+		std::unordered_map<u4, u2> name_and_type_indices;
+	public:
+		RemapPass(Remapper &remapper) : remapper(remapper) {}
+	public:
+		u4 interests() const override { return INTEREST_CONSTANTS | INTEREST_MEMBERS | INTEREST_ATTRIBUTES; }
+		std::vector<std::string> attribute_names() const override
+		{
+			return {
+				"Signature", "LocalVariableTable", "LocalVariableTypeTable", "EnclosingMethod", "Record",
+				"RuntimeVisibleAnnotations", "RuntimeInvisibleAnnotations",
+				"RuntimeVisibleParameterAnnotations", "RuntimeInvisibleParameterAnnotations",
+				"RuntimeVisibleTypeAnnotations", "RuntimeInvisibleTypeAnnotations", "AnnotationDefault"
+			};
+		}
+
+		void begin_class(PassContext &context) override;
+		void on_constant(PassContext &context, u2 index, ConstantPoolEntry &entry) override;
+		void on_field(PassContext &context, FieldInfo &field) override;
+		void on_method(PassContext &context, MethodInfo &method) override;
+		void on_attribute(PassContext &context, AttributeInfo &attribute) override;
+	private:
+		// Index of a Utf8 entry with `value`, added if there is none
+		u2 utf8_index(ConstantPool &constant_pool, const std::string &value);
+		u2 name_and_type_index(ConstantPool &constant_pool, u2 name_index, u2 descriptor_index);
+
+		template <typename Member>
+		void remap_member(PassContext &context, Member &member);
+		void remap_enclosing_method(PassContext &context, AttributeInfo &attribute);
+		void remap_record(PassContext &context, AttributeInfo &attribute);
+	};
+}
+
+#endif
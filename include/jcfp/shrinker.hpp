@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_SHRINKER_HPP_
+#define _JCFP_SHRINKER_HPP_
+
+#include <expected>
+#include <string>
+#include <vector>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	struct ShrinkStats {
+		size_t classes_removed = 0;
+		size_t fields_removed = 0;
+		size_t methods_removed = 0;
+		size_t constants_removed = 0;
+	};
+
+	/*
+	 * Removes the classes, fields and methods of a batch that can't be
+	 * reached from the entry points, then compacts the constant pool of
+	 * every class that changed.
+	 *
+	 * Everything referenced by a reachable member (through its bytecode,
+	 * descriptors and attributes) is reachable, as is everything referenced
+	 * by a reachable class itself (supertypes, `<clinit>`, class attributes
+	 * other than InnerClasses, NestMembers and PermittedSubclasses).
+	 *
+	 * Virtual methods are kept if they override a reachable method of a
+	 * supertype. Since the classes outside the batch are unknown, a method
+	 * is also kept if its class has a supertype outside the batch other
+	 * than `java/lang/Object`, or if it overrides one of the methods of
+	 * `java/lang/Object`.
+	 *
+	 * Reflection is not tracked, anything used that way must be an entry
+	 * point. The reachable set is computed level by level, each level in
+	 * parallel.
+	 */
+	class Shrinker {
+	private:
+		std::vector<std::string> kept_classes;
+		std::vector<std::string> kept_members;
+	public:
+		// Keeps a class and all of its members (e.g. a main class)
+		inline void keep_class(std::string name)
+		{
+			this->kept_classes.push_back(std::move(name));
+		}
+
+		// Keeps a single member, given as `Owner.name:descriptor`
+		inline void keep_member(std::string symbol)
+		{
+			this->kept_members.push_back(std::move(symbol));
+		}
+
+		// On failure, `classes` is left unchanged
+		std::expected<ShrinkStats, Error> shrink(std::vector<ClassFile> &classes, unsigned threads = 0);
+	};
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_SINK_HPP_
+#define _JCFP_SINK_HPP_
+
+#include <cstring>
+#include <unistd.h>
+#include <cerrno>
+#include "utils.hpp"
+#include "basetypes.hpp"
+
+/*
+ * Sinks that the encoders can write to without materializing the class
+ * in memory (see the `Sink` concept in `utils.hpp`)
+ */
+
+namespace jcfp {
+	// Counts the bytes written, useful to get the encoded size of something
+	class CountingSink {
+	private:
+		size_t count = 0;
+	public:
+		inline void write_bytes(const u1 *, size_t size)
+		{
+			this->count += size;
+		}
+
+		inline size_t size()
+		{
+			return this->count;
+		}
+	};
+
+	// 64-bit FNV-1a hash of the bytes written
+	class Fnv1aSink {
+	private:
+		uint64_t hash = 0xcbf29ce484222325;
+	public:
+		inline void write_bytes(const u1 *buf, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i) {
+				this->hash ^= buf[i];
+				this->hash *= 0x100000001b3;
+			}
+		}
+
+		inline uint64_t digest()
+		{
+			return this->hash;
+		}
+	};
+
+	/*
+	 * Buffered writer over a file descriptor. The descriptor is not owned.
+	 * Errors are sticky: after a failed write, nothing else is written and
+	 * `error` returns the `errno` of the failure.
+	 */
+	class FdSink {
+	private:
+		int fd;
+		int err = 0;
+		size_t length = 0;
+		u1 buffer[0x10000];
+	public:
+		FdSink(int fd) : fd(fd) {}
+		FdSink(const FdSink &) = delete;
+		~FdSink()
+		{
+			this->flush();
+		}
+	public:
+		inline void write_bytes(const u1 *buf, size_t size)
+		{
+			if (this->length + size > sizeof(this->buffer)) {
+				this->flush();
+
+				// Too big to be worth buffering
+				if (size >= sizeof(this->buffer)) {
+					this->write_all(buf, size);
+					return;
+				}
+			}
+
+			std::memcpy(&this->buffer[this->length], buf, size);
+			this->length += size;
+		}
+
+		inline bool flush()
+		{
+			this->write_all(this->buffer, this->length);
+			this->length = 0;
+			return this->err == 0;
+		}
+
+		inline int error()
+		{
+			return this->err;
+		}
+	private:
+		inline void write_all(const u1 *buf, size_t size)
+		{
+			while (size > 0 && this->err == 0) {
+				ssize_t written = ::write(this->fd, buf, size);
+				if (written < 0) {
+					if (errno != EINTR)
+						this->err = errno;
+					continue;
+				}
+
+				buf += written;
+				size -= written;
+			}
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_STRIP_HPP_
+#define _JCFP_STRIP_HPP_
+
+#include <span>
+#include <expected>
+#include <string_view>
+#include <unordered_map>
+#include "jcfp.hpp"
+
+/*
+ * Streaming attribute stripper. Copies a class from its raw bytes to a
+ * sink, dropping the attributes with the given names from the class, its
+ * fields and methods, and their `Code` attributes, and fixing up the
+ * attribute counts and lengths on the way. No ClassFile is built: the
+ * constant pool is scanned once to find the names and copied as is, so
+ * the Utf8 entries of the stripped names are left in it.
+ */
+
+namespace jcfp {
+	// Attributes only used by debuggers and stack traces
+	inline constexpr std::string_view debug_attributes[] = {
+		"LineNumberTable",
+		"LocalVariableTable",
+		"LocalVariableTypeTable",
+		"SourceDebugExtension",
+	};
+
+	namespace detail {
+		template <Sink S>
+		class AttributeStripper {
+		private:
+			enum NameKind : u1 { Keep, Strip, Code };
+
+			// An attribute table once stripped
+			struct Measure {
+				size_t length; // Including the count
+				u2 kept;
+				size_t end; // Offset right after the original table
+			};
+
+			const u1 *bytes;
+			size_t max_length;
+			S &sink;
+			std::vector<u1> name_kinds; // Indexed by constant pool index
+
+			/*
+			 * Measured while measuring their parent, so each table is only
+			 * read twice: once to measure it, once to copy it. Indexed by
+			 * offset, and cleared after each top level table.
+			 */
+			std::unordered_map<size_t, Measure> measures;
+			std::unordered_map<size_t, size_t> code_attributes_offsets; // By offset of the Code body
+		public:
+			size_t removed = 0;
+		public:
+			AttributeStripper(const u1 *bytes, size_t max_length, S &sink)
+				: bytes(bytes), max_length(max_length), sink(sink) {}
+		public:
+			std::expected<void, Error> strip(std::span<const std::string_view> names)
+			{
+				BufReader reader = BufReader(this->bytes, this->max_length);
+				if (reader.read_be<u4>() != JCFP_CLASSFILE_MAGIC)
+					return std::unexpected(Error { ErrorKind::WrongMagic, reader.prev_pos() });
+				reader.skip(2 * sizeof(u2)); // minor_version, major_version
+
+				auto result = this->scan_constant_pool(reader, names);
+				if (!result.has_value())
+					return result;
+
+				// access_flags, this_class, super_class, interfaces
+				reader.skip(3 * sizeof(u2));
+				reader.skip(reader.read_be<u2>() * sizeof(u2));
+				this->copy_until(0, reader.pos());
+
+				for (int members = 0; members < 2; ++members) {
+					size_t start = reader.pos();
+					u2 members_count = reader.read_be<u2>();
+					this->copy_until(start, reader.pos());
+
+					for (u2 i = 0; i < members_count; ++i) {
+						start = reader.pos();
+						reader.skip(3 * sizeof(u2)); // access_flags, name_index, descriptor_index
+						this->copy_until(start, reader.pos());
+
+						result = this->strip_table(reader);
+						if (!result.has_value())
+							return result;
+					}
+				}
+
+				return this->strip_table(reader);
+			}
+		private:
+			inline void copy_until(size_t start, size_t end)
+			{
+				this->sink.write_bytes(&this->bytes[start], end - start);
+			}
+
+			inline NameKind name_kind(u2 name_index)
+			{
+				return name_index < this->name_kinds.size() ? static_cast<NameKind>(this->name_kinds[name_index]) : Keep;
+			}
+
+			// Finds the Utf8 entries of the stripped names without decoding the constant pool
+			std::expected<void, Error> scan_constant_pool(BufReader &reader, std::span<const std::string_view> names)
+			{
+				u2 constant_pool_count = reader.read_be<u2>();
+				this->name_kinds.assign(constant_pool_count, Keep);
+
+				for (u2 i = 1; i < constant_pool_count; ++i) {
+					u1 tag = reader.read<u1>();
+					u1 size = ConstantPoolEntry::entry_size(tag);
+					if (size == 0)
+						return std::unexpected(Error { ErrorKind::InvalidTag, reader.prev_pos() });
+
+					if (tag != static_cast<u1>(ConstantPoolEntry::Tag::Utf8)) {
+						reader.skip(size - sizeof(tag));
+						if (tag == static_cast<u1>(ConstantPoolEntry::Tag::Long) ||
+						    tag == static_cast<u1>(ConstantPoolEntry::Tag::Double))
+							++i;
+						continue;
+					}
+
+					u2 length = reader.read_be<u2>();
+					const u1 *utf8 = &this->bytes[reader.pos()];
+					reader.skip(length);
+
+					// The names are ASCII, which is encoded the same way in modified UTF-8
+					std::string_view name = std::string_view(reinterpret_cast<const char *>(utf8), length);
+					if (name == "Code") {
+						this->name_kinds[i] = Code;
+					} else {
+						for (auto stripped : names) {
+							if (name == stripped) {
+								this->name_kinds[i] = Strip;
+								break;
+							}
+						}
+					}
+				}
+
+				return {};
+			}
+
+			// Strips a top level attribute table (of the class or of a member)
+			std::expected<void, Error> strip_table(BufReader &reader)
+			{
+				auto result = this->strip_attributes(reader);
+				this->measures.clear();
+				this->code_attributes_offsets.clear();
+				return result;
+			}
+
+			// Measures the attribute table at `offset` and the ones nested in its `Code` attributes
+			std::expected<Measure, Error> measure_attributes(size_t offset)
+			{
+				auto it = this->measures.find(offset);
+				if (it != this->measures.end())
+					return it->second;
+
+				BufReader reader = BufReader(this->bytes, this->max_length);
+				reader.skip(offset);
+
+				size_t length = sizeof(u2);
+				u2 kept = 0;
+				u2 attributes_count = reader.read_be<u2>();
+				for (u2 i = 0; i < attributes_count; ++i) {
+					u2 name_index = reader.read_be<u2>();
+					u4 attribute_length = reader.read_be<u4>();
+					size_t start = reader.pos();
+					reader.skip(attribute_length);
+
+					NameKind kind = this->name_kind(name_index);
+					if (kind == Strip)
+						continue;
+
+					++kept;
+					length += sizeof(u2) + sizeof(u4);
+					if (kind == Code) {
+						auto code_length = this->measure_code(start, attribute_length);
+						if (!code_length.has_value())
+							return std::unexpected(code_length.error());
+						length += code_length.value();
+					} else {
+						length += attribute_length;
+					}
+				}
+
+				Measure measure = Measure { length, kept, reader.pos() };
+				this->measures.emplace(offset, measure);
+				return measure;
+			}
+
+			// Length of the `Code` attribute whose body starts at `offset`, once stripped
+			std::expected<size_t, Error> measure_code(size_t offset, u4 length)
+			{
+				BufReader reader = BufReader(this->bytes, this->max_length);
+				reader.skip(offset + 2 * sizeof(u2)); // max_stack, max_locals
+				reader.skip(reader.read_be<u4>()); // code
+				reader.skip(reader.read_be<u2>() * 4 * sizeof(u2)); // exception_table
+				size_t attributes_offset = reader.pos();
+
+				auto attributes = this->measure_attributes(attributes_offset);
+				if (!attributes.has_value())
+					return std::unexpected(attributes.error());
+
+				// Nothing may be left between the end of the attributes and the end of the body
+				if (attributes.value().end != offset + length)
+					return std::unexpected(Error { ErrorKind::Malformed, offset });
+
+				this->code_attributes_offsets.emplace(offset, attributes_offset);
+				return (attributes_offset - offset) + attributes.value().length;
+			}
+
+			std::expected<void, Error> strip_attributes(BufReader &reader)
+			{
+				auto measured = this->measure_attributes(reader.pos());
+				if (!measured.has_value())
+					return std::unexpected(measured.error());
+
+				u2 attributes_count = reader.read_be<u2>();
+				write_be(this->sink, measured.value().kept);
+				this->removed += attributes_count - measured.value().kept;
+
+				for (u2 i = 0; i < attributes_count; ++i) {
+					size_t start = reader.pos();
+					u2 name_index = reader.read_be<u2>();
+					u4 attribute_length = reader.read_be<u4>();
+					size_t body = reader.pos();
+					reader.skip(attribute_length);
+
+					switch (this->name_kind(name_index)) {
+					case Strip:
+						break;
+					case Code: {
+						// Already measured with the parent table
+						size_t attributes_offset = this->code_attributes_offsets.at(body);
+						auto nested = this->measures.at(attributes_offset);
+						write_be(this->sink, name_index);
+						write_be(this->sink, static_cast<u4>((attributes_offset - body) + nested.length));
+
+						BufReader code_reader = BufReader(this->bytes, this->max_length);
+						code_reader.skip(attributes_offset);
+						this->copy_until(body, attributes_offset);
+						auto result = this->strip_attributes(code_reader);
+						if (!result.has_value())
+							return result;
+						break;
+					}
+					default:
+						this->copy_until(start, reader.pos());
+						break;
+					}
+				}
+
+				return {};
+			}
+		};
+	}
+
+	/*
+	 * Writes the class in `bytes` to `sink` without the attributes named
+	 * in `names`, and returns the number of attributes removed. On error
+	 * (including truncated input), part of the class may have been written.
+	 */
+	template <Sink S>
+	std::expected<size_t, Error> strip_attributes(const u1 *bytes, size_t max_length, S &sink,
+						      std::span<const std::string_view> names = debug_attributes)
+	{
+		detail::AttributeStripper<S> stripper = detail::AttributeStripper<S>(bytes, max_length, sink);
+		try {
+			auto result = stripper.strip(names);
+			if (!result.has_value())
+				return std::unexpected(result.error());
+		} catch (const std::out_of_range &) {
+			return std::unexpected(Error { ErrorKind::Malformed, max_length });
+		}
+
+		return stripper.removed;
+	}
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_SYNTHETIC_HPP_
+#define _JCFP_SYNTHETIC_HPP_
+
+#include <expected>
+#include <string>
+#include "jcfp.hpp"
+
+/*
+ * Generator of synthetic (but valid) classes with a given shape, to
+ * benchmark and test the library on sizes that real classes rarely reach.
+ * The same shape and seed always give the same class.
+ */
+
+namespace jcfp {
+	struct SyntheticShape {
+		uint64_t seed = 0;
+
+		// The constant pool is filled with random constants up to this count
+		// (it is larger if the class needs more entries than that)
+		u2 constant_pool_count = 256;
+		u2 wide_entries = 0; // Long/Double constants among the random ones
+
+		u2 fields = 16;
+		u2 methods = 16;
+		u2 code_length = 256; // Of each method, at least 1
+
+		// Nesting of the annotation in the class' RuntimeInvisibleAnnotations,
+		// none if 0
+		u2 annotation_depth = 0;
+	};
+
+	/*
+	 * Generates the class `name` (a subclass of `java/lang/Object`) with the
+	 * given shape. Its methods are static, and their code only pushes and
+	 * pops constants. Returns Unsupported if the class does not fit in a
+	 * constant pool.
+	 */
+	std::expected<ClassFile, Error> generate_class(const std::string &name, const SyntheticShape &shape);
+
+	// A random shape, mostly small with some outliers, like the classes of real applications
+	SyntheticShape random_shape(uint64_t seed);
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_TRACE_HPP_
+#define _JCFP_TRACE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "basetypes.hpp"
+
+/*
+ * Tracing hooks for the phases of parsing and encoding. They are only
+ * compiled in with JCFP_TRACING (see the JCFP_WITH_TRACING CMake option),
+ * and even then they cost a single atomic load per phase until a Tracer
+ * is installed with `set_tracer`.
+ */
+
+#ifdef JCFP_TRACING
+#	define JCFP_TRACE_BEGIN(scope, phase, offset) jcfp::TraceScope scope = jcfp::TraceScope(phase, offset)
+#	define JCFP_TRACE_END(scope, offset) scope.end(offset)
+#else
+#	define JCFP_TRACE_BEGIN(scope, phase, offset)
+#	define JCFP_TRACE_END(scope, offset)
+#endif
+
+namespace jcfp {
+	enum class TracePhase : u1 {
+		Header,       // Access flags, this/super class and interfaces
+		ConstantPool,
+		Fields,
+		Methods,
+		Attributes,   // Class attributes
+		Encode,       // A whole class
+		MAX
+	};
+
+	const char *trace_phase_name(TracePhase phase);
+
+	struct TraceEvent {
+		TracePhase phase;
+		uint64_t begin_ns; // Monotonic (std::chrono::steady_clock)
+		uint64_t end_ns;
+		size_t bytes;      // Read or written during the phase, if known
+	};
+
+	/*
+	 * Receives an event at the end of every phase that succeeded. It is
+	 * called from whatever thread parses or encodes, so it must be thread
+	 * safe, and it should be cheap.
+	 */
+	class Tracer {
+	public:
+		virtual ~Tracer() = default;
+		virtual void on_phase(const TraceEvent &event) = 0;
+	};
+
+	namespace detail {
+		extern std::atomic<Tracer *> active_tracer;
+	}
+
+	// Installs the tracer for every thread, or removes it (nullptr). It must outlive its use.
+	inline void set_tracer(Tracer *tracer)
+	{
+		detail::active_tracer.store(tracer, std::memory_order_release);
+	}
+
+	inline Tracer *get_tracer()
+	{
+		return detail::active_tracer.load(std::memory_order_acquire);
+	}
+
+	inline uint64_t trace_timestamp()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+
+	/*
+	 * Measures a phase from its construction until `end`, and the bytes
+	 * between the offsets (in the input or output) given to both. Nothing
+	 * is reported if `end` is never called.
+	 */
+	class TraceScope {
+	private:
+		Tracer *tracer;
+		TracePhase phase;
+		size_t offset;
+		uint64_t begin_ns = 0;
+	public:
+		inline TraceScope(TracePhase phase, size_t offset) : tracer(get_tracer()), phase(phase), offset(offset)
+		{
+			if (this->tracer)
+				this->begin_ns = trace_timestamp();
+		}
+	public:
+		inline void end(size_t offset)
+		{
+			if (!this->tracer)
+				return;
+
+			this->tracer->on_phase(TraceEvent { this->phase, this->begin_ns, trace_timestamp(), offset - this->offset });
+			this->tracer = nullptr;
+		}
+	};
+
+	// Bytes written to a sink so far, for the sinks that know it (0 otherwise)
+	template <typename S>
+	inline size_t trace_sink_size(S &sink)
+	{
+		if constexpr (requires { sink.size(); })
+			return sink.size();
+		else
+			return 0;
+	}
+
+	/*
+	 * Default tracer: a histogram of the durations of each phase, with
+	 * power of two buckets (bucket `i` holds the durations in [2^i, 2^(i+1))
+	 * nanoseconds, bucket 0 also holds 0), plus the totals. Lock free.
+	 */
+	class TraceHistogram : public Tracer {
+	public:
+		static constexpr size_t bucket_count = 64;
+	private:
+		struct PhaseStats {
+			std::atomic<uint64_t> count = 0;
+			std::atomic<uint64_t> total_ns = 0;
+			std::atomic<uint64_t> bytes = 0;
+			std::atomic<uint64_t> buckets[bucket_count] = {};
+		};
+
+		PhaseStats phases[static_cast<size_t>(TracePhase::MAX)];
+	public:
+		void on_phase(const TraceEvent &event) override;
+	public:
+		uint64_t count(TracePhase phase) const;
+		uint64_t total_ns(TracePhase phase) const;
+		uint64_t bytes(TracePhase phase) const;
+		uint64_t bucket(TracePhase phase, size_t index) const;
+
+		// Upper bound of the bucket holding the `quantile` (in [0, 1]) of the durations, 0 if empty
+		uint64_t quantile_ns(TracePhase phase, double quantile) const;
+
+		// One line per phase that was seen: count, total time, throughput and quantiles
+		std::string to_string() const;
+
+		void reset();
+	};
+}
+
+#endif
@@ -18,6 +18,13 @@
 
 #include "basetypes.hpp"
 #include <stdexcept>
+#include <concepts>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <bit>
+#include <utility>
+#include <type_traits>
 
 #ifdef DEBUG
 #	define LOG(fmt, ...) printf("[JCFP] " fmt "\n", ##__VA_ARGS__)
@@ -28,6 +35,34 @@
 #endif
 
 namespace jcfp {
+	// Converts between native and big endian byte order (works both ways)
+	template <typename T>
+	inline T swap_be(T value)
+	{
+		if constexpr (std::endian::native == std::endian::big || sizeof(T) == 1) {
+			return value;
+		} else if constexpr (std::is_enum_v<T>) {
+			return static_cast<T>(std::byteswap(std::to_underlying(value)));
+		} else {
+			return std::byteswap(value);
+		}
+	}
+
+	// Removes the items whose flag is set, keeping the order of the rest
+	template <typename T>
+	inline void erase_flagged(std::vector<T> &items, const std::vector<bool> &flags)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < items.size(); ++i) {
+			if (flags[i])
+				continue;
+			if (kept != i)
+				items[kept] = std::move(items[i]);
+			++kept;
+		}
+		items.erase(items.begin() + kept, items.end());
+	}
+
 	class BufReader {
 	private:
 		const u1 *buffer;
@@ -40,7 +75,6 @@ namespace jcfp {
 		template <typename T>
 		inline T read() // throws std::out_of_range
 		{
-			T *t = (T *)&this->buffer[this->offset];
 			const auto next_offset = this->offset + sizeof(T);
 			if (this->max_length > 0 && next_offset > this->max_length) {
 				throw std::out_of_range(
@@ -49,34 +83,46 @@ namespace jcfp {
 				);
 			}
 
+			T t;
+			std::memcpy(&t, &this->buffer[this->offset], sizeof(T));
 			this->prev_offset = this->offset;
 			this->offset += sizeof(T);
-			return *t;
+			return t;
 		}
 
 		template <typename T>
 		inline T read_be()
 		{
-			T t = this->read<T>();
-			T t_copy = t;
-			u1 *bytes = (u1 *)&t;
-			for (size_t i = 0; i < sizeof(T); ++i) {
-				bytes[i] = ((u1 *)&t_copy)[sizeof(T) - i - 1];
-			}
-
-			return t;
+			return swap_be(this->read<T>());
 		}
 
 		inline std::vector<u1> read_bytes(size_t size)
 		{
-			std::vector<u1> bytes;
+			const u1 *start = &this->buffer[this->offset];
+			this->skip(size);
 
-			for (size_t i = 0; i < size; ++i) {
-				u1 byte = this->read<u1>();
-				bytes.push_back(byte);
+			return std::vector<u1>(start, start + size);
+		}
+
+		// Advances the reader without copying anything
+		inline void skip(size_t size) // throws std::out_of_range
+		{
+			const auto next_offset = this->offset + size;
+			if (this->max_length > 0 && next_offset > this->max_length) {
+				throw std::out_of_range(
+					"Attempted to skip from " + std::to_string(offset) + " to " +
+					std::to_string(next_offset) + " (max offset: " + std::to_string(this->max_length) + ")"
+				);
 			}
 
-			return bytes;
+			this->prev_offset = this->offset;
+			this->offset = next_offset;
+		}
+
+		// Start of the underlying buffer (not the current position)
+		inline const u1 *data()
+		{
+			return this->buffer;
 		}
 
 		inline size_t prev_pos()
@@ -90,15 +136,34 @@ namespace jcfp {
 		}
 	};
 
+	/*
+	 * Anything the encoders can write to. Only `write_bytes` is required,
+	 * see `sink.hpp` for the sinks other than ByteStream.
+	 */
+	template <typename T>
+	concept Sink = requires(T &sink, const u1 *buf, size_t size) {
+		sink.write_bytes(buf, size);
+	};
+
+	template <Sink S, typename T>
+	inline void write_be(S &sink, const T &value)
+	{
+		T value_be = swap_be(value);
+		sink.write_bytes(reinterpret_cast<const u1 *>(&value_be), sizeof(T));
+	}
+
 	class ByteStream {
 	private:
 		std::vector<u1> bytes;
 	public:
 		std::vector<u1> collect()
 		{
-			std::vector<u1> buf = this->bytes;
-			this->bytes = {};
-			return buf;
+			return std::exchange(this->bytes, {});
+		}
+
+		inline void reserve(size_t size)
+		{
+			this->bytes.reserve(size);
 		}
 	public:
 		void write_bytes(const std::vector<u1> &buf)
@@ -121,14 +186,9 @@ namespace jcfp {
 		}
 
 		template <typename T>
-		inline void write_be(const T &value_le)
+		inline void write_be(const T &value)
 		{
-			u1 buf[sizeof(T)];
-			for (size_t i = 0; i < sizeof(buf); ++i) {
-				buf[i] = *((u1 *)&value_le + sizeof(T) - i - 1);
-			}
-
-			this->write_bytes(buf, sizeof(buf));
+			jcfp::write_be(*this, value);
 		}
 
 		inline size_t size()
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JCFP_VALIDATOR_HPP_
+#define _JCFP_VALIDATOR_HPP_
+
+#include <expected>
+#include <span>
+#include <utility>
+#include "jcfp.hpp"
+
+namespace jcfp {
+	/*
+	 * Read-only view of a constant pool that passed `validate`. Its
+	 * accessors do no checks at all, and can't throw.
+	 *
+	 * Every index stored in the class points to an entry, and to an entry
+	 * of the right type wherever its place fixes the type (see `validate`).
+	 * Elsewhere, check `tag` before calling `get` and the other accessors.
+	 *
+	 * NOTE: The view is only valid as long as the class is not modified
+	 *       (and not destroyed). Accessing an index that was not stored in
+	 *       the class (or validated some other way), or with the wrong
+	 *       type, is undefined behavior.
+	 */
+	class ValidatedConstantPool {
+	private:
+		std::span<const ConstantPoolEntry> entries;
+	public:
+		explicit ValidatedConstantPool(std::span<const ConstantPoolEntry> entries) : entries(entries) {}
+	public:
+		inline u2 count() const noexcept
+		{
+			return this->entries.size();
+		}
+
+		inline ConstantPoolEntry::Tag tag(u2 index) const noexcept
+		{
+			return this->entries[index].tag;
+		}
+
+		template <typename T>
+		inline const T &get(u2 index) const noexcept
+		{
+			const T *info = std::get_if<T>(&this->entries[index].info);
+			if (!info)
+				std::unreachable(); // Lets the compiler drop the check
+			return *info;
+		}
+
+		inline const std::string &utf8(u2 index) const noexcept
+		{
+			return this->get<ConstantPoolEntry::Utf8Info>(index).bytes.str();
+		}
+
+		inline const std::string &class_name(u2 index) const noexcept
+		{
+			return this->utf8(this->get<ConstantPoolEntry::ClassInfo>(index).name_index);
+		}
+
+		// Names of a Fieldref, Methodref or InterfaceMethodref
+		inline ConstantPool::MemberRef member_ref(u2 index) const noexcept
+		{
+			u2 class_index;
+			u2 name_and_type_index;
+			switch (this->entries[index].tag) {
+			case ConstantPoolEntry::Tag::Fieldref:
+				class_index = this->get<ConstantPoolEntry::FieldrefInfo>(index).class_index;
+				name_and_type_index = this->get<ConstantPoolEntry::FieldrefInfo>(index).name_and_type_index;
+				break;
+			case ConstantPoolEntry::Tag::Methodref:
+				class_index = this->get<ConstantPoolEntry::MethodrefInfo>(index).class_index;
+				name_and_type_index = this->get<ConstantPoolEntry::MethodrefInfo>(index).name_and_type_index;
+				break;
+			default:
+				class_index = this->get<ConstantPoolEntry::InterfaceMethodrefInfo>(index).class_index;
+				name_and_type_index = this->get<ConstantPoolEntry::InterfaceMethodrefInfo>(index).name_and_type_index;
+				break;
+			}
+
+			auto &name_and_type = this->get<ConstantPoolEntry::NameAndTypeInfo>(name_and_type_index);
+			return ConstantPool::MemberRef {
+				&this->class_name(class_index),
+				&this->utf8(name_and_type.name_index),
+				&this->utf8(name_and_type.descriptor_index)
+			};
+		}
+	};
+
+	/*
+	 * Checks the structure of a class in one pass: every reference between
+	 * constant pool entries (index in range, expected tag, valid
+	 * MethodHandle kind), the slots after Long/Double entries, the class
+	 * header, and the name and descriptor indices of every member and
+	 * attribute (including the ones nested in `Code` attributes).
+	 *
+	 * The indices inside attribute bodies (see `find_references`) must
+	 * point to an entry. Their tag is checked too for the bytecode
+	 * operands, `catch_type`, annotation descriptors, and the
+	 * `ConstantValue`, `Signature`, `SourceFile`, `Exceptions`,
+	 * `InnerClasses`, `EnclosingMethod`, `NestHost`, `NestMembers`,
+	 * `PermittedSubclasses`, `ModuleMainClass`, `ModulePackages` and
+	 * `BootstrapMethods` attributes. Attributes with an unknown layout are
+	 * not looked into.
+	 *
+	 * A lazy constant pool is decoded entirely. On success, returns a view
+	 * of the constant pool with unchecked accessors. Fails with Malformed,
+	 * with the offending index as the offset.
+	 */
+	std::expected<ValidatedConstantPool, Error> validate(ClassFile &classfile);
+}
+
+#endif
@@ -24,7 +24,7 @@ AttributeInfo AttributeInfo::parse(BufReader &reader)
 	u2 attribute_name_index = reader.read_be<u2>();
 	u4 attribute_length = reader.read_be<u4>();
 	std::vector<u1> info = reader.read_bytes(attribute_length);
-	return AttributeInfo(attribute_name_index, info);
+	return AttributeInfo(attribute_name_index, std::move(info));
 }
 
 AttributeInfo AttributeInfo::parse(const u1 *bytes, size_t max_length)
@@ -33,6 +33,13 @@ AttributeInfo AttributeInfo::parse(const u1 *bytes, size_t max_length)
 	return AttributeInfo::parse(reader);
 }
 
+void AttributeInfo::skip(BufReader &reader)
+{
+	reader.skip(sizeof(u2)); // attribute_name_index
+	u4 attribute_length = reader.read_be<u4>();
+	reader.skip(attribute_length);
+}
+
 std::vector<u1> AttributeInfo::encode()
 {
 	ByteStream stream = ByteStream();
@@ -40,15 +47,6 @@ std::vector<u1> AttributeInfo::encode()
 	return stream.collect();
 }
 
-void AttributeInfo::encode(ByteStream &stream)
-{
-	stream.write_be(this->attribute_name_index);
-
-	u4 attribute_length = this->info.size();
-	stream.write_be(attribute_length);
-	stream.write_bytes(this->info);
-}
-
 void AttributeInfo::relocate(int diff, u2 from)
 {
 	JCFP_RELOCATE_INDEX(this->attribute_name_index, diff, from);
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/bytecode.hpp>
+
+using namespace jcfp;
+
+/*
+ * Length of each fixed-size instruction, indexed by opcode. Variable
+ * length instructions (tableswitch, lookupswitch and wide) and invalid
+ * opcodes have a length of 0.
+ */
+static constexpr auto instruction_lengths = []() {
+	struct { u1 data[256] = {}; } table;
+	auto set = [&](u1 first, u1 last, u1 length) {
+		for (unsigned op = first; op <= last; ++op)
+			table.data[op] = length;
+	};
+
+	set(0x00, 0x0f, 1); // nop ... dconst_1
+	set(0x10, 0x10, 2); // bipush
+	set(0x11, 0x11, 3); // sipush
+	set(0x12, 0x12, 2); // ldc
+	set(0x13, 0x14, 3); // ldc_w, ldc2_w
+	set(0x15, 0x19, 2); // iload ... aload
+	set(0x1a, 0x35, 1); // iload_0 ... saload
+	set(0x36, 0x3a, 2); // istore ... astore
+	set(0x3b, 0x83, 1); // istore_0 ... lxor
+	set(0x84, 0x84, 3); // iinc
+	set(0x85, 0x98, 1); // i2l ... dcmpg
+	set(0x99, 0xa8, 3); // ifeq ... jsr
+	set(0xa9, 0xa9, 2); // ret
+	set(0xac, 0xb1, 1); // ireturn ... return
+	set(0xb2, 0xb8, 3); // getstatic ... invokestatic
+	set(0xb9, 0xba, 5); // invokeinterface, invokedynamic
+	set(0xbb, 0xbb, 3); // new
+	set(0xbc, 0xbc, 2); // newarray
+	set(0xbd, 0xbd, 3); // anewarray
+	set(0xbe, 0xbf, 1); // arraylength, athrow
+	set(0xc0, 0xc1, 3); // checkcast, instanceof
+	set(0xc2, 0xc3, 1); // monitorenter, monitorexit
+	set(0xc5, 0xc5, 4); // multianewarray
+	set(0xc6, 0xc7, 3); // ifnull, ifnonnull
+	set(0xc8, 0xc9, 5); // goto_w, jsr_w
+	return table;
+}();
+
+static inline u4 read_u4(std::span<const u1> code, size_t offset)
+{
+	return (static_cast<u4>(code[offset]) << 24) | (static_cast<u4>(code[offset + 1]) << 16) |
+	       (static_cast<u4>(code[offset + 2]) << 8) | static_cast<u4>(code[offset + 3]);
+}
+
+size_t jcfp::instruction_length(std::span<const u1> code, size_t pc)
+{
+	if (pc >= code.size())
+		return 0;
+
+	u1 opcode = code[pc];
+	size_t length = instruction_lengths.data[opcode];
+
+	switch (static_cast<Opcode>(opcode)) {
+	case Opcode::OP_wide:
+		if (pc + 1 >= code.size())
+			return 0;
+		length = code[pc + 1] == static_cast<u1>(Opcode::OP_iinc) ? 6 : 4;
+		break;
+	case Opcode::OP_tableswitch:
+	case Opcode::OP_lookupswitch: {
+		// The operands are aligned to 4 bytes, relative to the start of the code
+		size_t operands = (pc + 4) & ~static_cast<size_t>(3);
+		if (operands + 12 > code.size())
+			return 0;
+
+		if (opcode == static_cast<u1>(Opcode::OP_tableswitch)) {
+			int32_t low = static_cast<int32_t>(read_u4(code, operands + 4));
+			int32_t high = static_cast<int32_t>(read_u4(code, operands + 8));
+			if (high < low)
+				return 0;
+			length = operands - pc + 12 + (static_cast<int64_t>(high) - low + 1) * 4;
+		} else {
+			int32_t npairs = static_cast<int32_t>(read_u4(code, operands + 4));
+			if (npairs < 0)
+				return 0;
+			length = operands - pc + 8 + static_cast<size_t>(npairs) * 8;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (length == 0 || pc + length > code.size())
+		return 0;
+
+	return length;
+}
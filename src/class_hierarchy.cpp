@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/class_hierarchy.hpp>
+#include <jcfp/parallel.hpp>
+#include <jcfp/utils.hpp>
+#include <algorithm>
+
+using namespace jcfp;
+using ClassId = ClassHierarchy::ClassId;
+
+// Names of a class and its direct supertypes, as found in its constant pool
+struct ClassRecord {
+	const std::string *name = nullptr;
+	const std::string *super_class = nullptr;
+	std::vector<const std::string *> interfaces;
+	bool is_interface = false;
+};
+
+ClassHierarchy ClassHierarchy::build(std::span<ClassFile> classes, StringInterner *interner, unsigned threads)
+{
+	ClassHierarchy hierarchy;
+	if (!interner) {
+		hierarchy.owned_interner = std::make_unique<StringInterner>();
+		interner = hierarchy.owned_interner.get();
+	}
+
+	LOG("Building class hierarchy (classes: %lu)...", classes.size());
+
+	// Decoding the names is the expensive part, and each class is independent
+	std::vector<ClassRecord> records(classes.size());
+	parallel_for(classes.size(), [&](size_t i) {
+		auto &classfile = classes[i];
+		auto &record = records[i];
+		auto &constant_pool = classfile.constant_pool;
+
+		const std::string *name = constant_pool.find_class_name(classfile.this_class);
+		if (!name)
+			return; // Malformed class, ignored
+
+		record.name = interner->intern(*name);
+		if (auto super_class = constant_pool.find_class_name(classfile.super_class))
+			record.super_class = interner->intern(*super_class);
+
+		record.interfaces.reserve(classfile.interfaces.size());
+		for (u2 index : classfile.interfaces) {
+			if (auto iface = constant_pool.find_class_name(index))
+				record.interfaces.push_back(interner->intern(*iface));
+		}
+
+		record.is_interface = (classfile.access_flags & ACC_INTERFACE) != 0;
+	}, threads);
+
+	auto id_of = [&hierarchy](const std::string *name) {
+		auto [it, inserted] = hierarchy.ids.try_emplace(*name, hierarchy.names.size());
+		if (inserted) {
+			hierarchy.names.push_back(name);
+			hierarchy.loaded.push_back(false);
+			hierarchy.interface_flags.push_back(false);
+		}
+		return it->second;
+	};
+
+	// Assign the ids and keep the first definition of each class
+	std::vector<const ClassRecord *> definitions;
+	for (auto &record : records) {
+		if (!record.name)
+			continue;
+
+		ClassId id = id_of(record.name);
+		if (id >= definitions.size())
+			definitions.resize(id + 1, nullptr);
+		if (definitions[id])
+			continue;
+
+		definitions[id] = &record;
+		hierarchy.loaded[id] = true;
+		hierarchy.interface_flags[id] = record.is_interface;
+		if (record.super_class)
+			id_of(record.super_class);
+		for (auto iface : record.interfaces) {
+			ClassId iface_id = id_of(iface);
+			if (!hierarchy.loaded[iface_id])
+				hierarchy.interface_flags[iface_id] = true;
+		}
+	}
+
+	size_t count = hierarchy.names.size();
+	definitions.resize(count, nullptr);
+
+	// Direct supertypes, as CSR
+	hierarchy.super_classes.assign(count, npos);
+	hierarchy.supertype_offsets.assign(count + 1, 0);
+	for (ClassId id = 0; id < count; ++id) {
+		auto record = definitions[id];
+		hierarchy.supertype_offsets[id + 1] = hierarchy.supertype_offsets[id];
+		if (!record)
+			continue;
+
+		if (record->super_class) {
+			ClassId super_id = hierarchy.ids.at(*record->super_class);
+			hierarchy.super_classes[id] = super_id;
+			hierarchy.supertype_ids.push_back(super_id);
+		}
+
+		for (auto iface : record->interfaces)
+			hierarchy.supertype_ids.push_back(hierarchy.ids.at(*iface));
+		hierarchy.supertype_offsets[id + 1] = hierarchy.supertype_ids.size();
+	}
+
+	// Direct subtypes, by counting the incoming edges first
+	hierarchy.subtype_offsets.assign(count + 1, 0);
+	for (ClassId super_id : hierarchy.supertype_ids)
+		++hierarchy.subtype_offsets[super_id + 1];
+	for (size_t i = 0; i < count; ++i)
+		hierarchy.subtype_offsets[i + 1] += hierarchy.subtype_offsets[i];
+
+	hierarchy.subtype_ids.resize(hierarchy.supertype_ids.size());
+	std::vector<u4> cursor(hierarchy.subtype_offsets.begin(), hierarchy.subtype_offsets.end() - 1);
+	for (ClassId id = 0; id < count; ++id) {
+		for (ClassId super_id : hierarchy.supertypes(id))
+			hierarchy.subtype_ids[cursor[super_id]++] = id;
+	}
+
+	/*
+	 * Interval labels of the superclass tree. A class extends another one
+	 * (directly or not) if its interval is nested in the other's. Classes in
+	 * a superclass cycle are never reached from a root, and stay unlabeled.
+	 */
+	std::vector<std::vector<ClassId>> subclasses(count);
+	for (ClassId id = 0; id < count; ++id) {
+		if (hierarchy.super_classes[id] != npos)
+			subclasses[hierarchy.super_classes[id]].push_back(id);
+	}
+
+	hierarchy.enter.assign(count, npos);
+	hierarchy.leave.assign(count, npos);
+	u4 clock = 0;
+	std::vector<std::pair<ClassId, size_t>> stack;
+	for (ClassId root = 0; root < count; ++root) {
+		if (hierarchy.super_classes[root] != npos)
+			continue;
+
+		hierarchy.enter[root] = clock++;
+		stack.push_back({ root, 0 });
+		while (!stack.empty()) {
+			auto &[id, next] = stack.back();
+			if (next < subclasses[id].size()) {
+				ClassId child = subclasses[id][next++];
+				hierarchy.enter[child] = clock++;
+				stack.push_back({ child, 0 });
+			} else {
+				hierarchy.leave[id] = clock++;
+				stack.pop_back();
+			}
+		}
+	}
+
+	/*
+	 * Transitive interfaces, computed after the ones of every supertype
+	 * (iterative post-order, so deep hierarchies don't exhaust the stack).
+	 * Supertypes still in progress are part of a cycle, and are skipped.
+	 */
+	enum : u1 { Unvisited, InProgress, Visited };
+	std::vector<u1> state(count, Unvisited);
+	std::vector<std::vector<ClassId>> closures(count);
+	std::vector<ClassId> pending;
+	for (ClassId start = 0; start < count; ++start) {
+		if (state[start] != Unvisited)
+			continue;
+
+		pending.push_back(start);
+		while (!pending.empty()) {
+			ClassId id = pending.back();
+			if (state[id] == Unvisited) {
+				state[id] = InProgress;
+				for (ClassId super_id : hierarchy.supertypes(id)) {
+					if (state[super_id] == Unvisited)
+						pending.push_back(super_id);
+				}
+				continue;
+			}
+
+			pending.pop_back();
+			if (state[id] == Visited)
+				continue;
+
+			auto &closure = closures[id];
+			for (ClassId super_id : hierarchy.supertypes(id)) {
+				if (state[super_id] != Visited)
+					continue;
+				if (hierarchy.interface_flags[super_id])
+					closure.push_back(super_id);
+				closure.insert(closure.end(), closures[super_id].begin(), closures[super_id].end());
+			}
+
+			std::sort(closure.begin(), closure.end());
+			closure.erase(std::unique(closure.begin(), closure.end()), closure.end());
+			state[id] = Visited;
+		}
+	}
+
+	hierarchy.interface_offsets.assign(count + 1, 0);
+	for (ClassId id = 0; id < count; ++id) {
+		hierarchy.interface_ids.insert(hierarchy.interface_ids.end(), closures[id].begin(), closures[id].end());
+		hierarchy.interface_offsets[id + 1] = hierarchy.interface_ids.size();
+	}
+
+	LOG("Class hierarchy built (classes: %lu, edges: %lu)", count, hierarchy.supertype_ids.size());
+
+	return hierarchy;
+}
+
+bool ClassHierarchy::is_subtype(ClassId a, ClassId b) const
+{
+	if (a == b)
+		return true;
+
+	if (this->enter[a] != npos && this->enter[b] != npos &&
+	    this->enter[b] < this->enter[a] && this->leave[a] < this->leave[b])
+		return true;
+
+	if (!this->interface_flags[b])
+		return false;
+
+	auto interfaces = this->all_interfaces(a);
+	return std::binary_search(interfaces.begin(), interfaces.end(), b);
+}
+
+std::optional<ClassId> ClassHierarchy::common_super_class(ClassId a, ClassId b) const
+{
+	if (this->is_subtype(a, b))
+		return b;
+	if (this->is_subtype(b, a))
+		return a;
+
+	// Only labeled classes have a superclass chain that ends in a root
+	if (this->enter[a] == npos)
+		return {};
+
+	for (ClassId id = this->super_classes[a]; id != npos; id = this->super_classes[id]) {
+		if (this->is_subtype(b, id))
+			return id;
+	}
+
+	return {};
+}
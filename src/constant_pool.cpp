@@ -21,33 +21,34 @@ using namespace jcfp;
 using Tag = ConstantPoolEntry::Tag;
 using EntryVariant = ConstantPoolEntry::EntryVariant;
 
-std::expected<ConstantPool, Error> ConstantPool::parse(BufReader &reader)
+std::expected<std::vector<u4>, Error> ConstantPool::scan(BufReader &reader)
 {
-	std::vector<ConstantPoolEntry> entries;
-
-	LOG("Parsing constant pool (offset: %lu)...", reader.pos());
+	std::vector<u4> offsets;
 
 	u2 constant_pool_count = reader.read_be<u2>();
-	if (constant_pool_count == 0) {
-		LOG("Empty constant pool");
-		return ConstantPool(entries);
-	}
-	LOG("Constant pool count: %hu", constant_pool_count);
+	if (constant_pool_count == 0)
+		return offsets;
 
 	// The first entry is always an empty tag
-	entries.push_back(ConstantPoolEntry());
-
-	for (u2 i = 1; i <= constant_pool_count - 1; ++i) {
-		auto result = ConstantPoolEntry::parse(reader);
-		if (!result.has_value()) {
-			ERR("Failed to parse constant pool entry '%hu'", i);
-			return std::unexpected(result.error());
+	offsets.resize(constant_pool_count, 0);
+
+	for (u2 i = 1; i < constant_pool_count; ++i) {
+		size_t offset = reader.pos();
+		u1 tag = reader.read<u1>();
+		u1 size = ConstantPoolEntry::entry_size(tag);
+		if (size == 0) {
+			ERR("Invalid tag '%hhu' for constant pool entry '%hu'", tag, i);
+			return std::unexpected(Error { ErrorKind::InvalidTag, offset });
 		}
 
-		LOG("New constant pool entry parsed (%hu): %s", i, result.value().to_string().c_str());
+		if (tag == Tag::Utf8) {
+			u2 length = reader.read_be<u2>();
+			reader.skip(length);
+		} else {
+			reader.skip(size - sizeof(tag));
+		}
 
-		auto entry = result.value();
-		entries.push_back(entry);
+		offsets[i] = offset;
 
 		/* From: https://docs.oracle.com/javase/specs/jvms/se7/html/jvms-4.html
 		 * """
@@ -60,29 +61,102 @@ std::expected<ConstantPool, Error> ConstantPool::parse(BufReader &reader)
 		 * In retrospect, making 8-byte constants take two constant pool entries was a poor choice.
 		 * """
 		 */
-		if (entry.tag == Tag::Long || entry.tag == Tag::Double) {
-			entries.push_back(ConstantPoolEntry());
+		if (tag == Tag::Long || tag == Tag::Double)
 			++i;
+	}
+
+	return offsets;
+}
+
+std::expected<ConstantPool, Error> ConstantPool::parse(BufReader &reader, StringInterner *interner)
+{
+	LOG("Parsing constant pool (offset: %lu)...", reader.pos());
+
+	// First pass: find and validate every entry, so the storage can be sized exactly
+	auto scan_result = ConstantPool::scan(reader);
+	if (!scan_result.has_value())
+		return std::unexpected(scan_result.error());
+	auto &offsets = scan_result.value();
+	LOG("Constant pool count: %lu", offsets.size());
+
+	// Second pass: decode each entry from its offset. The entries are
+	// independent from each other, and their bounds were already checked.
+	std::vector<ConstantPoolEntry> entries(offsets.size());
+	for (size_t i = 1; i < offsets.size(); ++i) {
+		if (offsets[i] == 0)
+			continue; // Unusable index after a wide entry
+
+		BufReader entry_reader = BufReader(&reader.data()[offsets[i]]);
+		auto result = ConstantPoolEntry::parse(entry_reader, interner);
+		if (!result.has_value()) {
+			ERR("Failed to parse constant pool entry '%lu'", i);
+			return std::unexpected(result.error());
 		}
+
+		LOG("New constant pool entry parsed (%lu): %s", i, result.value().to_string().c_str());
+		entries[i] = std::move(result.value());
 	}
 
 	LOG("Constant pool parsed successfully (offset: %lu, entries: %lu)", reader.pos(), entries.size());
 
-	return ConstantPool(entries);
+	return ConstantPool(std::move(entries));
+}
+
+std::expected<ConstantPool, Error> ConstantPool::parse_lazy(BufReader &reader, StringInterner *interner)
+{
+	LOG("Parsing constant pool lazily (offset: %lu)...", reader.pos());
+
+	size_t start = reader.pos();
+	auto scan_result = ConstantPool::scan(reader);
+	if (!scan_result.has_value())
+		return std::unexpected(scan_result.error());
+	auto &offsets = scan_result.value();
+
+	// Only the tags are read, the entries stay in the raw bytes until they are needed
+	std::vector<ConstantPoolEntry> entries(offsets.size());
+	for (size_t i = 1; i < offsets.size(); ++i) {
+		if (offsets[i] == 0)
+			continue;
+
+		entries[i].tag = static_cast<Tag>(reader.data()[offsets[i]]);
+		entries[i].raw_offset = offsets[i] - start;
+	}
+
+	ConstantPool constant_pool = ConstantPool(std::move(entries));
+	constant_pool.interner = interner;
+	constant_pool.raw = std::make_shared<const std::vector<u1>>(&reader.data()[start], &reader.data()[reader.pos()]);
+
+	LOG("Constant pool scanned successfully (offset: %lu, entries: %lu)", reader.pos(), constant_pool.entries.size());
+
+	return constant_pool;
+}
+
+void ConstantPool::decode_entry(u2 index)
+{
+	auto &entry = this->entries[index];
+
+	// The raw bytes were validated by `scan`, so decoding can't fail here
+	BufReader reader = BufReader(&this->raw->data()[entry.raw_offset]);
+	entry = ConstantPoolEntry::parse(reader, this->interner).value();
 }
 
-std::expected<ConstantPoolEntry, Error> ConstantPoolEntry::parse(BufReader &reader)
+void ConstantPool::decode_all()
+{
+	for (size_t i = 1; i < this->entries.size(); ++i) {
+		if (this->entries[i].raw_offset != 0)
+			this->decode_entry(i);
+	}
+
+	this->raw = nullptr;
+}
+
+std::expected<ConstantPoolEntry, Error> ConstantPoolEntry::parse(BufReader &reader, StringInterner *interner)
 {
 	u1 tag = reader.read<u1>();
 	EntryVariant info;
 
+	// Empty entries are never stored in a ClassFile, so tag 0 is invalid like any other unknown tag
 	switch (tag) {
-		case Tag::Empty:
-		{
-			info = ConstantPoolEntry::EmptyInfo {};
-
-			break;
-		}
 		case Tag::Class:
 		{
 			ConstantPoolEntry::ClassInfo val;
@@ -174,10 +248,13 @@ std::expected<ConstantPoolEntry, Error> ConstantPoolEntry::parse(BufReader &read
 			ConstantPoolEntry::Utf8Info val;
 
 			u2 length = reader.read_be<u2>();
-			std::vector<u1> bytes = reader.read_bytes(length);
-			std::string str = std::string(bytes.begin(), bytes.end());
-			val.bytes = str;
-			info = val;
+			const char *bytes = reinterpret_cast<const char *>(&reader.data()[reader.pos()]);
+			reader.skip(length);
+			if (interner)
+				val.bytes = interner->make(std::string_view(bytes, length));
+			else
+				val.bytes = std::string(bytes, length);
+			info = std::move(val);
 
 			break;
 		}
@@ -198,6 +275,15 @@ std::expected<ConstantPoolEntry, Error> ConstantPoolEntry::parse(BufReader &read
 
 			break;
 		}
+		case Tag::Dynamic:
+		{
+			ConstantPoolEntry::DynamicInfo val;
+			val.bootstrap_method_attr_index = reader.read_be<u2>();
+			val.name_and_type_index = reader.read_be<u2>();
+			info = val;
+
+			break;
+		}
 		case Tag::InvokeDynamic:
 		{
 			ConstantPoolEntry::InvokeDynamicInfo val;
@@ -207,9 +293,30 @@ std::expected<ConstantPoolEntry, Error> ConstantPoolEntry::parse(BufReader &read
 
 			break;
 		}
+		case Tag::Module:
+		{
+			ConstantPoolEntry::ModuleInfo val;
+			val.name_index = reader.read_be<u2>();
+			info = val;
+
+			break;
+		}
+		case Tag::Package:
+		{
+			ConstantPoolEntry::PackageInfo val;
+			val.name_index = reader.read_be<u2>();
+			info = val;
+
+			break;
+		}
+		default:
+		{
+			ERR("Failed to parse tag '%hhu' (unknown)", tag);
+			return std::unexpected(Error { ErrorKind::InvalidTag, reader.prev_pos() });
+		}
 	}
 
-	return ConstantPoolEntry(info);
+	return ConstantPoolEntry(std::move(info));
 }
 
 
@@ -233,16 +340,6 @@ std::vector<u1>	ConstantPool::encode()
 	return stream.collect();
 }
 
-void ConstantPool::encode(ByteStream &stream)
-{
-	u2 constant_pool_count = this->count();
-	stream.write_be(constant_pool_count);
-
-	for (auto &entry : this->entries) {
-		entry.encode(stream);
-	}
-}
-
 std::vector<u1>	ConstantPoolEntry::encode()
 {
 	ByteStream stream = ByteStream();
@@ -250,108 +347,27 @@ std::vector<u1>	ConstantPoolEntry::encode()
 	return stream.collect();
 }
 
-void ConstantPoolEntry::encode(ByteStream &stream)
+void ConstantPool::relocate(int diff, u2 from)
 {
-	if (this->tag == Tag::Empty)
-		return;
+	this->modified = true;
 
-	stream.write_be(this->tag);
+	for (size_t i = 1; i < this->entries.size(); ++i) {
+		auto &entry = this->entries[i];
 
-	switch (this->tag) {
-	case Tag::Class: {
-		ClassInfo &info = this->get<ClassInfo>();
-		stream.write_be(info.name_index);
-		break;
-	}
-	case Tag::Fieldref: {
-		FieldrefInfo &info = this->get<FieldrefInfo>();
-		stream.write_be(info.class_index);
-		stream.write_be(info.name_and_type_index);
-		break;
-	}
-	case Tag::Methodref: {
-		MethodrefInfo &info = this->get<MethodrefInfo>();
-		stream.write_be(info.class_index);
-		stream.write_be(info.name_and_type_index);
-		break;
-	}
-	case Tag::InterfaceMethodref: {
-		InterfaceMethodrefInfo &info = this->get<InterfaceMethodrefInfo>();
-		stream.write_be(info.class_index);
-		stream.write_be(info.name_and_type_index);
-		break;
-	}
-	case Tag::String: {
-		StringInfo &info = this->get<StringInfo>();
-		stream.write_be(info.string_index);
-		break;
-	}
-	case Tag::Integer: {
-		IntegerInfo &info = this->get<IntegerInfo>();
-		stream.write_be(info.bytes);
-		break;
-	}
-	case Tag::Float: {
-		FloatInfo &info = this->get<FloatInfo>();
-		stream.write_be(info.bytes);
-		break;
-	}
-	case Tag::Long: {
-		LongInfo &info = this->get<LongInfo>();
-		stream.write_be(info.high_bytes);
-		stream.write_be(info.low_bytes);
-		break;
-	}
-	case Tag::Double: {
-		DoubleInfo &info = this->get<DoubleInfo>();
-		stream.write_be(info.high_bytes);
-		stream.write_be(info.low_bytes);
-		break;
-	}
-	case Tag::NameAndType: {
-		NameAndTypeInfo &info = this->get<NameAndTypeInfo>();
-		stream.write_be(info.name_index);
-		stream.write_be(info.descriptor_index);
-		break;
-	}
-	case Tag::Utf8: {
-		Utf8Info &info = this->get<Utf8Info>();
-
-		u2 length = info.bytes.size();
-		stream.write_be(length);
-		for (char b : info.bytes) {
-			stream.write(b);
+		// Lazy entries without references don't need to be decoded
+		switch (entry.tag) {
+		case Tag::Empty:
+		case Tag::Integer:
+		case Tag::Float:
+		case Tag::Long:
+		case Tag::Double:
+		case Tag::Utf8:
+			continue;
+		default:
+			break;
 		}
-		break;
-	}
-	case Tag::MethodHandle: {
-		MethodHandleInfo &info = this->get<MethodHandleInfo>();
-		stream.write_be(info.reference_kind);
-		stream.write_be(info.reference_index);
-		break;
-	}
-	case Tag::MethodType: {
-		MethodTypeInfo &info = this->get<MethodTypeInfo>();
-		stream.write_be(info.descriptor_index);
-		break;
-	}
-	case Tag::InvokeDynamic: {
-		InvokeDynamicInfo &info = this->get<InvokeDynamicInfo>();
-		stream.write_be(info.bootstrap_method_attr_index);
-		stream.write_be(info.name_and_type_index);
 
-		break;
-	}
-	default:
-		ERR("Failed to encode tag '%u' (unknown)", this->tag);
-		break;
-	}
-}
-
-void ConstantPool::relocate(int diff, u2 from)
-{
-	for (auto &entry : this->get_entries()) {
-		entry.relocate(diff, from);
+		this->get_entry(i).relocate(diff, from);
 	}
 }
 
@@ -409,12 +425,28 @@ void ConstantPoolEntry::relocate(int diff, u2 from)
 		JCFP_RELOCATE_INDEX(info.descriptor_index, diff, from);
 		break;
 	}
+	// NOTE: The `bootstrap_method_attr_index` is an index into the
+	//       BootstrapMethods attribute, not into the constant pool
+	case Tag::Dynamic: {
+		DynamicInfo &info = this->get<DynamicInfo>();
+		JCFP_RELOCATE_INDEX(info.name_and_type_index, diff, from);
+		break;
+	}
 	case Tag::InvokeDynamic: {
 		InvokeDynamicInfo &info = this->get<InvokeDynamicInfo>();
-		JCFP_RELOCATE_INDEX(info.bootstrap_method_attr_index, diff, from);
 		JCFP_RELOCATE_INDEX(info.name_and_type_index, diff, from);
 		break;
 	}
+	case Tag::Module: {
+		ModuleInfo &info = this->get<ModuleInfo>();
+		JCFP_RELOCATE_INDEX(info.name_index, diff, from);
+		break;
+	}
+	case Tag::Package: {
+		PackageInfo &info = this->get<PackageInfo>();
+		JCFP_RELOCATE_INDEX(info.name_index, diff, from);
+		break;
+	}
 	default:
 		ERR("Failed to relocate tag '%u' (unknown)", this->tag);
 		break;
@@ -439,11 +471,40 @@ std::string ConstantPoolEntry::to_string()
 	case Tag::Long: fmt = std::format("Long {{ high_bytes: {:#x}, low_bytes: {:#x} }}", this->get<LongInfo>().high_bytes, this->get<LongInfo>().low_bytes); break;
 	case Tag::Double: fmt = std::format("Double {{ high_bytes: {:#x}, low_bytes: {:#x} }}", this->get<DoubleInfo>().high_bytes, this->get<DoubleInfo>().low_bytes); break;
 	case Tag::NameAndType: fmt = std::format("NameAndType {{ name_index: {}, descriptor_index: {} }}", this->get<NameAndTypeInfo>().name_index, this->get<NameAndTypeInfo>().descriptor_index); break;
-	case Tag::Utf8: fmt = std::format("Utf8 {{ bytes: \"{}\" }}", this->get<Utf8Info>().bytes); break;
+	case Tag::Utf8: fmt = std::format("Utf8 {{ bytes: \"{}\" }}", this->get<Utf8Info>().bytes.str()); break;
 	case Tag::MethodHandle: fmt = std::format("MethodHandle {{ reference_kind: {}, reference_index: {} }}", this->get<MethodHandleInfo>().reference_kind, this->get<MethodHandleInfo>().reference_index); break;
 	case Tag::MethodType: fmt = std::format("MethodType {{ descriptor_index: {} }}", this->get<MethodTypeInfo>().descriptor_index); break;
+	case Tag::Dynamic: fmt = std::format("Dynamic {{ bootstrap_method_attr_index: {}, name_and_type_index: {} }}", this->get<DynamicInfo>().bootstrap_method_attr_index, this->get<DynamicInfo>().name_and_type_index); break;
 	case Tag::InvokeDynamic: fmt = std::format("InvokeDynamic {{ bootstrap_method_attr_index: {}, name_and_type_index: {} }}", this->get<InvokeDynamicInfo>().bootstrap_method_attr_index, this->get<InvokeDynamicInfo>().name_and_type_index); break;
+	case Tag::Module: fmt = std::format("Module {{ name_index: {} }}", this->get<ModuleInfo>().name_index); break;
+	case Tag::Package: fmt = std::format("Package {{ name_index: {} }}", this->get<PackageInfo>().name_index); break;
 	default: fmt = "<Unknown (tag: " + std::to_string(this->tag) + ")>"; break;
 	}
 	return fmt;
 }
+
+MemoryUsage ConstantPool::memory_usage() const
+{
+	MemoryUsage usage;
+	usage.add(&MemoryUsage::constant_pool_entries, this->entries);
+	for (auto &entry : this->entries) {
+		// Lazy entries are still in the raw bytes
+		auto utf8 = std::get_if<ConstantPoolEntry::Utf8Info>(&entry.info);
+		if (utf8 && utf8->bytes.owned_str())
+			usage.add(&MemoryUsage::utf8_payloads, *utf8->bytes.owned_str());
+	}
+
+	if (this->raw)
+		usage.add(&MemoryUsage::source, *this->raw);
+
+	return usage;
+}
+
+void ConstantPool::shrink_to_fit()
+{
+	this->entries.shrink_to_fit();
+	for (auto &entry : this->entries) {
+		if (auto utf8 = std::get_if<ConstantPoolEntry::Utf8Info>(&entry.info))
+			utf8->bytes.shrink_to_fit();
+	}
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/diff.hpp>
+#include <jcfp/utils.hpp>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace jcfp;
+using Tag = ConstantPoolEntry::Tag;
+
+static constexpr u4 DELTA_MAGIC = 0x4A434644; // 'JCFD'
+
+// Copies shorter than this are sent as literals, which is smaller
+static constexpr size_t MIN_COPY_LENGTH = 4;
+
+namespace {
+	// Thrown while splitting a class or applying a delta, turned into an `Error` by the callers
+	struct DiffError {
+		Error error;
+	};
+
+	// A part of a class that is matched on its own. The key identifies it among the parts of the other class.
+	struct Part {
+		std::string key;
+		size_t offset;
+		size_t length;
+	};
+
+	uint64_t hash_bytes(const u1 *bytes, size_t length)
+	{
+		uint64_t hash = 0xcbf29ce484222325;
+		for (size_t i = 0; i < length; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001b3;
+		}
+		return hash;
+	}
+
+	// Splits a class into the parts that are matched by `diff`, in order. Throws on malformed classes.
+	std::vector<Part> split(const u1 *bytes, size_t length)
+	{
+		std::vector<Part> parts;
+		BufReader reader = BufReader(bytes, length);
+		if (reader.read_be<u4>() != JCFP_CLASSFILE_MAGIC)
+			throw DiffError { Error { ErrorKind::WrongMagic, 0 } };
+		reader.skip(2 * sizeof(u2)); // minor_version, major_version
+
+		auto scan_result = ConstantPool::scan(reader);
+		if (!scan_result.has_value())
+			throw DiffError { scan_result.error() };
+		auto &offsets = scan_result.value();
+
+		// Up to the constant pool count
+		size_t pool_offset = offsets.size() > 1 ? offsets[1] : reader.pos();
+		parts.push_back(Part { "H", 0, pool_offset });
+
+		// Constant pool entries, by content
+		for (size_t i = 1; i < offsets.size(); ++i) {
+			if (offsets[i] == 0)
+				continue;
+
+			size_t end = reader.pos();
+			for (size_t next = i + 1; next < offsets.size(); ++next) {
+				if (offsets[next] != 0) {
+					end = offsets[next];
+					break;
+				}
+			}
+
+			std::string key = "K";
+			key.append(reinterpret_cast<const char *>(&bytes[offsets[i]]), end - offsets[i]);
+			parts.push_back(Part { std::move(key), offsets[i], end - offsets[i] });
+		}
+
+		auto utf8 = [&](u2 index) -> std::string_view {
+			if (index == 0 || index >= offsets.size() || offsets[index] == 0 || bytes[offsets[index]] != Tag::Utf8)
+				throw DiffError { Error { ErrorKind::Malformed, reader.pos() } };
+			const u1 *entry = &bytes[offsets[index]];
+			return std::string_view(reinterpret_cast<const char *>(&entry[3]), (entry[1] << 8) | entry[2]);
+		};
+
+		auto skip_attributes = [&]() {
+			for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+				reader.skip(sizeof(u2)); // attribute_name_index
+				reader.skip(reader.read_be<u4>());
+			}
+		};
+
+		// access_flags, this_class, super_class and interfaces
+		size_t start = reader.pos();
+		reader.skip(3 * sizeof(u2));
+		reader.skip(reader.read_be<u2>() * sizeof(u2));
+		parts.push_back(Part { "C", start, reader.pos() - start });
+
+		// Fields and methods, by name and descriptor
+		for (const char *kind : { "F", "M" }) {
+			parts.push_back(Part { std::string(kind) + "#", reader.pos(), sizeof(u2) });
+			for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+				start = reader.pos();
+				reader.skip(sizeof(u2)); // access_flags
+				std::string key = kind;
+				key += utf8(reader.read_be<u2>());
+				key += ':';
+				key += utf8(reader.read_be<u2>());
+				skip_attributes();
+				parts.push_back(Part { std::move(key), start, reader.pos() - start });
+			}
+		}
+
+		// Class attributes, by name
+		parts.push_back(Part { "A#", reader.pos(), sizeof(u2) });
+		for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+			start = reader.pos();
+			std::string key = "A";
+			key += utf8(reader.read_be<u2>());
+			reader.skip(reader.read_be<u4>());
+			parts.push_back(Part { std::move(key), start, reader.pos() - start });
+		}
+
+		if (reader.pos() != length)
+			throw DiffError { Error { ErrorKind::Malformed, reader.pos() } };
+
+		return parts;
+	}
+
+	class DeltaWriter {
+	private:
+		ByteStream stream;
+		const u1 *old_bytes;
+		size_t copy_offset = 0;
+		size_t copy_length = 0;
+		std::vector<u1> literal_bytes;
+		size_t cursor = 0; // End of the last copy written
+	public:
+		DeltaWriter(const u1 *old_bytes) : old_bytes(old_bytes) {}
+	public:
+		void varint(uint64_t value)
+		{
+			do {
+				u1 byte = value & 0x7F;
+				value >>= 7;
+				if (value)
+					byte |= 0x80;
+				this->stream.write(byte);
+			} while (value);
+		}
+
+		inline ByteStream &get_stream()
+		{
+			return this->stream;
+		}
+
+		void copy(size_t offset, size_t length)
+		{
+			if (length == 0)
+				return;
+
+			if (this->copy_length > 0 && offset == this->copy_offset + this->copy_length) {
+				this->copy_length += length;
+				return;
+			}
+
+			if (length < MIN_COPY_LENGTH) {
+				this->literal(&this->old_bytes[offset], length);
+				return;
+			}
+
+			this->flush();
+			this->copy_offset = offset;
+			this->copy_length = length;
+		}
+
+		void literal(const u1 *bytes, size_t length)
+		{
+			if (length == 0)
+				return;
+
+			if (this->copy_length > 0)
+				this->flush();
+			this->literal_bytes.insert(this->literal_bytes.end(), bytes, &bytes[length]);
+		}
+
+		void flush()
+		{
+			if (this->copy_length > 0) {
+				int64_t delta = static_cast<int64_t>(this->copy_offset) - static_cast<int64_t>(this->cursor);
+				this->varint(this->copy_length << 1);
+				this->varint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+				this->cursor = this->copy_offset + this->copy_length;
+				this->copy_length = 0;
+			}
+
+			if (!this->literal_bytes.empty()) {
+				this->varint((this->literal_bytes.size() << 1) | 1);
+				this->stream.write_bytes(this->literal_bytes);
+				this->literal_bytes.clear();
+			}
+		}
+	};
+
+	uint64_t read_varint(BufReader &reader)
+	{
+		uint64_t value = 0;
+		for (unsigned shift = 0; ; shift += 7) {
+			if (shift > 63)
+				throw DiffError { Error { ErrorKind::Malformed, reader.pos() } };
+
+			u1 byte = reader.read<u1>();
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+	}
+}
+
+std::expected<std::vector<u1>, Error> jcfp::diff(const u1 *old_bytes, size_t old_length,
+						 const u1 *new_bytes, size_t new_length)
+{
+	LOG("Diffing classes (old: %zu bytes, new: %zu bytes)...", old_length, new_length);
+
+	// A BufReader with no length is not bounds checked
+	if (old_length == 0 || new_length == 0)
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+
+	std::vector<Part> old_parts;
+	std::vector<Part> new_parts;
+	try {
+		old_parts = split(old_bytes, old_length);
+		new_parts = split(new_bytes, new_length);
+	} catch (const DiffError &e) {
+		ERR("Failed to split class at offset '%zu'", e.error.offset);
+		return std::unexpected(e.error);
+	} catch (const std::out_of_range &) {
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+	}
+
+	// The first one wins for duplicate keys (e.g. duplicate constants)
+	std::unordered_map<std::string_view, const Part *> old_index;
+	old_index.reserve(old_parts.size());
+	for (auto &part : old_parts)
+		old_index.try_emplace(part.key, &part);
+
+	DeltaWriter writer = DeltaWriter(old_bytes);
+	auto &stream = writer.get_stream();
+	stream.write_be(DELTA_MAGIC);
+	writer.varint(old_length);
+	uint64_t old_hash = hash_bytes(old_bytes, old_length);
+	for (size_t i = 0; i < sizeof(old_hash); ++i)
+		stream.write(static_cast<u1>(old_hash >> (i * 8)));
+	writer.varint(new_length);
+
+	for (auto &part : new_parts) {
+		const u1 *bytes = &new_bytes[part.offset];
+		auto it = old_index.find(part.key);
+		if (it == old_index.end()) {
+			writer.literal(bytes, part.length);
+			continue;
+		}
+
+		// Only the middle of a changed part is sent (e.g. the edited bytecode of a method)
+		const Part &old_part = *it->second;
+		const u1 *old_part_bytes = &old_bytes[old_part.offset];
+		size_t common = std::min(part.length, old_part.length);
+		size_t prefix = 0;
+		while (prefix < common && bytes[prefix] == old_part_bytes[prefix])
+			++prefix;
+		size_t suffix = 0;
+		while (suffix < common - prefix &&
+		       bytes[part.length - suffix - 1] == old_part_bytes[old_part.length - suffix - 1])
+			++suffix;
+
+		writer.copy(old_part.offset, prefix);
+		writer.literal(&bytes[prefix], part.length - prefix - suffix);
+		writer.copy(old_part.offset + old_part.length - suffix, suffix);
+	}
+	writer.flush();
+
+	auto delta = stream.collect();
+	LOG("Delta size: %zu bytes", delta.size());
+	return delta;
+}
+
+std::expected<std::vector<u1>, Error> jcfp::diff(ClassFile &old_class, ClassFile &new_class)
+{
+	return diff(old_class.encode(), new_class.encode());
+}
+
+std::expected<std::vector<u1>, Error> jcfp::patch(const u1 *old_bytes, size_t old_length, std::span<const u1> delta)
+{
+	if (delta.empty())
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+
+	BufReader reader = BufReader(delta.data(), delta.size());
+	try {
+		if (reader.read_be<u4>() != DELTA_MAGIC)
+			return std::unexpected(Error { ErrorKind::WrongMagic, 0 });
+
+		uint64_t expected_length = read_varint(reader);
+		uint64_t expected_hash = 0;
+		for (size_t i = 0; i < sizeof(expected_hash); ++i)
+			expected_hash |= static_cast<uint64_t>(reader.read<u1>()) << (i * 8);
+		if (expected_length != old_length || expected_hash != hash_bytes(old_bytes, old_length)) {
+			ERR("Delta was made for another class");
+			return std::unexpected(Error { ErrorKind::Malformed, 0 });
+		}
+
+		uint64_t new_length = read_varint(reader);
+		std::vector<u1> bytes;
+		bytes.reserve(std::min<uint64_t>(new_length, old_length + delta.size()));
+
+		size_t cursor = 0;
+		while (reader.pos() < delta.size()) {
+			size_t op_offset = reader.pos();
+			uint64_t op = read_varint(reader);
+			uint64_t length = op >> 1;
+			if (length > new_length - bytes.size())
+				throw DiffError { Error { ErrorKind::Malformed, op_offset } };
+
+			if (op & 1) {
+				const u1 *literal = &delta.data()[reader.pos()];
+				reader.skip(length);
+				bytes.insert(bytes.end(), literal, &literal[length]);
+				continue;
+			}
+
+			uint64_t zigzag = read_varint(reader);
+			int64_t offset_delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+			uint64_t offset = static_cast<uint64_t>(static_cast<int64_t>(cursor) + offset_delta);
+			if (offset > old_length || length > old_length - offset)
+				throw DiffError { Error { ErrorKind::Malformed, op_offset } };
+
+			bytes.insert(bytes.end(), &old_bytes[offset], &old_bytes[offset + length]);
+			cursor = offset + length;
+		}
+
+		if (bytes.size() != new_length)
+			throw DiffError { Error { ErrorKind::Malformed, reader.pos() } };
+
+		return bytes;
+	} catch (const DiffError &e) {
+		ERR("Failed to apply delta at offset '%zu'", e.error.offset);
+		return std::unexpected(e.error);
+	} catch (const std::out_of_range &) {
+		return std::unexpected(Error { ErrorKind::Malformed, reader.pos() });
+	}
+}
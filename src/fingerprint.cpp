@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/fingerprint.hpp>
+#include <jcfp/references.hpp>
+#include <jcfp/strip.hpp>
+#include <jcfp/utils.hpp>
+#include <algorithm>
+
+using namespace jcfp;
+using Tag = ConstantPoolEntry::Tag;
+
+namespace {
+	// Thrown while walking the class, turned into an `Error` by `fingerprint`
+	struct FingerprintError {
+		Error error;
+	};
+
+	// FNV-1a, finished with the MurmurHash3 mixer. Stable, but not cryptographic.
+	class Hasher {
+	private:
+		uint64_t state = 0xcbf29ce484222325;
+	public:
+		inline void bytes(const u1 *data, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i) {
+				this->state ^= data[i];
+				this->state *= 0x100000001b3;
+			}
+		}
+
+		// Little endian, so the result is the same everywhere
+		inline void value(uint64_t value)
+		{
+			u1 buf[sizeof(value)];
+			for (size_t i = 0; i < sizeof(buf); ++i)
+				buf[i] = static_cast<u1>(value >> (i * 8));
+			this->bytes(buf, sizeof(buf));
+		}
+
+		inline uint64_t finish() const
+		{
+			uint64_t hash = this->state;
+			hash ^= hash >> 33;
+			hash *= 0xff51afd7ed558ccd;
+			hash ^= hash >> 33;
+			hash *= 0xc4ceb9fe1a85ec53;
+			hash ^= hash >> 33;
+			return hash;
+		}
+	};
+
+	class Fingerprinter {
+	private:
+		enum class State : u1 { Unknown, Hashing, Done };
+
+		const u1 *bytes;
+		size_t length;
+		u4 flags;
+		std::vector<u4> offsets;
+		std::vector<uint64_t> entry_hashes;
+		std::vector<State> entry_states;
+		Utf8Lookup utf8;
+	public:
+		Fingerprinter(const u1 *bytes, size_t length, u4 flags) : bytes(bytes), length(length), flags(flags)
+		{
+			this->utf8 = [this](u2 index) -> std::optional<std::string_view> {
+				if (index == 0 || index >= this->offsets.size() || this->offsets[index] == 0)
+					return {};
+
+				const u1 *entry = &this->bytes[this->offsets[index]];
+				if (entry[0] != Tag::Utf8)
+					return {};
+				return std::string_view(reinterpret_cast<const char *>(&entry[3]), (entry[1] << 8) | entry[2]);
+			};
+		}
+	public:
+		uint64_t run()
+		{
+			BufReader reader = BufReader(this->bytes, this->length);
+			if (reader.read_be<u4>() != JCFP_CLASSFILE_MAGIC)
+				this->fail(ErrorKind::WrongMagic, 0);
+
+			Hasher hasher;
+			hasher.value(reader.read_be<u2>()); // minor_version
+			hasher.value(reader.read_be<u2>()); // major_version
+
+			auto scan_result = ConstantPool::scan(reader);
+			if (!scan_result.has_value())
+				throw FingerprintError { scan_result.error() };
+			this->offsets = std::move(scan_result.value());
+			this->entry_hashes.resize(this->offsets.size());
+			this->entry_states.resize(this->offsets.size(), State::Unknown);
+
+			hasher.value(reader.read_be<u2>()); // access_flags
+			hasher.value(this->entry(reader.read_be<u2>())); // this_class
+			hasher.value(this->reference(reader.read_be<u2>())); // super_class
+			u2 interfaces_count = reader.read_be<u2>();
+			hasher.value(interfaces_count);
+			for (u2 i = 0; i < interfaces_count; ++i)
+				hasher.value(this->entry(reader.read_be<u2>()));
+
+			hasher.value(this->members(reader)); // fields
+			hasher.value(this->members(reader)); // methods
+			hasher.value(this->attributes(reader, true));
+
+			if (reader.pos() != this->length)
+				this->fail(ErrorKind::Malformed, reader.pos());
+
+			return hasher.finish();
+		}
+	private:
+		[[noreturn]] void fail(ErrorKind kind, size_t offset)
+		{
+			throw FingerprintError { Error { kind, offset } };
+		}
+
+		inline bool is_abi() const
+		{
+			return this->flags & FINGERPRINT_ABI;
+		}
+
+		uint64_t entry(u2 index)
+		{
+			if (index == 0 || index >= this->offsets.size() || this->offsets[index] == 0)
+				this->fail(ErrorKind::Malformed, index);
+			if (this->entry_states[index] == State::Done)
+				return this->entry_hashes[index];
+			if (this->entry_states[index] == State::Hashing)
+				this->fail(ErrorKind::Malformed, this->offsets[index]); // Reference cycle
+			this->entry_states[index] = State::Hashing;
+
+			// Bounds were checked by the scan
+			size_t offset = this->offsets[index];
+			BufReader reader = BufReader(&this->bytes[offset], this->length - offset);
+			u1 tag = reader.read<u1>();
+			Hasher hasher;
+			hasher.value(tag);
+
+			switch (tag) {
+			case Tag::Utf8: {
+				u2 length = reader.read_be<u2>();
+				hasher.bytes(&this->bytes[offset + reader.pos()], length);
+				break;
+			}
+			case Tag::Integer:
+			case Tag::Float:
+				hasher.value(reader.read_be<u4>());
+				break;
+			case Tag::Long:
+			case Tag::Double:
+				hasher.value(reader.read_be<u4>());
+				hasher.value(reader.read_be<u4>());
+				break;
+			case Tag::Class:
+			case Tag::String:
+			case Tag::MethodType:
+			case Tag::Module:
+			case Tag::Package:
+				hasher.value(this->entry(reader.read_be<u2>()));
+				break;
+			case Tag::Fieldref:
+			case Tag::Methodref:
+			case Tag::InterfaceMethodref:
+			case Tag::NameAndType:
+				hasher.value(this->entry(reader.read_be<u2>()));
+				hasher.value(this->entry(reader.read_be<u2>()));
+				break;
+			case Tag::MethodHandle:
+				hasher.value(reader.read<u1>()); // reference_kind
+				hasher.value(this->entry(reader.read_be<u2>()));
+				break;
+			case Tag::Dynamic:
+			case Tag::InvokeDynamic:
+				// Index into the BootstrapMethods attribute, which is hashed in order
+				hasher.value(reader.read_be<u2>());
+				hasher.value(this->entry(reader.read_be<u2>()));
+				break;
+			default:
+				this->fail(ErrorKind::InvalidTag, offset);
+			}
+
+			this->entry_states[index] = State::Done;
+			this->entry_hashes[index] = hasher.finish();
+			return this->entry_hashes[index];
+		}
+
+		// Same as `entry`, but 0 means "none"
+		inline uint64_t reference(u2 index)
+		{
+			return index == 0 ? 0 : this->entry(index);
+		}
+
+		bool wants_attribute(std::string_view name)
+		{
+			if (this->flags & FINGERPRINT_IGNORE_DEBUG) {
+				if (name == "SourceFile" ||
+				    std::find(std::begin(debug_attributes), std::end(debug_attributes), name) != std::end(debug_attributes))
+					return false;
+			}
+
+			if (this->is_abi())
+				return name == "ConstantValue" || name == "Exceptions" || name == "Signature";
+
+			return true;
+		}
+
+		// Hashes `body`, with the indices at `sites` replaced by the hashes of their entries
+		void body(Hasher &hasher, std::span<const u1> body, std::vector<ReferenceSite> &sites)
+		{
+			std::sort(sites.begin(), sites.end(), [](auto &a, auto &b) { return a.offset < b.offset; });
+
+			size_t pos = 0;
+			for (auto &site : sites) {
+				hasher.bytes(body.data() + pos, site.offset - pos);
+				u2 index = site.width == 1 ? body[site.offset] : (body[site.offset] << 8) | body[site.offset + 1];
+				hasher.value(this->reference(index));
+				pos = site.offset + site.width;
+			}
+			auto rest = body.subspan(pos);
+			hasher.bytes(rest.data(), rest.size());
+		}
+
+		uint64_t attribute(u2 name_index, std::span<const u1> body)
+		{
+			if (*this->utf8(name_index) == "Code")
+				return this->code(name_index, body);
+
+			Hasher hasher;
+			hasher.value(this->entry(name_index));
+
+			auto sites = find_references(this->utf8, name_index, body);
+			if (!sites.has_value()) {
+				if (sites.error().kind != ErrorKind::Unsupported)
+					this->fail(sites.error().kind, name_index);
+
+				// Unknown layout, can't tell the indices from the rest
+				hasher.bytes(body.data(), body.size());
+				return hasher.finish();
+			}
+
+			this->body(hasher, body, sites.value());
+			return hasher.finish();
+		}
+
+		// The nested attributes are filtered like the others, so they are hashed one by one
+		uint64_t code(u2 name_index, std::span<const u1> body)
+		{
+			Hasher hasher;
+			hasher.value(this->entry(name_index));
+
+			// A BufReader with no length is not bounds checked
+			if (body.empty())
+				this->fail(ErrorKind::Malformed, name_index);
+
+			BufReader reader = BufReader(body.data(), body.size());
+			reader.skip(2 * sizeof(u2)); // max_stack, max_locals
+			reader.skip(reader.read_be<u4>()); // code
+			reader.skip(reader.read_be<u2>() * 4 * sizeof(u2)); // exception_table
+			size_t attributes_offset = reader.pos();
+
+			auto sites = find_references(this->utf8, name_index, body);
+			if (!sites.has_value() && sites.error().kind == ErrorKind::Unsupported) {
+				// A nested attribute has an unknown layout, look for the sites without the nested attributes
+				std::vector<u1> head = std::vector<u1>(body.begin(), body.begin() + attributes_offset);
+				head.resize(head.size() + sizeof(u2)); // attributes_count = 0
+				sites = find_references(this->utf8, name_index, head);
+			}
+			if (!sites.has_value())
+				this->fail(sites.error().kind, name_index);
+
+			std::erase_if(sites.value(), [&](auto &site) { return site.offset >= attributes_offset; });
+			this->body(hasher, body.first(attributes_offset), sites.value());
+			hasher.value(this->attributes(reader, true));
+			return hasher.finish();
+		}
+
+		// Hash of an attribute table, or just skips it if `hash` is false
+		uint64_t attributes(BufReader &reader, bool hash)
+		{
+			Hasher hasher;
+			u2 kept = 0;
+			for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+				u2 name_index = reader.read_be<u2>();
+				u4 length = reader.read_be<u4>();
+				std::span<const u1> body = { &reader.data()[reader.pos()], length };
+				reader.skip(length);
+				if (!hash)
+					continue;
+
+				auto name = this->utf8(name_index);
+				if (!name)
+					this->fail(ErrorKind::Malformed, reader.pos());
+				if (!this->wants_attribute(*name))
+					continue;
+
+				hasher.value(this->attribute(name_index, body));
+				++kept;
+			}
+
+			hasher.value(kept);
+			return hasher.finish();
+		}
+
+		uint64_t members(BufReader &reader)
+		{
+			std::vector<uint64_t> hashes;
+			for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+				u2 access_flags = reader.read_be<u2>();
+				u2 name_index = reader.read_be<u2>();
+				u2 descriptor_index = reader.read_be<u2>();
+				bool visible = (access_flags & (ACC_PUBLIC | ACC_PROTECTED)) != 0;
+				uint64_t attributes = this->attributes(reader, visible || !this->is_abi());
+				if (this->is_abi() && !visible)
+					continue;
+
+				Hasher hasher;
+				hasher.value(access_flags);
+				hasher.value(this->entry(name_index));
+				hasher.value(this->entry(descriptor_index));
+				hasher.value(attributes);
+				hashes.push_back(hasher.finish());
+			}
+
+			// The ABI doesn't depend on the order of the members
+			if (this->is_abi())
+				std::sort(hashes.begin(), hashes.end());
+
+			Hasher hasher;
+			hasher.value(hashes.size());
+			for (uint64_t hash : hashes)
+				hasher.value(hash);
+			return hasher.finish();
+		}
+	};
+}
+
+std::expected<uint64_t, Error> jcfp::fingerprint(const u1 *bytes, size_t length, u4 flags)
+{
+	// A BufReader with no length is not bounds checked
+	if (length == 0)
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+
+	try {
+		return Fingerprinter(bytes, length, flags).run();
+	} catch (const FingerprintError &e) {
+		ERR("Failed to fingerprint class at offset '%zu'", e.error.offset);
+		return std::unexpected(e.error);
+	} catch (const std::out_of_range &) {
+		return std::unexpected(Error { ErrorKind::Malformed, length });
+	}
+}
+
+std::expected<uint64_t, Error> jcfp::fingerprint(ClassFile &classfile, u4 flags)
+{
+	return fingerprint(classfile.encode(), flags);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/frozen.hpp>
+#include <jcfp/utils.hpp>
+
+using namespace jcfp;
+
+FrozenClassFile::FrozenClassFile(ClassFile &classfile)
+	: magic(classfile.magic), minor_version(classfile.minor_version), major_version(classfile.major_version),
+	  constant_pool(std::move(classfile.constant_pool)), access_flags(classfile.access_flags),
+	  this_class(classfile.this_class), super_class(classfile.super_class),
+	  interfaces(std::move(classfile.interfaces)), source(std::move(classfile.source)),
+	  constant_pool_source(classfile.constant_pool_source), attributes_source(classfile.attributes_source)
+{
+	this->fields.reserve(classfile.fields.size());
+	for (auto &field : classfile.fields)
+		this->fields.push_back(Cow<FieldInfo>(std::move(field)));
+
+	this->methods.reserve(classfile.methods.size());
+	for (auto &method : classfile.methods)
+		this->methods.push_back(Cow<MethodInfo>(std::move(method)));
+
+	this->attributes.reserve(classfile.attributes.size());
+	for (auto &attribute : classfile.attributes)
+		this->attributes.push_back(Cow<AttributeInfo>(std::move(attribute)));
+}
+
+FrozenClassFile FrozenClassFile::freeze(ClassFile classfile)
+{
+	// Decoding the remaining lazy entries doesn't count as a modification
+	classfile.constant_pool.get_entries();
+
+	return FrozenClassFile(classfile);
+}
+
+ClassFile FrozenClassFile::thaw() const
+{
+	std::vector<FieldInfo> fields;
+	fields.reserve(this->fields.size());
+	for (auto &field : this->fields)
+		fields.push_back(*field);
+
+	std::vector<MethodInfo> methods;
+	methods.reserve(this->methods.size());
+	for (auto &method : this->methods)
+		methods.push_back(*method);
+
+	std::vector<AttributeInfo> attributes;
+	attributes.reserve(this->attributes.size());
+	for (auto &attribute : this->attributes)
+		attributes.push_back(*attribute);
+
+	ClassFile classfile = ClassFile(this->magic, this->minor_version, this->major_version, *this->constant_pool,
+					this->access_flags, this->this_class, this->super_class, this->interfaces,
+					std::move(fields), std::move(methods), std::move(attributes));
+	classfile.source = this->source;
+	classfile.constant_pool_source = this->constant_pool_source;
+	classfile.attributes_source = this->attributes_source;
+
+	return classfile;
+}
+
+std::vector<u1> FrozenClassFile::encode() const
+{
+	ByteStream stream = ByteStream();
+	if (this->source)
+		stream.reserve(this->source->size());
+	this->encode(stream);
+	return stream.collect();
+}
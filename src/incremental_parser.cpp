@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/incremental_parser.hpp>
+#include <jcfp/utils.hpp>
+#include <algorithm>
+
+using namespace jcfp;
+
+std::expected<FeedStatus, Error> IncrementalParser::feed(std::span<const u1> chunk)
+{
+	if (this->state == State::Done)
+		return FeedStatus::Done;
+
+	if (this->options.flags & (PARSE_LAZY_CONSTANT_POOL | PARSE_RETAIN_SOURCE)) {
+		ERR("Incremental parsing does not support lazy constant pools or retained sources");
+		return std::unexpected(Error { ErrorKind::Unsupported, this->offset });
+	}
+
+	// Parse straight from the chunk when nothing is pending, and only
+	// keep the incomplete tail (if any) for the next call
+	if (this->pending.empty()) {
+		auto result = this->process(chunk.data(), chunk.size());
+		if (!result.has_value())
+			return std::unexpected(result.error());
+		this->pending.assign(chunk.begin() + result.value(), chunk.end());
+	} else {
+		this->pending.insert(this->pending.end(), chunk.begin(), chunk.end());
+		auto result = this->process(this->pending.data(), this->pending.size());
+		if (!result.has_value())
+			return std::unexpected(result.error());
+		this->pending.erase(this->pending.begin(), this->pending.begin() + result.value());
+	}
+
+	if (this->state == State::Done) {
+		this->pending = {};
+		return FeedStatus::Done;
+	}
+
+	return FeedStatus::NeedMoreData;
+}
+
+std::optional<ClassFile> IncrementalParser::take()
+{
+	if (this->state != State::Done)
+		return {};
+
+	return ClassFile(this->magic, this->minor_version, this->major_version, std::move(this->constant_pool),
+			 this->access_flags, this->this_class, this->super_class, std::move(this->interfaces),
+			 std::move(this->fields), std::move(this->methods), std::move(this->attributes));
+}
+
+std::expected<size_t, Error> IncrementalParser::process(const u1 *bytes, size_t size)
+{
+	size_t pos = 0;
+
+	while (this->state != State::Done) {
+		if (this->state == State::AttributeBody) {
+			size_t length = std::min(static_cast<size_t>(this->body_left), size - pos);
+			if (this->keep_attribute)
+				this->attribute.info.insert(this->attribute.info.end(), &bytes[pos], &bytes[pos + length]);
+			pos += length;
+			this->offset += length;
+			this->body_left -= length;
+			if (this->body_left > 0)
+				break;
+
+			this->end_attribute();
+			continue;
+		}
+
+		if (pos == size)
+			break;
+
+		// Every step reads a whole element before changing any state,
+		// so an incomplete element is simply retried on the next feed
+		BufReader reader = BufReader(&bytes[pos], size - pos);
+		try {
+			auto result = this->step(reader);
+			if (!result.has_value())
+				return std::unexpected(result.error());
+		} catch (const std::out_of_range &) {
+			break;
+		}
+
+		pos += reader.pos();
+		this->offset += reader.pos();
+	}
+
+	return pos;
+}
+
+std::expected<void, Error> IncrementalParser::step(BufReader &reader)
+{
+	switch (this->state) {
+	case State::Header: {
+		u4 magic = reader.read_be<u4>();
+		u2 minor_version = reader.read_be<u2>();
+		u2 major_version = reader.read_be<u2>();
+		u2 constant_pool_count = reader.read_be<u2>();
+		if (magic != JCFP_CLASSFILE_MAGIC)
+			return std::unexpected(Error { ErrorKind::WrongMagic, this->offset });
+
+		this->magic = magic;
+		this->minor_version = minor_version;
+		this->major_version = static_cast<MajorVersion>(major_version);
+		this->constant_pool_count = constant_pool_count;
+
+		// The first entry is always an empty tag
+		if (constant_pool_count > 0) {
+			this->entries.reserve(constant_pool_count);
+			this->entries.push_back(ConstantPoolEntry());
+		}
+
+		this->state = State::ConstantPoolEntry;
+		if (this->constant_pool_index >= this->constant_pool_count)
+			this->end_constant_pool();
+		break;
+	}
+	case State::ConstantPoolEntry: {
+		auto result = ConstantPoolEntry::parse(reader, this->options.interner);
+		if (!result.has_value())
+			return std::unexpected(result.error());
+
+		auto &entry = result.value();
+		bool is_wide = entry.is_wide_entry();
+		this->entries.push_back(std::move(entry));
+		++this->constant_pool_index;
+
+		// 8-byte constants take up two entries, see `ConstantPool::parse`
+		if (is_wide) {
+			this->entries.push_back(ConstantPoolEntry());
+			++this->constant_pool_index;
+		}
+
+		if (this->constant_pool_index >= this->constant_pool_count)
+			this->end_constant_pool();
+		break;
+	}
+	case State::ClassInfo: {
+		AccessFlags access_flags = reader.read_be<AccessFlags>();
+		u2 this_class = reader.read_be<u2>();
+		u2 super_class = reader.read_be<u2>();
+		u2 interfaces_count = reader.read_be<u2>();
+
+		this->access_flags = access_flags;
+		this->this_class = this_class;
+		this->super_class = super_class;
+		this->interfaces_count = interfaces_count;
+		this->state = State::Interfaces;
+		if (interfaces_count == 0)
+			this->end_interfaces();
+		break;
+	}
+	case State::Interfaces: {
+		std::vector<u2> interfaces;
+		interfaces.reserve(this->interfaces_count);
+		for (u2 i = 0; i < this->interfaces_count; ++i)
+			interfaces.push_back(reader.read_be<u2>());
+
+		this->interfaces = std::move(interfaces);
+		this->end_interfaces();
+		break;
+	}
+	case State::MembersCount: {
+		u2 members_count = reader.read_be<u2>();
+
+		this->members_left = members_count;
+		if (this->section == Section::Fields && this->options.has(PARSE_FIELDS))
+			this->fields.reserve(members_count);
+		else if (this->section == Section::Methods && this->options.has(PARSE_METHODS))
+			this->methods.reserve(members_count);
+
+		this->state = State::MemberHeader;
+		if (members_count == 0)
+			this->end_section();
+		break;
+	}
+	case State::MemberHeader: {
+		AccessFlags flags = reader.read_be<AccessFlags>();
+		u2 name_index = reader.read_be<u2>();
+		u2 descriptor_index = reader.read_be<u2>();
+		u2 attributes_count = reader.read_be<u2>();
+
+		this->member = MethodInfo { flags, name_index, descriptor_index, {} };
+		this->keep_member = this->options.has(this->section == Section::Fields ? PARSE_FIELDS : PARSE_METHODS);
+		this->attributes_left = attributes_count;
+		this->state = State::AttributeHeader;
+		if (attributes_count == 0)
+			this->end_member();
+		break;
+	}
+	case State::AttributesCount: {
+		u2 attributes_count = reader.read_be<u2>();
+
+		this->attributes_left = attributes_count;
+		if (this->options.has(PARSE_CLASS_ATTRIBUTES))
+			this->attributes.reserve(attributes_count);
+
+		this->state = State::AttributeHeader;
+		if (attributes_count == 0)
+			this->state = State::Done;
+		break;
+	}
+	case State::AttributeHeader: {
+		u2 attribute_name_index = reader.read_be<u2>();
+		u4 attribute_length = reader.read_be<u4>();
+
+		u4 flag = PARSE_CLASS_ATTRIBUTES;
+		if (this->section == Section::Fields)
+			flag = PARSE_FIELD_ATTRIBUTES;
+		else if (this->section == Section::Methods)
+			flag = PARSE_METHOD_ATTRIBUTES;
+
+		bool keep = (this->section == Section::Class || this->keep_member) && this->options.has(flag);
+		// The names are only looked up when filtering, see `ClassFile::parse`
+		if (keep && !this->options.attribute_names.empty() && !this->constant_pool.find_utf8(attribute_name_index)) {
+			ERR("Invalid attribute name index '%hu'", attribute_name_index);
+			return std::unexpected(Error { ErrorKind::Malformed, this->offset });
+		}
+
+		this->keep_attribute = keep && this->options.wants_attribute(this->constant_pool, attribute_name_index);
+		this->attribute = AttributeInfo(attribute_name_index, {});
+		// The length is not trusted until the body actually arrives
+		if (this->keep_attribute)
+			this->attribute.info.reserve(std::min(attribute_length, static_cast<u4>(0x10000)));
+		this->body_left = attribute_length;
+		this->state = State::AttributeBody;
+		break;
+	}
+	case State::AttributeBody:
+	case State::Done:
+		break;
+	}
+
+	return {};
+}
+
+void IncrementalParser::end_constant_pool()
+{
+	LOG("Constant pool parsed incrementally (offset: %lu, entries: %lu)", this->offset, this->entries.size());
+	this->constant_pool = ConstantPool(std::move(this->entries));
+	this->entries = {};
+	this->state = State::ClassInfo;
+}
+
+void IncrementalParser::end_interfaces()
+{
+	// Nothing past this point was requested, see `ClassFile::parse`
+	if (!this->options.has(PARSE_FIELDS) && !this->options.has(PARSE_METHODS) &&
+	    !this->options.has(PARSE_CLASS_ATTRIBUTES)) {
+		this->state = State::Done;
+		return;
+	}
+
+	this->section = Section::Fields;
+	this->state = State::MembersCount;
+}
+
+void IncrementalParser::end_section()
+{
+	if (this->section == Section::Fields) {
+		if (!this->options.has(PARSE_METHODS) && !this->options.has(PARSE_CLASS_ATTRIBUTES)) {
+			this->state = State::Done;
+			return;
+		}
+
+		this->section = Section::Methods;
+		this->state = State::MembersCount;
+	} else {
+		this->section = Section::Class;
+		this->state = State::AttributesCount;
+	}
+}
+
+void IncrementalParser::end_member()
+{
+	if (this->keep_member) {
+		if (this->section == Section::Fields) {
+			this->fields.push_back(FieldInfo {
+				this->member.access_flags, this->member.name_index,
+				this->member.descriptor_index, std::move(this->member.attributes)
+			});
+		} else {
+			this->methods.push_back(std::move(this->member));
+		}
+	}
+
+	this->member = {};
+	--this->members_left;
+	this->state = State::MemberHeader;
+	if (this->members_left == 0)
+		this->end_section();
+}
+
+void IncrementalParser::end_attribute()
+{
+	if (this->keep_attribute) {
+		if (this->section == Section::Class)
+			this->attributes.push_back(std::move(this->attribute));
+		else
+			this->member.attributes.push_back(std::move(this->attribute));
+	}
+
+	--this->attributes_left;
+	this->state = State::AttributeHeader;
+	if (this->attributes_left > 0)
+		return;
+
+	if (this->section == Section::Class)
+		this->state = State::Done;
+	else
+		this->end_member();
+}
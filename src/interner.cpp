@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/interner.hpp>
+
+using namespace jcfp;
+
+const std::string *StringInterner::intern(std::string_view str)
+{
+	size_t hash = Hash{}(str);
+
+	// The low bits pick the bucket inside the shard, use the high ones here
+	auto &shard = this->shards[(hash >> (sizeof(size_t) * 8 - 16)) % shard_count];
+	std::lock_guard lock(shard.mutex);
+
+	auto it = shard.strings.find(str);
+	if (it == shard.strings.end())
+		it = shard.strings.emplace(str).first;
+
+	// Set nodes never move, so the address is stable
+	return &*it;
+}
+
+size_t StringInterner::size()
+{
+	size_t size = 0;
+	for (auto &shard : this->shards) {
+		std::lock_guard lock(shard.mutex);
+		size += shard.strings.size();
+	}
+
+	return size;
+}
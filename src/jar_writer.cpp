@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/jar_writer.hpp>
+#include <jcfp/parallel.hpp>
+#include <jcfp/utils.hpp>
+#include <array>
+#include <limits>
+
+#ifdef JCFP_HAVE_ZLIB
+#	include <zlib.h>
+#endif
+
+using namespace jcfp;
+
+static u4 compute_crc32(const std::vector<u1> &data)
+{
+#ifdef JCFP_HAVE_ZLIB
+	return crc32(crc32(0, nullptr, 0), data.data(), data.size());
+#else
+	static const auto table = []() {
+		std::array<u4, 256> table;
+		for (u4 i = 0; i < 256; ++i) {
+			u4 crc = i;
+			for (int j = 0; j < 8; ++j)
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+			table[i] = crc;
+		}
+		return table;
+	}();
+
+	u4 crc = 0xFFFFFFFF;
+	for (u1 byte : data)
+		crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+#endif
+}
+
+#ifdef JCFP_HAVE_ZLIB
+// Raw deflate (no zlib header), as ZIP expects. Returns nothing if it doesn't shrink the data.
+static std::optional<std::vector<u1>> deflate_raw(const std::vector<u1> &data)
+{
+	z_stream stream = {};
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return {};
+
+	std::vector<u1> compressed(deflateBound(&stream, data.size()));
+	stream.next_in = const_cast<Bytef *>(data.data());
+	stream.avail_in = data.size();
+	stream.next_out = compressed.data();
+	stream.avail_out = compressed.size();
+
+	int status = deflate(&stream, Z_FINISH);
+	size_t size = stream.total_out;
+	deflateEnd(&stream);
+
+	if (status != Z_STREAM_END || size >= data.size())
+		return {};
+
+	compressed.resize(size);
+	return compressed;
+}
+#endif
+
+std::expected<void, Error> JarWriter::prepare()
+{
+#ifndef JCFP_HAVE_ZLIB
+	if (this->compression == Compression::Deflate) {
+		ERR("Deflate requested, but the library was built without zlib");
+		return std::unexpected(Error { ErrorKind::Unsupported, 0 });
+	}
+#endif
+
+	if (this->entries.size() > std::numeric_limits<u2>::max()) {
+		ERR("Too many entries for a non-ZIP64 archive (%lu)", this->entries.size());
+		return std::unexpected(Error { ErrorKind::Unsupported, 0 });
+	}
+
+	for (auto &entry : this->entries) {
+		if (entry.name.size() > std::numeric_limits<u2>::max()) {
+			ERR("Entry name too long (%zu bytes)", entry.name.size());
+			return std::unexpected(Error { ErrorKind::Unsupported, 0 });
+		}
+	}
+
+	// Computed aside, so a failure leaves the entries untouched and `finish` can be called again
+	std::vector<Prepared> prepared(this->entries.size());
+	parallel_for(this->entries.size(), [this, &prepared](size_t i) {
+		auto &entry = this->entries[i];
+		auto &result = prepared[i];
+		if (entry.classfile.has_value())
+			result.data = entry.classfile.value().encode();
+
+		const std::vector<u1> &data = result.data.has_value() ? result.data.value() : entry.data;
+		result.size = data.size();
+		if (result.size > std::numeric_limits<u4>::max())
+			return;
+		result.crc32 = compute_crc32(data);
+
+#ifdef JCFP_HAVE_ZLIB
+		if (this->compression == Compression::Deflate) {
+			auto compressed = deflate_raw(data);
+			if (compressed.has_value()) {
+				result.data = std::move(compressed.value());
+				result.method = 8;
+			}
+		}
+#endif
+	}, this->threads);
+
+	// Every offset and size has to fit in a u4
+	uint64_t total = 22;
+	for (size_t i = 0; i < this->entries.size(); ++i) {
+		auto &entry = this->entries[i];
+		size_t stored = prepared[i].data.has_value() ? prepared[i].data.value().size() : entry.data.size();
+		total += 30 + 46 + 2 * entry.name.size() + stored;
+		if (prepared[i].size > std::numeric_limits<u4>::max() || total > std::numeric_limits<u4>::max()) {
+			ERR("Archive too big for a non-ZIP64 archive");
+			return std::unexpected(Error { ErrorKind::Unsupported, 0 });
+		}
+	}
+
+	for (size_t i = 0; i < this->entries.size(); ++i) {
+		auto &entry = this->entries[i];
+		if (prepared[i].data.has_value())
+			entry.data = std::move(prepared[i].data.value());
+		entry.classfile.reset();
+		entry.size = prepared[i].size;
+		entry.crc32 = prepared[i].crc32;
+		entry.method = prepared[i].method;
+	}
+
+	return {};
+}
+
+std::expected<std::vector<u1>, Error> JarWriter::finish()
+{
+	ByteStream stream = ByteStream();
+	auto result = this->finish(stream);
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	return stream.collect();
+}
@@ -18,7 +18,65 @@
 
 using namespace jcfp;
 
-std::expected<ClassFile, Error> ClassFile::parse(const u1 *bytes, size_t max_length)
+bool ParseOptions::wants_attribute(ConstantPool &constant_pool, u2 attribute_name_index) const
+{
+	if (this->attribute_names.empty())
+		return true;
+
+	const std::string *name = constant_pool.find_utf8(attribute_name_index);
+	if (!name)
+		return false;
+
+	for (auto &wanted : this->attribute_names) {
+		if (*name == wanted)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Parses an attribute table, keeping only the attributes selected by `options`.
+ * If `keep` is false, the whole table is skipped by length. `complete` is set
+ * to false if any attribute was left out.
+ */
+static std::expected<std::vector<AttributeInfo>, Error> parse_attributes(BufReader &reader, ConstantPool &constant_pool,
+									 const ParseOptions &options, bool keep, bool &complete)
+{
+	std::vector<AttributeInfo> attributes;
+	u2 attributes_count = reader.read_be<u2>();
+	complete = keep || attributes_count == 0;
+
+	if (!keep) {
+		for (u2 i = 0; i < attributes_count; ++i)
+			AttributeInfo::skip(reader);
+		return attributes;
+	}
+
+	attributes.reserve(attributes_count);
+	for (u2 i = 0; i < attributes_count; ++i) {
+		size_t attribute_start = reader.pos();
+		u2 attribute_name_index = reader.read_be<u2>();
+		u4 attribute_length = reader.read_be<u4>();
+		// The names are only looked up when filtering
+		if (!options.attribute_names.empty() && !constant_pool.find_utf8(attribute_name_index)) {
+			ERR("Invalid attribute name index '%hu'", attribute_name_index);
+			return std::unexpected(Error { ErrorKind::Malformed, attribute_start });
+		}
+
+		if (!options.wants_attribute(constant_pool, attribute_name_index)) {
+			reader.skip(attribute_length);
+			complete = false;
+			continue;
+		}
+
+		attributes.push_back(AttributeInfo(attribute_name_index, reader.read_bytes(attribute_length)));
+	}
+
+	return attributes;
+}
+
+std::expected<ClassFile, Error> ClassFile::parse(const u1 *bytes, size_t max_length, const ParseOptions &options)
 {
 	u4 magic;
 	u2 minor_version;
@@ -31,9 +89,39 @@ std::expected<ClassFile, Error> ClassFile::parse(const u1 *bytes, size_t max_len
 	std::vector<FieldInfo> fields;
 	std::vector<MethodInfo> methods;
 	std::vector<AttributeInfo> attributes;
+	SourceRange constant_pool_source;
+	SourceRange attributes_source;
 
 	BufReader reader = BufReader(bytes, max_length);
-	LOG("Parsing ClassFile (bytes: %p, max_length: %lu)...", bytes, max_length);
+	LOG("Parsing ClassFile (bytes: %p, max_length: %lu, flags: %x)...", bytes, max_length, options.flags);
+
+	bool retain_source = options.has(PARSE_RETAIN_SOURCE);
+	// Sections with skipped attributes must be encoded again, so they get no range
+	auto range_from = [&](size_t start, bool complete = true) {
+		return retain_source && complete ? SourceRange { static_cast<u4>(start), static_cast<u4>(reader.pos() - start) }
+						 : SourceRange {};
+	};
+
+	auto build = [&]() {
+		ClassFile classfile = ClassFile(magic, minor_version, major_version, std::move(constant_pool),
+						access_flags, this_class, super_class, std::move(interfaces),
+						std::move(fields), std::move(methods), std::move(attributes));
+		if (retain_source) {
+			classfile.source = std::make_shared<const std::vector<u1>>(bytes, &bytes[reader.pos()]);
+			classfile.constant_pool_source = constant_pool_source;
+			classfile.attributes_source = attributes_source;
+
+			// The ranges were recorded before the buffer existed
+			classfile.constant_pool_source.buffer = classfile.source;
+			classfile.attributes_source.buffer = classfile.source;
+			for (auto &field : classfile.fields)
+				field.source.buffer = classfile.source;
+			for (auto &method : classfile.methods)
+				method.source.buffer = classfile.source;
+		}
+
+		return classfile;
+	};
 
 	magic = reader.read_be<u4>();
 	LOG("ClassFile magic: %X", magic);
@@ -44,11 +132,17 @@ std::expected<ClassFile, Error> ClassFile::parse(const u1 *bytes, size_t max_len
 	major_version = static_cast<MajorVersion>(reader.read_be<u2>());
 	LOG("ClassFile version: %hu %hu", major_version, minor_version);
 
-	auto result = ConstantPool::parse(reader);
+	size_t constant_pool_start = reader.pos();
+	JCFP_TRACE_BEGIN(constant_pool_trace, TracePhase::ConstantPool, constant_pool_start);
+	auto result = options.has(PARSE_LAZY_CONSTANT_POOL) ? ConstantPool::parse_lazy(reader, options.interner)
+							    : ConstantPool::parse(reader, options.interner);
 	if (!result.has_value())
 		return std::unexpected(result.error());
-	constant_pool = result.value();
+	constant_pool = std::move(result.value());
+	constant_pool_source = range_from(constant_pool_start);
+	JCFP_TRACE_END(constant_pool_trace, reader.pos());
 
+	JCFP_TRACE_BEGIN(header_trace, TracePhase::Header, reader.pos());
 	access_flags = reader.read_be<AccessFlags>();
 	this_class = reader.read_be<u2>();
 	super_class = reader.read_be<u2>();
@@ -58,137 +152,181 @@ std::expected<ClassFile, Error> ClassFile::parse(const u1 *bytes, size_t max_len
 
 	u2 interfaces_count = reader.read_be<u2>();
 	LOG("Interfaces count: %hu", interfaces_count);
+	interfaces.reserve(interfaces_count);
 	for (u2 i = 0; i < interfaces_count; ++i) {
 		u2 iface = reader.read_be<u2>();
 		interfaces.push_back(iface);
 	}
+	JCFP_TRACE_END(header_trace, reader.pos());
+
+	// Nothing past this point was requested, no need to walk the rest of the class
+	if (!options.has(PARSE_FIELDS) && !options.has(PARSE_METHODS) && !options.has(PARSE_CLASS_ATTRIBUTES)) {
+		LOG("ClassFile parsed partially (offset: %lu)", reader.pos());
+		return build();
+	}
 
+	JCFP_TRACE_BEGIN(fields_trace, TracePhase::Fields, reader.pos());
 	u2 fields_count = reader.read_be<u2>();
 	LOG("Fields count: %hu", fields_count);
+	if (options.has(PARSE_FIELDS))
+		fields.reserve(fields_count);
 	for (u2 i = 0; i < fields_count; ++i) {
+		size_t field_start = reader.pos();
 		AccessFlags flags = reader.read_be<AccessFlags>(); // u2
 		u2 name_index = reader.read_be<u2>();
 		u2 descriptor_index = reader.read_be<u2>();
 
-		std::vector<AttributeInfo> attributes;
-		u2 attributes_count = reader.read_be<u2>();
-		for (u2 j = 0; j < attributes_count; ++j) {
-			attributes.push_back(AttributeInfo::parse(reader));
-		}
+		bool keep = options.has(PARSE_FIELDS);
+		bool complete;
+		auto attributes = parse_attributes(reader, constant_pool, options,
+						   keep && options.has(PARSE_FIELD_ATTRIBUTES), complete);
+		if (!attributes.has_value())
+			return std::unexpected(attributes.error());
+		if (!keep)
+			continue;
 
 		fields.push_back(FieldInfo {
 			flags, name_index, descriptor_index,
-			std::move(attributes)
+			std::move(attributes.value()), range_from(field_start, complete)
 		});
 	}
 
+	JCFP_TRACE_END(fields_trace, reader.pos());
+
+	if (!options.has(PARSE_METHODS) && !options.has(PARSE_CLASS_ATTRIBUTES)) {
+		LOG("ClassFile parsed partially (offset: %lu)", reader.pos());
+		return build();
+	}
+
+	JCFP_TRACE_BEGIN(methods_trace, TracePhase::Methods, reader.pos());
 	u2 methods_count = reader.read_be<u2>();
 	LOG("Methods count: %hu", methods_count);
+	if (options.has(PARSE_METHODS))
+		methods.reserve(methods_count);
 	for (u2 i = 0; i < methods_count; ++i) {
+		size_t method_start = reader.pos();
 		AccessFlags flags = reader.read_be<AccessFlags>();
 		u2 name_index = reader.read_be<u2>();
 		u2 descriptor_index = reader.read_be<u2>();
 
-		std::vector<AttributeInfo> attributes;
-		u2 attributes_count = reader.read_be<u2>();
-		for (u2 j = 0; j < attributes_count; ++j) {
-			attributes.push_back(AttributeInfo::parse(reader));
-		}
+		bool keep = options.has(PARSE_METHODS);
+		bool complete;
+		auto attributes = parse_attributes(reader, constant_pool, options,
+						   keep && options.has(PARSE_METHOD_ATTRIBUTES), complete);
+		if (!attributes.has_value())
+			return std::unexpected(attributes.error());
+		if (!keep)
+			continue;
 
 		methods.push_back(MethodInfo {
 			flags, name_index, descriptor_index,
-			std::move(attributes)
+			std::move(attributes.value()), range_from(method_start, complete)
 		});
 	}
 
-	u2 attributes_count = reader.read_be<u2>();
-	LOG("Attributes count: %hu", attributes_count);
-	for (u2 i = 0; i < attributes_count; ++i) {
-		attributes.push_back(AttributeInfo::parse(reader));
-	}
+	JCFP_TRACE_END(methods_trace, reader.pos());
+
+	size_t attributes_start = reader.pos();
+	JCFP_TRACE_BEGIN(attributes_trace, TracePhase::Attributes, attributes_start);
+	bool attributes_complete;
+	auto class_attributes = parse_attributes(reader, constant_pool, options, options.has(PARSE_CLASS_ATTRIBUTES),
+						 attributes_complete);
+	if (!class_attributes.has_value())
+		return std::unexpected(class_attributes.error());
+	attributes = std::move(class_attributes.value());
+	attributes_source = range_from(attributes_start, attributes_complete);
+	JCFP_TRACE_END(attributes_trace, reader.pos());
+	LOG("Attributes count: %lu", attributes.size());
 
 	LOG("ClassFile parsed successfully (offset: %lu)", reader.pos());
 
-	return ClassFile(magic, minor_version, major_version, constant_pool,
-			 access_flags, this_class, super_class, interfaces,
-			 fields, methods, attributes);
+	return build();
+}
+
+// Returns true if any of the member's indices was relocated
+template <typename T>
+static bool relocate_member(T &member, int diff, u2 from)
+{
+	bool relocated = member.name_index >= from || member.descriptor_index >= from;
+	JCFP_RELOCATE_INDEX(member.name_index, diff, from);
+	JCFP_RELOCATE_INDEX(member.descriptor_index, diff, from);
+
+	for (auto &attr : member.attributes) {
+		relocated |= attr.attribute_name_index >= from;
+		attr.relocate(diff, from);
+	}
+
+	return relocated;
 }
 
 std::vector<u1> ClassFile::encode()
 {
 	ByteStream stream = ByteStream();
+	if (this->source)
+		stream.reserve(this->source->size());
 	this->encode(stream);
 	return stream.collect();
 }
 
-void ClassFile::encode(ByteStream &stream)
+void ClassFile::relocate(int diff, u2 from)
 {
-	LOG("Encoding ClassFile to bytes...");
-
-	stream.write_be(this->magic);
-	stream.write_be(this->minor_version);
-	stream.write_be(this->major_version);
-
-	LOG("Encoding constant pool at offset: %lx", stream.size());
-	constant_pool.encode(stream);
-	LOG("Current offset after writing constant pool: ", stream.size());
-
-	stream.write_be(this->access_flags);
-	stream.write_be(this->this_class);
-	stream.write_be(this->super_class);
+	this->constant_pool.relocate(diff, from);
 
-	LOG("Encoding interfaces at offset: %lx", stream.size());
-	u2 interfaces_count = static_cast<u2>(this->interfaces.size());
-	stream.write_be(interfaces_count);
+	JCFP_RELOCATE_INDEX(this->this_class, diff, from);
+	JCFP_RELOCATE_INDEX(this->super_class, diff, from);
 	for (auto &interface : this->interfaces) {
-		stream.write_be(interface);
+		JCFP_RELOCATE_INDEX(interface, diff, from);
 	}
 
-	LOG("Encoding fields at offset: %lx", stream.size());
-	u2 fields_count = static_cast<u2>(this->fields.size());
-	stream.write_be(fields_count);
 	for (auto &field : this->fields) {
-		stream.write_be(field.access_flags);
-		stream.write_be(field.name_index);
-		stream.write_be(field.descriptor_index);
-
-		u2 attributes_count = static_cast<u2>(field.attributes.size());
-		stream.write_be(attributes_count);
-		for (auto &attribute : field.attributes) {
-			attribute.encode(stream);
-		}
+		if (relocate_member(field, diff, from))
+			field.mark_dirty();
 	}
 
-	LOG("Encoding methods at offset: %lx", stream.size());
-	u2 methods_count = static_cast<u2>(this->methods.size());
-	stream.write_be(methods_count);
 	for (auto &method : this->methods) {
-		stream.write_be(method.access_flags);
-		stream.write_be(method.name_index);
-		stream.write_be(method.descriptor_index);
-
-		u2 attributes_count = static_cast<u2>(method.attributes.size());
-		stream.write_be(attributes_count);
-		for (auto &attribute : method.attributes) {
-			attribute.encode(stream);
-		}
+		if (relocate_member(method, diff, from))
+			method.mark_dirty();
 	}
 
-	LOG("Encoding attributes at offset: %lx", stream.size());
-	u2 attributes_count = static_cast<u2>(this->attributes.size());
-	stream.write_be(attributes_count);
-	for (auto &attribute : this->attributes) {
-		attribute.encode(stream);
+	for (auto &attr : this->attributes) {
+		attr.relocate(diff, from);
 	}
-
-	LOG("ClassFile encoding finished successfully");
+	this->mark_attributes_dirty();
 }
 
-void ClassFile::relocate(int diff, u2 from)
+MemoryUsage ClassFile::memory_usage() const
 {
-	this->constant_pool.relocate(diff, from);
+	MemoryUsage usage = this->constant_pool.memory_usage();
+	usage.add(&MemoryUsage::structure, this->interfaces);
+	usage.add(&MemoryUsage::structure, this->fields);
+	usage.add(&MemoryUsage::structure, this->methods);
+	usage.add(&MemoryUsage::structure, this->attributes);
+
+	for (auto &field : this->fields)
+		usage += field.memory_usage();
+	for (auto &method : this->methods)
+		usage += method.memory_usage();
+	for (auto &attribute : this->attributes)
+		usage += attribute.memory_usage();
+
+	if (this->source)
+		usage.add(&MemoryUsage::source, *this->source);
+
+	return usage;
+}
 
-	for (auto &attr : this->attributes) {
-		attr.relocate(diff, from);
-	}
+void ClassFile::shrink_to_fit()
+{
+	this->constant_pool.shrink_to_fit();
+	this->interfaces.shrink_to_fit();
+	this->fields.shrink_to_fit();
+	this->methods.shrink_to_fit();
+	this->attributes.shrink_to_fit();
+
+	for (auto &field : this->fields)
+		field.shrink_to_fit();
+	for (auto &method : this->methods)
+		method.shrink_to_fit();
+	for (auto &attribute : this->attributes)
+		attribute.shrink_to_fit();
 }
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/pipeline.hpp>
+#include <jcfp/references.hpp>
+#include <jcfp/utils.hpp>
+#include <algorithm>
+
+using namespace jcfp;
+
+Pipeline &Pipeline::add(std::unique_ptr<Pass> pass)
+{
+	u4 interests = pass->interests();
+	std::vector<std::string> attribute_names = pass->attribute_names();
+	std::bitset<256> opcodes = pass->opcodes();
+
+	this->interests |= interests;
+	this->stages.push_back(Stage { std::move(pass), interests, std::move(attribute_names), opcodes });
+	return *this;
+}
+
+bool Pipeline::wants_attribute(const Stage &stage, ConstantPool &constant_pool, u2 attribute_name_index) const
+{
+	if (!(stage.interests & INTEREST_ATTRIBUTES))
+		return false;
+	if (stage.attribute_names.empty())
+		return true;
+
+	const std::string *name = constant_pool.find_utf8(attribute_name_index);
+	return name && std::find(stage.attribute_names.begin(), stage.attribute_names.end(), *name) != stage.attribute_names.end();
+}
+
+void Pipeline::visit_code(PassContext &context, AttributeInfo &attribute) const
+{
+	u4 code_interests = this->interests & (INTEREST_BYTECODE | INTEREST_ATTRIBUTES);
+	if (!code_interests)
+		return;
+
+	// Only the layout is read here (see CodeAttr), nothing is copied
+	constexpr size_t code_offset = 2 * sizeof(u2) + sizeof(u4); // max_stack, max_locals, code_length
+	u4 code_length;
+	size_t attributes_offset;
+	bool nested_wanted = false;
+	try {
+		// A reader with no length is not bounds checked
+		if (attribute.info.empty())
+			throw std::out_of_range("Empty Code attribute");
+
+		BufReader reader = BufReader(attribute.info.data(), attribute.info.size());
+		reader.skip(2 * sizeof(u2));
+		code_length = reader.read_be<u4>();
+		reader.skip(code_length);
+		reader.skip(reader.read_be<u2>() * sizeof(CodeAttr::ExceptionTableEntry));
+
+		attributes_offset = reader.pos();
+		for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+			u2 attribute_name_index = reader.read_be<u2>();
+			reader.skip(reader.read_be<u4>());
+			for (auto &stage : this->stages)
+				nested_wanted |= this->wants_attribute(stage, context.classfile.constant_pool, attribute_name_index);
+		}
+	} catch (const std::out_of_range &) {
+		context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+		return;
+	}
+
+	bool modified = false;
+	if (this->interests & INTEREST_BYTECODE) {
+		std::span<u1> bytecode = { attribute.info.data() + code_offset, code_length };
+		bool valid = for_each_instruction(bytecode, [&](size_t pc, Opcode opcode) {
+			for (auto &stage : this->stages) {
+				if (!(stage.interests & INTEREST_BYTECODE) || !stage.opcodes.test(static_cast<u1>(opcode)))
+					continue;
+
+				context.dirty = false;
+				stage.pass->on_instruction(context, bytecode, pc, opcode);
+				modified |= context.dirty;
+			}
+		});
+		if (!valid)
+			context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+	}
+
+	// Attributes nested in the Code attribute (e.g. LineNumberTable), only decoded if a pass wants one of them
+	if (!nested_wanted || context.error) {
+		context.dirty = modified;
+		return;
+	}
+
+	BufReader reader = BufReader(&attribute.info[attributes_offset], attribute.info.size() - attributes_offset);
+	std::vector<AttributeInfo> nested(reader.read_be<u2>());
+	for (auto &nested_attribute : nested)
+		nested_attribute = AttributeInfo::parse(reader); // Bounds were checked above
+
+	bool nested_modified = false;
+	this->visit_attributes(context, nested, nested_modified);
+	if (nested_modified) {
+		// Everything up to the attributes count is kept as is
+		ByteStream stream = ByteStream();
+		stream.write_bytes(attribute.info.data(), attributes_offset);
+		write_be(stream, static_cast<u2>(nested.size()));
+		for (auto &nested_attribute : nested)
+			nested_attribute.encode(stream);
+		attribute.info = stream.collect();
+	}
+
+	context.dirty = modified || nested_modified;
+}
+
+void Pipeline::visit_attributes(PassContext &context, std::vector<AttributeInfo> &attributes, bool &modified) const
+{
+	std::vector<bool> removed(attributes.size(), false);
+	bool any_removed = false;
+	for (size_t i = 0; i < attributes.size() && !context.error; ++i) {
+		auto &attribute = attributes[i];
+		context.removed = false;
+		bool dirty = false;
+		for (auto &stage : this->stages) {
+			if (!this->wants_attribute(stage, context.classfile.constant_pool, attribute.attribute_name_index))
+				continue;
+
+			context.dirty = false;
+			stage.pass->on_attribute(context, attribute);
+			dirty |= context.dirty;
+		}
+
+		removed[i] = context.removed;
+		any_removed |= context.removed;
+		if (removed[i])
+			continue;
+
+		const std::string *name = context.classfile.constant_pool.find_utf8(attribute.attribute_name_index);
+		if (context.owner.kind == AttributeOwner::Method && name && *name == "Code") {
+			context.dirty = false;
+			this->visit_code(context, attribute);
+			dirty |= context.dirty;
+		}
+
+		modified |= dirty;
+	}
+
+	if (any_removed) {
+		erase_flagged(attributes, removed);
+		modified = true;
+	}
+}
+
+template <typename Member>
+bool Pipeline::visit_member(PassContext &context, Member &member, AttributeOwner owner) const
+{
+	context.owner = owner;
+	context.removed = false;
+	bool dirty = false;
+	if (this->interests & INTEREST_MEMBERS) {
+		for (auto &stage : this->stages) {
+			if (!(stage.interests & INTEREST_MEMBERS))
+				continue;
+
+			context.dirty = false;
+			if constexpr (std::is_same_v<Member, FieldInfo>)
+				stage.pass->on_field(context, member);
+			else
+				stage.pass->on_method(context, member);
+			dirty |= context.dirty;
+		}
+	}
+
+	// The attributes of a removed member don't matter anymore
+	bool removed = context.removed;
+	if (!removed && (this->interests & (INTEREST_ATTRIBUTES | INTEREST_BYTECODE)))
+		this->visit_attributes(context, member.attributes, dirty);
+
+	if (dirty)
+		member.mark_dirty();
+	context.removed = removed;
+	return dirty;
+}
+
+std::expected<size_t, Error> Pipeline::run(ClassFile &classfile)
+{
+	LOG("Running pipeline with %zu passes...", this->stages.size());
+
+	PassContext context = PassContext(classfile);
+	bool modified = false;
+
+	for (auto &stage : this->stages)
+		stage.pass->begin_class(context);
+
+	if (this->interests & INTEREST_CONSTANTS) {
+		// Entries added by the passes are not visited
+		u2 count = classfile.constant_pool.count();
+		for (u2 i = 1; i < count && !context.error; ++i) {
+			if (classfile.constant_pool.get_tag(i) == ConstantPoolEntry::Tag::Empty)
+				continue;
+
+			context.dirty = false;
+			for (auto &stage : this->stages) {
+				if (stage.interests & INTEREST_CONSTANTS)
+					stage.pass->on_constant(context, i, classfile.constant_pool.get_entry(i));
+			}
+
+			if (context.dirty) {
+				classfile.constant_pool.mark_dirty();
+				modified = true;
+			}
+		}
+	}
+
+	auto visit_members = [&](auto &members, AttributeOwner::Kind kind) {
+		std::vector<bool> removed(members.size(), false);
+		bool any_removed = false;
+		for (size_t i = 0; i < members.size() && !context.error; ++i) {
+			modified |= this->visit_member(context, members[i], AttributeOwner { kind, static_cast<u2>(i) });
+			removed[i] = context.removed;
+			any_removed |= context.removed;
+		}
+
+		if (any_removed) {
+			erase_flagged(members, removed);
+			modified = true;
+		}
+	};
+
+	if (this->interests & (INTEREST_MEMBERS | INTEREST_ATTRIBUTES | INTEREST_BYTECODE)) {
+		visit_members(classfile.fields, AttributeOwner::Field);
+		visit_members(classfile.methods, AttributeOwner::Method);
+	}
+
+	if ((this->interests & INTEREST_ATTRIBUTES) && !context.error) {
+		bool attributes_modified = false;
+		context.owner = AttributeOwner { AttributeOwner::Class, 0 };
+		this->visit_attributes(context, classfile.attributes, attributes_modified);
+		if (attributes_modified) {
+			classfile.mark_attributes_dirty();
+			modified = true;
+		}
+	}
+
+	if (!context.error) {
+		for (auto &stage : this->stages)
+			stage.pass->end_class(context);
+	}
+
+	if (context.error) {
+		ERR("Pipeline failed at offset '%zu'", context.error->offset);
+		return std::unexpected(*context.error);
+	}
+
+	modified |= classfile.constant_pool.is_modified();
+	if (!modified)
+		return 0;
+
+	auto removed = compact_constant_pool(classfile);
+	if (!removed.has_value() && removed.error().kind == ErrorKind::Unsupported) {
+		// Attributes with unknown layouts may use any entry, so none can be removed
+		LOG("Pipeline skipped the constant pool compaction");
+		return 0;
+	}
+
+	return removed;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/reference_graph.hpp>
+#include <jcfp/bytecode.hpp>
+#include <jcfp/parallel.hpp>
+#include <jcfp/utils.hpp>
+#include <algorithm>
+#include <atomic>
+#include <unordered_set>
+
+using namespace jcfp;
+using SymbolId = ReferenceGraph::SymbolId;
+using SymbolKind = ReferenceGraph::SymbolKind;
+using Edge = std::pair<SymbolId, SymbolId>;
+
+struct Symbol {
+	const std::string *name = nullptr;
+	SymbolKind kind = SymbolKind::Class;
+};
+
+// References found in a single class, before the symbols get their ids
+struct ClassReferences {
+	const std::string *name = nullptr;
+	std::vector<std::pair<Symbol, Symbol>> members;
+	std::vector<const std::string *> classes;
+
+	// Filled once the ids are known
+	std::vector<Edge> member_edges;
+	std::vector<Edge> class_edges;
+};
+
+// Element class of an array descriptor (`[[Lpkg/A;` -> `pkg/A`), if any
+static std::string_view strip_array(std::string_view name)
+{
+	if (name.empty() || name[0] != '[')
+		return name;
+
+	name.remove_prefix(name.find_first_not_of('['));
+	if (name.size() < 3 || name.front() != 'L' || name.back() != ';')
+		return {}; // Array of primitives
+	return name.substr(1, name.size() - 2);
+}
+
+// Resolves a Fieldref, Methodref or InterfaceMethodref into an `Owner.name:descriptor` symbol
+static Symbol resolve_member(ConstantPool &constant_pool, u2 index, StringInterner &interner)
+{
+	auto member_ref = constant_pool.find_member_ref(index);
+	if (!member_ref.has_value())
+		return {};
+
+	auto [owner, name, descriptor] = member_ref.value();
+	bool is_field = constant_pool.get_tag(index) == ConstantPoolEntry::Tag::Fieldref;
+
+	std::string symbol;
+	symbol.reserve(owner->size() + name->size() + descriptor->size() + 2);
+	symbol.append(*owner).append(".").append(*name).append(":").append(*descriptor);
+	return Symbol { interner.intern(symbol), is_field ? SymbolKind::Field : SymbolKind::Method };
+}
+
+static void scan_class(ClassFile &classfile, ClassReferences &references, StringInterner &interner)
+{
+	using Tag = ConstantPoolEntry::Tag;
+	auto &constant_pool = classfile.constant_pool;
+
+	auto class_name = constant_pool.find_class_name(classfile.this_class);
+	if (!class_name)
+		return; // Malformed class, ignored
+	references.name = interner.intern(*class_name);
+	Symbol class_symbol = { references.name, SymbolKind::Class };
+
+	for (u2 i = 1; i < constant_pool.count(); ++i) {
+		if (constant_pool.get_tag(i) != Tag::Class || i == classfile.this_class)
+			continue;
+
+		auto name = constant_pool.find_class_name(i);
+		if (!name)
+			continue;
+
+		std::string_view element = strip_array(*name);
+		if (!element.empty() && element != *class_name)
+			references.classes.push_back(interner.intern(element));
+	}
+
+	// Every member reference is resolved once per class
+	std::vector<Symbol> resolved(constant_pool.count());
+	std::vector<u1> is_resolved(constant_pool.count(), false);
+	auto resolve = [&](u2 index) {
+		if (index >= resolved.size())
+			return Symbol {};
+		if (!is_resolved[index]) {
+			resolved[index] = resolve_member(constant_pool, index, interner);
+			is_resolved[index] = true;
+		}
+		return resolved[index];
+	};
+
+	bool found_code = false;
+	for (auto &method : classfile.methods) {
+		for (auto &attribute : method.attributes) {
+			auto attribute_name = constant_pool.find_utf8(attribute.attribute_name_index);
+			if (!attribute_name || *attribute_name != "Code")
+				continue;
+
+			auto name = constant_pool.find_utf8(method.name_index);
+			auto descriptor = constant_pool.find_utf8(method.descriptor_index);
+			if (!name || !descriptor)
+				continue;
+
+			std::string caller_name = *class_name + "." + *name + ":" + *descriptor;
+			Symbol caller = { interner.intern(caller_name), SymbolKind::Method };
+			found_code = true;
+
+			try {
+				CodeAttr code_attr = CodeAttr(attribute);
+				auto code = code_attr.code();
+				for_each_instruction(code, [&](size_t pc, Opcode opcode) {
+					if (opcode < Opcode::OP_getstatic || opcode > Opcode::OP_invokeinterface)
+						return;
+
+					u2 index = (code[pc + 1] << 8) | code[pc + 2];
+					Symbol callee = resolve(index);
+					if (callee.name)
+						references.members.push_back({ caller, callee });
+				});
+			} catch (const std::out_of_range &) {
+				ERR("Malformed Code attribute in '%s'", caller_name.c_str());
+			}
+		}
+	}
+
+	if (found_code)
+		return;
+
+	for (u2 i = 1; i < constant_pool.count(); ++i) {
+		Tag tag = constant_pool.get_tag(i);
+		if (tag != Tag::Fieldref && tag != Tag::Methodref && tag != Tag::InterfaceMethodref)
+			continue;
+
+		Symbol callee = resolve(i);
+		if (callee.name)
+			references.members.push_back({ class_symbol, callee });
+	}
+}
+
+/*
+ * Merges the edges of every class into CSR arrays: the out-degree of each
+ * symbol is counted atomically, then every class writes its edges to the
+ * slots it reserves with an atomic cursor.
+ */
+static ReferenceGraph::Adjacency merge_edges(size_t count, const std::vector<ClassReferences> &classes,
+					     std::vector<Edge> ClassReferences::*edges, bool reverse, unsigned threads)
+{
+	ReferenceGraph::Adjacency adjacency;
+	std::vector<std::atomic<u4>> cursors(count);
+
+	parallel_for(classes.size(), [&](size_t i) {
+		for (auto [from, to] : classes[i].*edges)
+			cursors[reverse ? to : from].fetch_add(1, std::memory_order_relaxed);
+	}, threads);
+
+	adjacency.offsets.resize(count + 1);
+	adjacency.offsets[0] = 0;
+	for (size_t i = 0; i < count; ++i) {
+		adjacency.offsets[i + 1] = adjacency.offsets[i] + cursors[i].load(std::memory_order_relaxed);
+		cursors[i].store(adjacency.offsets[i], std::memory_order_relaxed);
+	}
+
+	adjacency.targets.resize(adjacency.offsets[count]);
+	parallel_for(classes.size(), [&](size_t i) {
+		for (auto [from, to] : classes[i].*edges) {
+			SymbolId source = reverse ? to : from;
+			SymbolId target = reverse ? from : to;
+			adjacency.targets[cursors[source].fetch_add(1, std::memory_order_relaxed)] = target;
+		}
+	}, threads);
+
+	// The slots were handed out in any order, sort them so the result is deterministic
+	parallel_for(count, [&](size_t i) {
+		std::sort(adjacency.targets.begin() + adjacency.offsets[i], adjacency.targets.begin() + adjacency.offsets[i + 1]);
+	}, threads);
+
+	return adjacency;
+}
+
+ReferenceGraph ReferenceGraph::build(std::span<ClassFile> classes, StringInterner *interner, unsigned threads)
+{
+	ReferenceGraph graph;
+	if (!interner) {
+		graph.owned_interner = std::make_unique<StringInterner>();
+		interner = graph.owned_interner.get();
+	}
+
+	LOG("Building reference graph (classes: %lu)...", classes.size());
+
+	std::vector<ClassReferences> references(classes.size());
+	parallel_for(classes.size(), [&](size_t i) {
+		scan_class(classes[i], references[i], *interner);
+	}, threads);
+
+	// Symbols get their ids in the order they are found, so the ids are deterministic
+	std::unordered_map<const std::string *, SymbolId> symbol_ids;
+	auto id_of = [&](Symbol symbol) {
+		auto [it, inserted] = symbol_ids.try_emplace(symbol.name, graph.names.size());
+		if (inserted) {
+			graph.names.push_back(symbol.name);
+			graph.kinds.push_back(symbol.kind);
+		}
+		return it->second;
+	};
+
+	std::unordered_set<const std::string *> defined;
+	for (auto &record : references) {
+		if (!record.name || !defined.insert(record.name).second) {
+			record = ClassReferences();
+			continue;
+		}
+
+		SymbolId class_id = id_of(Symbol { record.name, SymbolKind::Class });
+		record.member_edges.reserve(record.members.size());
+		for (auto &[from, to] : record.members)
+			record.member_edges.push_back({ id_of(from), id_of(to) });
+		record.class_edges.reserve(record.classes.size());
+		for (auto name : record.classes)
+			record.class_edges.push_back({ class_id, id_of(Symbol { name, SymbolKind::Class }) });
+
+		record.members = {};
+		record.classes = {};
+	}
+
+	parallel_for(references.size(), [&](size_t i) {
+		for (auto edges : { &references[i].member_edges, &references[i].class_edges }) {
+			std::sort(edges->begin(), edges->end());
+			edges->erase(std::unique(edges->begin(), edges->end()), edges->end());
+		}
+	}, threads);
+
+	size_t count = graph.names.size();
+	graph.member_references = merge_edges(count, references, &ClassReferences::member_edges, false, threads);
+	graph.member_referrers = merge_edges(count, references, &ClassReferences::member_edges, true, threads);
+	graph.class_references = merge_edges(count, references, &ClassReferences::class_edges, false, threads);
+	graph.class_referrers = merge_edges(count, references, &ClassReferences::class_edges, true, threads);
+
+	graph.ids.reserve(count);
+	for (SymbolId id = 0; id < count; ++id)
+		graph.ids.emplace(*graph.names[id], id);
+
+	LOG("Reference graph built (symbols: %lu, edges: %lu)", count, graph.edge_count());
+
+	return graph;
+}
@@ -0,0 +1,1086 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/references.hpp>
+#include <jcfp/bytecode.hpp>
+#include <jcfp/utils.hpp>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+using namespace jcfp;
+
+namespace {
+	// Thrown while walking an attribute body, turned into an `Error` by `find_references`
+	struct SiteError {
+		Error error;
+	};
+
+	enum class AttributeKind {
+		Unknown,
+		Opaque, // Holds no constant pool indices
+		SingleIndex,
+		IndexTable,
+		Code,
+		StackMapTable,
+		InnerClasses,
+		EnclosingMethod,
+		LocalVariableTable,
+		Annotations,
+		ParameterAnnotations,
+		TypeAnnotations,
+		AnnotationDefault,
+		BootstrapMethods,
+		MethodParameters,
+		Module,
+		Record,
+	};
+
+	AttributeKind attribute_kind(std::string_view name)
+	{
+		static constexpr std::pair<std::string_view, AttributeKind> kinds[] = {
+			{ "Code", AttributeKind::Code },
+			{ "LineNumberTable", AttributeKind::Opaque },
+			{ "SourceDebugExtension", AttributeKind::Opaque },
+			{ "Deprecated", AttributeKind::Opaque },
+			{ "Synthetic", AttributeKind::Opaque },
+			{ "ConstantValue", AttributeKind::SingleIndex },
+			{ "Signature", AttributeKind::SingleIndex },
+			{ "SourceFile", AttributeKind::SingleIndex },
+			{ "NestHost", AttributeKind::SingleIndex },
+			{ "ModuleMainClass", AttributeKind::SingleIndex },
+			{ "Exceptions", AttributeKind::IndexTable },
+			{ "NestMembers", AttributeKind::IndexTable },
+			{ "PermittedSubclasses", AttributeKind::IndexTable },
+			{ "ModulePackages", AttributeKind::IndexTable },
+			{ "StackMapTable", AttributeKind::StackMapTable },
+			{ "InnerClasses", AttributeKind::InnerClasses },
+			{ "EnclosingMethod", AttributeKind::EnclosingMethod },
+			{ "LocalVariableTable", AttributeKind::LocalVariableTable },
+			{ "LocalVariableTypeTable", AttributeKind::LocalVariableTable },
+			{ "RuntimeVisibleAnnotations", AttributeKind::Annotations },
+			{ "RuntimeInvisibleAnnotations", AttributeKind::Annotations },
+			{ "RuntimeVisibleParameterAnnotations", AttributeKind::ParameterAnnotations },
+			{ "RuntimeInvisibleParameterAnnotations", AttributeKind::ParameterAnnotations },
+			{ "RuntimeVisibleTypeAnnotations", AttributeKind::TypeAnnotations },
+			{ "RuntimeInvisibleTypeAnnotations", AttributeKind::TypeAnnotations },
+			{ "AnnotationDefault", AttributeKind::AnnotationDefault },
+			{ "BootstrapMethods", AttributeKind::BootstrapMethods },
+			{ "MethodParameters", AttributeKind::MethodParameters },
+			{ "Module", AttributeKind::Module },
+			{ "Record", AttributeKind::Record },
+		};
+
+		for (auto &[kind_name, kind] : kinds) {
+			if (kind_name == name)
+				return kind;
+		}
+
+		return AttributeKind::Unknown;
+	}
+
+	/*
+	 * Walks an attribute body (and the attributes nested in it), recording
+	 * the offset of every constant pool index. All the offsets are relative
+	 * to the start of the outermost body.
+	 */
+	class SiteFinder {
+	private:
+		static constexpr int max_depth = 64;
+
+		const Utf8Lookup &utf8;
+		BufReader reader;
+		std::vector<ReferenceSite> sites;
+		int depth = 0;
+	public:
+		SiteFinder(const Utf8Lookup &utf8, std::span<const u1> body)
+			: utf8(utf8), reader(body.data(), body.size()) {}
+	public:
+		std::vector<ReferenceSite> collect(u2 name_index, size_t length)
+		{
+			this->body(name_index, length);
+			return std::move(this->sites);
+		}
+	private:
+		[[noreturn]] void fail(ErrorKind kind)
+		{
+			throw SiteError { Error { kind, this->reader.pos() } };
+		}
+
+		void index(bool descriptor = false)
+		{
+			size_t offset = this->reader.pos();
+			if (this->reader.read_be<u2>() != 0)
+				this->sites.push_back(ReferenceSite { static_cast<u4>(offset), 2, descriptor });
+		}
+
+		void indices(size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				this->index();
+		}
+
+		void index_table()
+		{
+			this->indices(this->reader.read_be<u2>());
+		}
+
+		void body(u2 name_index, size_t length)
+		{
+			auto name = this->utf8(name_index);
+			if (!name)
+				this->fail(ErrorKind::Malformed);
+
+			AttributeKind kind = attribute_kind(*name);
+			if (kind == AttributeKind::Unknown) {
+				ERR("Unknown attribute '%.*s', its references can't be found", static_cast<int>(name->size()), name->data());
+				this->fail(ErrorKind::Unsupported);
+			}
+
+			// A BufReader with no length is not bounds checked
+			if (length == 0 && kind != AttributeKind::Opaque)
+				this->fail(ErrorKind::Malformed);
+
+			size_t end = this->reader.pos() + length;
+			if (++this->depth > max_depth)
+				this->fail(ErrorKind::Malformed);
+
+			switch (kind) {
+			case AttributeKind::Opaque:
+				this->reader.skip(length);
+				break;
+			case AttributeKind::SingleIndex:
+				this->index();
+				break;
+			case AttributeKind::IndexTable:
+				this->index_table();
+				break;
+			case AttributeKind::Code:
+				this->code();
+				break;
+			case AttributeKind::StackMapTable:
+				this->stack_map_table();
+				break;
+			case AttributeKind::InnerClasses:
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+					this->indices(3); // inner_class_info, outer_class_info, inner_name
+					this->reader.skip(sizeof(u2)); // inner_class_access_flags
+				}
+				break;
+			case AttributeKind::EnclosingMethod:
+				this->indices(2);
+				break;
+			case AttributeKind::LocalVariableTable:
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+					this->reader.skip(2 * sizeof(u2)); // start_pc, length
+					this->indices(2); // name, descriptor (or signature)
+					this->reader.skip(sizeof(u2)); // index
+				}
+				break;
+			case AttributeKind::Annotations:
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i)
+					this->annotation();
+				break;
+			case AttributeKind::ParameterAnnotations:
+				for (u1 i = 0, count = this->reader.read<u1>(); i < count; ++i) {
+					for (u2 j = 0, annotations = this->reader.read_be<u2>(); j < annotations; ++j)
+						this->annotation();
+				}
+				break;
+			case AttributeKind::TypeAnnotations:
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i)
+					this->type_annotation();
+				break;
+			case AttributeKind::AnnotationDefault:
+				this->element_value();
+				break;
+			case AttributeKind::BootstrapMethods:
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+					this->index(); // bootstrap_method_ref
+					this->index_table(); // bootstrap_arguments
+				}
+				break;
+			case AttributeKind::MethodParameters:
+				for (u1 i = 0, count = this->reader.read<u1>(); i < count; ++i) {
+					this->index();
+					this->reader.skip(sizeof(u2)); // access_flags
+				}
+				break;
+			case AttributeKind::Module:
+				this->module();
+				break;
+			case AttributeKind::Record:
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+					this->indices(2); // name, descriptor
+					this->attributes();
+				}
+				break;
+			case AttributeKind::Unknown:
+				break;
+			}
+
+			--this->depth;
+			if (this->reader.pos() != end)
+				this->fail(ErrorKind::Malformed);
+		}
+
+		void attributes()
+		{
+			for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+				size_t name_offset = this->reader.pos();
+				u2 name_index = this->reader.read_be<u2>();
+				u4 length = this->reader.read_be<u4>();
+
+				this->sites.push_back(ReferenceSite { static_cast<u4>(name_offset), 2 });
+				this->body(name_index, length);
+			}
+		}
+
+		void code()
+		{
+			this->reader.skip(2 * sizeof(u2)); // max_stack, max_locals
+			u4 code_length = this->reader.read_be<u4>();
+			size_t code_start = this->reader.pos();
+			this->reader.skip(code_length);
+
+			std::span<const u1> code = { &this->reader.data()[code_start], code_length };
+			bool valid = for_each_instruction(code, [&](size_t pc, Opcode opcode) {
+				u4 operand = static_cast<u4>(code_start + pc + 1);
+				switch (opcode) {
+				case Opcode::OP_ldc:
+					if (code[pc + 1] != 0)
+						this->sites.push_back(ReferenceSite { operand, 1 });
+					break;
+				case Opcode::OP_ldc_w:
+				case Opcode::OP_ldc2_w:
+				case Opcode::OP_getstatic:
+				case Opcode::OP_putstatic:
+				case Opcode::OP_getfield:
+				case Opcode::OP_putfield:
+				case Opcode::OP_invokevirtual:
+				case Opcode::OP_invokespecial:
+				case Opcode::OP_invokestatic:
+				case Opcode::OP_invokeinterface:
+				case Opcode::OP_invokedynamic:
+				case Opcode::OP_new:
+				case Opcode::OP_anewarray:
+				case Opcode::OP_checkcast:
+				case Opcode::OP_instanceof:
+				case Opcode::OP_multianewarray:
+					this->sites.push_back(ReferenceSite { operand, 2 });
+					break;
+				default:
+					break;
+				}
+			});
+			if (!valid)
+				this->fail(ErrorKind::Malformed);
+
+			for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+				this->reader.skip(3 * sizeof(u2)); // start_pc, end_pc, handler_pc
+				this->index(); // catch_type
+			}
+
+			this->attributes();
+		}
+
+		void verification_type()
+		{
+			u1 tag = this->reader.read<u1>();
+			if (tag == 7) // Object_variable_info
+				this->index();
+			else if (tag == 8) // Uninitialized_variable_info
+				this->reader.skip(sizeof(u2));
+			else if (tag > 8)
+				this->fail(ErrorKind::Malformed);
+		}
+
+		void stack_map_table()
+		{
+			for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+				u1 frame_type = this->reader.read<u1>();
+				if (frame_type < 64) {
+					// same_frame
+				} else if (frame_type < 128) {
+					this->verification_type(); // same_locals_1_stack_item_frame
+				} else if (frame_type < 247) {
+					this->fail(ErrorKind::Malformed); // Reserved
+				} else if (frame_type == 247) {
+					this->reader.skip(sizeof(u2));
+					this->verification_type();
+				} else if (frame_type < 252) {
+					this->reader.skip(sizeof(u2)); // chop_frame, same_frame_extended
+				} else if (frame_type < 255) {
+					this->reader.skip(sizeof(u2)); // append_frame
+					for (int j = 0; j < frame_type - 251; ++j)
+						this->verification_type();
+				} else {
+					this->reader.skip(sizeof(u2)); // full_frame
+					for (u2 j = 0, locals = this->reader.read_be<u2>(); j < locals; ++j)
+						this->verification_type();
+					for (u2 j = 0, stack = this->reader.read_be<u2>(); j < stack; ++j)
+						this->verification_type();
+				}
+			}
+		}
+
+		void annotation()
+		{
+			this->index(true); // type_index
+			for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+				this->index(); // element_name_index
+				this->element_value();
+			}
+		}
+
+		void element_value()
+		{
+			if (++this->depth > max_depth)
+				this->fail(ErrorKind::Malformed);
+
+			u1 tag = this->reader.read<u1>();
+			switch (tag) {
+			case 'B': case 'C': case 'D': case 'F': case 'I':
+			case 'J': case 'S': case 'Z': case 's':
+				this->index();
+				break;
+			case 'c':
+				this->index(true); // class_info_index
+				break;
+			case 'e':
+				this->index(true); // type_name_index
+				this->index(); // const_name_index
+				break;
+			case '@':
+				this->annotation();
+				break;
+			case '[':
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i)
+					this->element_value();
+				break;
+			default:
+				this->fail(ErrorKind::Malformed);
+			}
+
+			--this->depth;
+		}
+
+		void type_annotation()
+		{
+			u1 target_type = this->reader.read<u1>();
+			switch (target_type) {
+			case 0x00: case 0x01: case 0x16:
+				this->reader.skip(1);
+				break;
+			case 0x10: case 0x17: case 0x42:
+			case 0x43: case 0x44: case 0x45: case 0x46:
+				this->reader.skip(2);
+				break;
+			case 0x11: case 0x12:
+				this->reader.skip(2);
+				break;
+			case 0x13: case 0x14: case 0x15:
+				break;
+			case 0x40: case 0x41:
+				this->reader.skip(this->reader.read_be<u2>() * 3 * sizeof(u2)); // localvar_target
+				break;
+			case 0x47: case 0x48: case 0x49: case 0x4A: case 0x4B:
+				this->reader.skip(3);
+				break;
+			default:
+				this->fail(ErrorKind::Malformed);
+			}
+
+			this->reader.skip(this->reader.read<u1>() * 2); // type_path
+			this->annotation();
+		}
+
+		void module()
+		{
+			this->index(); // module_name_index
+			this->reader.skip(sizeof(u2)); // module_flags
+			this->index(); // module_version_index
+
+			for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+				this->index(); // requires_index
+				this->reader.skip(sizeof(u2)); // requires_flags
+				this->index(); // requires_version_index
+			}
+
+			// exports, then opens
+			for (int table = 0; table < 2; ++table) {
+				for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+					this->index();
+					this->reader.skip(sizeof(u2)); // flags
+					this->index_table();
+				}
+			}
+
+			this->index_table(); // uses
+
+			for (u2 i = 0, count = this->reader.read_be<u2>(); i < count; ++i) {
+				this->index(); // provides_index
+				this->index_table(); // provides_with_index
+			}
+		}
+	};
+}
+
+// Calls `f(member)` on every field and method, stopping at the first error
+template <typename F>
+static std::expected<void, Error> for_each_member(ClassFile &classfile, F &&f)
+{
+	for (auto &field : classfile.fields) {
+		auto result = f(field);
+		if (!result.has_value())
+			return result;
+	}
+
+	for (auto &method : classfile.methods) {
+		auto result = f(method);
+		if (!result.has_value())
+			return result;
+	}
+
+	return {};
+}
+
+std::expected<std::vector<ReferenceSite>, Error> jcfp::find_references(const Utf8Lookup &utf8, u2 attribute_name_index, std::span<const u1> body)
+{
+	try {
+		SiteFinder finder = SiteFinder(utf8, body);
+		return finder.collect(attribute_name_index, body.size());
+	} catch (const SiteError &e) {
+		return std::unexpected(e.error);
+	} catch (const std::out_of_range &) {
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+	}
+}
+
+std::expected<std::vector<ReferenceSite>, Error> jcfp::find_references(ConstantPool &constant_pool, const AttributeInfo &attribute)
+{
+	Utf8Lookup utf8 = [&constant_pool](u2 index) -> std::optional<std::string_view> {
+		if (auto str = constant_pool.find_utf8(index))
+			return *str;
+		return {};
+	};
+
+	return find_references(utf8, attribute.attribute_name_index, attribute.info);
+}
+
+std::expected<std::vector<u2>, Error> jcfp::find_references(ClassFile &classfile)
+{
+	std::vector<u2> references = { classfile.this_class };
+	if (classfile.super_class != 0)
+		references.push_back(classfile.super_class);
+	references.insert(references.end(), classfile.interfaces.begin(), classfile.interfaces.end());
+
+	auto add_attributes = [&](std::vector<AttributeInfo> &attributes) -> std::expected<void, Error> {
+		for (auto &attribute : attributes) {
+			auto sites = find_references(classfile.constant_pool, attribute);
+			if (!sites.has_value())
+				return std::unexpected(sites.error());
+
+			references.push_back(attribute.attribute_name_index);
+			for (auto &site : sites.value()) {
+				const u1 *bytes = &attribute.info[site.offset];
+				references.push_back(site.width == 1 ? bytes[0] : (bytes[0] << 8) | bytes[1]);
+			}
+		}
+
+		return {};
+	};
+
+	auto result = for_each_member(classfile, [&](auto &member) {
+		references.push_back(member.name_index);
+		references.push_back(member.descriptor_index);
+		return add_attributes(member.attributes);
+	});
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	result = add_attributes(classfile.attributes);
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	return references;
+}
+
+std::expected<std::vector<bool>, Error> jcfp::find_used_entries(ClassFile &classfile)
+{
+	auto &constant_pool = classfile.constant_pool;
+	auto roots = find_references(classfile);
+	if (!roots.has_value())
+		return std::unexpected(roots.error());
+
+	std::vector<bool> used(constant_pool.count(), false);
+	std::vector<u2> pending = std::move(roots.value());
+	while (!pending.empty()) {
+		u2 index = pending.back();
+		pending.pop_back();
+
+		if (index == 0 || index >= used.size() || constant_pool.get_tag(index) == ConstantPoolEntry::Tag::Empty) {
+			ERR("Reference to invalid constant pool index '%hu'", index);
+			return std::unexpected(Error { ErrorKind::Malformed, index });
+		}
+
+		if (used[index])
+			continue;
+
+		used[index] = true;
+		for_each_reference(constant_pool.get_entry(index), [&pending](u2 &reference) {
+			pending.push_back(reference);
+		});
+	}
+
+	return used;
+}
+
+std::expected<void, Error> jcfp::remap_references(AttributeInfo &attribute, std::span<const ReferenceSite> sites, const RemapTable &table)
+{
+	auto remap = [&table](u2 index) -> u2 {
+		return index < table.size() ? table[index] : 0;
+	};
+
+	// Everything is checked first, so nothing changes on error
+	if (remap(attribute.attribute_name_index) == 0)
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+
+	for (auto &site : sites) {
+		const u1 *bytes = &attribute.info[site.offset];
+		u2 index = remap(site.width == 1 ? bytes[0] : (bytes[0] << 8) | bytes[1]);
+		if (index == 0)
+			return std::unexpected(Error { ErrorKind::Malformed, site.offset });
+
+		// Widening `ldc` would move the code after it, which would break every offset
+		if (site.width == 1 && index > 0xFF) {
+			ERR("ldc operand can't be remapped to index '%hu'", index);
+			return std::unexpected(Error { ErrorKind::Unsupported, site.offset });
+		}
+	}
+
+	attribute.attribute_name_index = remap(attribute.attribute_name_index);
+	for (auto &site : sites) {
+		u1 *bytes = &attribute.info[site.offset];
+		if (site.width == 1) {
+			bytes[0] = static_cast<u1>(remap(bytes[0]));
+		} else {
+			u2 index = remap((bytes[0] << 8) | bytes[1]);
+			bytes[0] = index >> 8;
+			bytes[1] = index & 0xFF;
+		}
+	}
+
+	return {};
+}
+
+std::expected<void, Error> jcfp::remap_references(ClassFile &classfile, const RemapTable &table)
+{
+	auto &constant_pool = classfile.constant_pool;
+	auto valid = [&table](u2 index) {
+		return index < table.size() && table[index] != 0;
+	};
+
+	// The attribute names are looked up with the old indices, so find everything first
+	std::vector<std::pair<AttributeInfo *, std::vector<ReferenceSite>>> attributes;
+	auto find_sites = [&](std::vector<AttributeInfo> &list) -> std::expected<void, Error> {
+		for (auto &attribute : list) {
+			auto sites = find_references(constant_pool, attribute);
+			if (!sites.has_value())
+				return std::unexpected(sites.error());
+			attributes.push_back({ &attribute, std::move(sites.value()) });
+		}
+		return {};
+	};
+
+	auto result = for_each_member(classfile, [&](auto &member) -> std::expected<void, Error> {
+		if (!valid(member.name_index) || !valid(member.descriptor_index))
+			return std::unexpected(Error { ErrorKind::Malformed, 0 });
+		return find_sites(member.attributes);
+	});
+	if (!result.has_value())
+		return result;
+
+	result = find_sites(classfile.attributes);
+	if (!result.has_value())
+		return result;
+
+	if (!valid(classfile.this_class) || (classfile.super_class != 0 && !valid(classfile.super_class)))
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+	for (u2 interface : classfile.interfaces) {
+		if (!valid(interface))
+			return std::unexpected(Error { ErrorKind::Malformed, 0 });
+	}
+
+	auto &entries = constant_pool.get_entries();
+	for (size_t i = 1; i < entries.size(); ++i) {
+		if (table[i] == 0)
+			continue; // Removed anyway
+
+		bool entry_valid = true;
+		for_each_reference(entries[i], [&](u2 &index) { entry_valid &= valid(index); });
+		if (!entry_valid)
+			return std::unexpected(Error { ErrorKind::Malformed, i });
+	}
+
+	// Dry run on copies, so that no attribute is left half remapped
+	for (auto &[attribute, sites] : attributes) {
+		AttributeInfo copy = AttributeInfo(attribute->attribute_name_index, {});
+		copy.info.assign(attribute->info.begin(), attribute->info.end());
+		auto checked = remap_references(copy, sites, table);
+		if (!checked.has_value())
+			return checked;
+	}
+
+	// Nothing can fail from here on
+	for (size_t i = 1; i < entries.size(); ++i) {
+		if (table[i] != 0)
+			for_each_reference(entries[i], [&](u2 &index) { index = table[index]; });
+	}
+
+	classfile.this_class = table[classfile.this_class];
+	if (classfile.super_class != 0)
+		classfile.super_class = table[classfile.super_class];
+	for (u2 &interface : classfile.interfaces)
+		interface = table[interface];
+
+	for_each_member(classfile, [&](auto &member) -> std::expected<void, Error> {
+		member.name_index = table[member.name_index];
+		member.descriptor_index = table[member.descriptor_index];
+		return {};
+	});
+
+	for (auto &[attribute, sites] : attributes)
+		remap_references(*attribute, sites, table);
+
+	classfile.mark_dirty();
+	return {};
+}
+
+namespace {
+	/*
+	 * Finds the lowest entry equal to each used entry, comparing the entries
+	 * after their own references were replaced by their canonical entries, so
+	 * that (for example) two Methodrefs whose Class entries are duplicates are
+	 * duplicates themselves. Unused entries map to 0.
+	 */
+	class EntryDeduplicator {
+	private:
+		static constexpr u2 visiting = 0xFFFF;
+		ConstantPool &constant_pool;
+		std::vector<u2> canonical;
+		std::unordered_map<std::string, u2> first_entries;
+	public:
+		EntryDeduplicator(ConstantPool &constant_pool)
+			: constant_pool(constant_pool), canonical(constant_pool.count(), 0)
+		{
+			this->first_entries.reserve(constant_pool.count());
+		}
+	public:
+		std::expected<std::vector<u2>, Error> find_canonical_entries(const std::vector<bool> &used)
+		{
+			for (u2 i = 1; i < this->constant_pool.count(); ++i) {
+				if (!used[i])
+					continue;
+
+				auto resolved = this->resolve(i);
+				if (!resolved.has_value())
+					return std::unexpected(resolved.error());
+			}
+
+			// Entries may be found out of order through the references, keep the lowest index of each group
+			std::vector<u2> lowest(this->canonical.size(), 0);
+			for (u2 i = 1; i < this->canonical.size(); ++i) {
+				u2 &first = this->canonical[i];
+				if (first == 0)
+					continue;
+				if (lowest[first] == 0)
+					lowest[first] = i;
+				first = lowest[first];
+			}
+
+			return std::move(this->canonical);
+		}
+	private:
+		// The references between entries form a shallow DAG (e.g. Methodref -> Class -> Utf8)
+		std::expected<u2, Error> resolve(u2 index)
+		{
+			if (this->canonical[index] == visiting)
+				return std::unexpected(Error { ErrorKind::Malformed, index }); // Cycle
+			if (this->canonical[index] != 0)
+				return this->canonical[index];
+
+			this->canonical[index] = visiting;
+			ConstantPoolEntry entry = this->constant_pool.get_entry(index);
+			std::optional<Error> error;
+			for_each_reference(entry, [&](u2 &reference) {
+				if (error.has_value())
+					return;
+
+				auto resolved = this->resolve(reference);
+				if (resolved.has_value())
+					reference = resolved.value();
+				else
+					error = resolved.error();
+			});
+			if (error.has_value())
+				return std::unexpected(error.value());
+
+			std::vector<u1> bytes = entry.encode();
+			auto [it, inserted] = this->first_entries.try_emplace(std::string(bytes.begin(), bytes.end()), index);
+			this->canonical[index] = it->second;
+			return it->second;
+		}
+	};
+}
+
+ConstantPoolImporter::ConstantPoolImporter(ConstantPool &target, ConstantPool &source)
+	: target(target), source(source), table(source.count(), 0)
+{
+	this->target_entries.reserve(target.count());
+	for (u2 i = 1; i < target.count(); ++i) {
+		if (target.get_tag(i) == ConstantPoolEntry::Tag::Empty)
+			continue;
+
+		std::vector<u1> bytes = target.get_entry(i).encode();
+		this->target_entries.try_emplace(std::string(bytes.begin(), bytes.end()), i);
+	}
+}
+
+ConstantPoolImporter::ConstantPoolImporter(ClassFile &target, ClassFile &source)
+	: ConstantPoolImporter(target.constant_pool, source.constant_pool)
+{
+	this->target_class = &target;
+	this->source_class = &source;
+}
+
+std::expected<u2, Error> ConstantPoolImporter::import(u2 index)
+{
+	if (index == 0 || index >= this->table.size() ||
+	    this->source.get_tag(index) == ConstantPoolEntry::Tag::Empty) {
+		ERR("Reference to invalid constant pool index '%hu'", index);
+		return std::unexpected(Error { ErrorKind::Malformed, index });
+	}
+
+	if (this->table[index] == visiting)
+		return std::unexpected(Error { ErrorKind::Malformed, index }); // Cycle
+	if (this->table[index] != 0)
+		return this->table[index];
+
+	this->table[index] = visiting;
+	ConstantPoolEntry entry = this->source.get_entry(index);
+	std::optional<Error> error;
+	for_each_reference(entry, [&](u2 &reference) {
+		if (error.has_value())
+			return;
+
+		auto imported = this->import(reference);
+		if (imported.has_value())
+			reference = imported.value();
+		else
+			error = imported.error();
+	});
+
+	// The bootstrap method index is not a constant pool index, it has to follow the method itself
+	if (!error.has_value() && (entry.tag == ConstantPoolEntry::Tag::Dynamic || entry.tag == ConstantPoolEntry::Tag::InvokeDynamic)) {
+		u2 &bootstrap_index = entry.tag == ConstantPoolEntry::Tag::Dynamic ?
+			entry.get<ConstantPoolEntry::DynamicInfo>().bootstrap_method_attr_index :
+			entry.get<ConstantPoolEntry::InvokeDynamicInfo>().bootstrap_method_attr_index;
+		auto imported = this->import_bootstrap_method(bootstrap_index);
+		if (imported.has_value())
+			bootstrap_index = imported.value();
+		else
+			error = imported.error();
+	}
+
+	if (error.has_value()) {
+		this->table[index] = 0;
+		return std::unexpected(error.value());
+	}
+
+	auto added = this->add(std::move(entry), index);
+	this->table[index] = added.value_or(0);
+	return added;
+}
+
+// Finds or adds `entry` in the target, `index` is the source index for the errors
+std::expected<u2, Error> ConstantPoolImporter::add(ConstantPoolEntry entry, u2 index)
+{
+	std::vector<u1> bytes = entry.encode();
+	auto [it, inserted] = this->target_entries.try_emplace(std::string(bytes.begin(), bytes.end()), 0);
+	if (inserted) {
+		if (this->target.count() + (entry.is_wide_entry() ? 2 : 1) > 0xFFFF) {
+			this->target_entries.erase(it);
+			ERR("Constant pool is full, can't import entry '%hu'", index);
+			return std::unexpected(Error { ErrorKind::Unsupported, index });
+		}
+		it->second = this->target.push_entry(std::move(entry));
+	}
+
+	return it->second;
+}
+
+std::expected<void, Error> ConstantPoolImporter::index_bootstrap_methods()
+{
+	if (this->bootstrap_indexed)
+		return {};
+
+	auto find_table = [](ClassFile &classfile) -> size_t {
+		for (size_t i = 0; i < classfile.attributes.size(); ++i) {
+			const std::string *name = classfile.constant_pool.find_utf8(classfile.attributes[i].attribute_name_index);
+			if (name && *name == "BootstrapMethods")
+				return i;
+		}
+		return none;
+	};
+
+	// Offset of each bootstrap method in the body, the last one is the end of the table
+	auto scan_table = [](const AttributeInfo &attribute) -> std::expected<std::vector<size_t>, Error> {
+		std::vector<size_t> offsets;
+		try {
+			BufReader reader = BufReader(attribute.info.data(), attribute.info.size());
+			u2 count = reader.read_be<u2>();
+			offsets.reserve(count + 1);
+			for (u2 i = 0; i < count; ++i) {
+				offsets.push_back(reader.pos());
+				reader.skip(sizeof(u2)); // bootstrap_method_ref
+				reader.skip(reader.read_be<u2>() * sizeof(u2)); // bootstrap_arguments
+			}
+			offsets.push_back(reader.pos());
+			if (reader.pos() != attribute.info.size())
+				throw std::out_of_range("trailing bytes");
+		} catch (const std::out_of_range &) {
+			ERR("Malformed BootstrapMethods attribute");
+			return std::unexpected(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+		}
+		return offsets;
+	};
+
+	size_t source_attribute = find_table(*this->source_class);
+	if (source_attribute == none) {
+		ERR("Dynamic constant without a BootstrapMethods attribute");
+		return std::unexpected(Error { ErrorKind::Malformed, 0 });
+	}
+
+	auto source_offsets = scan_table(this->source_class->attributes[source_attribute]);
+	if (!source_offsets.has_value())
+		return std::unexpected(source_offsets.error());
+
+	this->target_bootstrap_attribute = find_table(*this->target_class);
+	if (this->target_bootstrap_attribute != none) {
+		auto &attribute = this->target_class->attributes[this->target_bootstrap_attribute];
+		auto target_offsets = scan_table(attribute);
+		if (!target_offsets.has_value())
+			return std::unexpected(target_offsets.error());
+
+		for (size_t i = 0; i + 1 < target_offsets.value().size(); ++i) {
+			auto begin = attribute.info.begin() + target_offsets.value()[i];
+			auto end = attribute.info.begin() + target_offsets.value()[i + 1];
+			this->target_bootstrap_methods.try_emplace(std::string(begin, end), i);
+		}
+	}
+
+	this->source_bootstrap_attribute = source_attribute;
+	this->source_bootstrap_offsets = std::move(source_offsets.value());
+	this->bootstrap_indexed = true;
+	return {};
+}
+
+std::expected<u2, Error> ConstantPoolImporter::import_bootstrap_method(u2 index)
+{
+	if (!this->source_class || !this->target_class) {
+		ERR("Can't import a dynamic constant without the BootstrapMethods attributes");
+		return std::unexpected(Error { ErrorKind::Unsupported, index });
+	}
+
+	auto indexed = this->index_bootstrap_methods();
+	if (!indexed.has_value())
+		return std::unexpected(indexed.error());
+
+	if (auto it = this->bootstrap_table.find(index); it != this->bootstrap_table.end())
+		return it->second;
+
+	if (static_cast<size_t>(index) + 1 >= this->source_bootstrap_offsets.size()) {
+		ERR("Reference to invalid bootstrap method '%hu'", index);
+		return std::unexpected(Error { ErrorKind::Malformed, index });
+	}
+
+	// Same layout in the target, with every constant pool index imported
+	size_t offset = this->source_bootstrap_offsets[index];
+	size_t end = this->source_bootstrap_offsets[index + 1];
+	std::vector<u1> bytes;
+	bytes.reserve(end - offset);
+	for (size_t pos = offset; pos < end; pos += sizeof(u2)) {
+		// Read again every time, the source may also be the target
+		auto &body = this->source_class->attributes[this->source_bootstrap_attribute].info;
+		u2 value = (body[pos] << 8) | body[pos + 1];
+		// Every u2 is an index, except num_bootstrap_arguments
+		if (pos != offset + sizeof(u2)) {
+			auto imported = this->import(value);
+			if (!imported.has_value())
+				return std::unexpected(imported.error());
+			value = imported.value();
+		}
+		bytes.push_back(static_cast<u1>(value >> 8));
+		bytes.push_back(static_cast<u1>(value));
+	}
+
+	auto [it, inserted] = this->target_bootstrap_methods.try_emplace(std::string(bytes.begin(), bytes.end()), 0);
+	if (inserted) {
+		if (this->target_bootstrap_attribute == none) {
+			auto name_index = this->add(ConstantPoolEntry::Utf8Info { "BootstrapMethods" }, index);
+			if (!name_index.has_value()) {
+				this->target_bootstrap_methods.erase(it);
+				return std::unexpected(name_index.error());
+			}
+
+			this->target_bootstrap_attribute = this->target_class->attributes.size();
+			this->target_class->attributes.push_back(AttributeInfo(name_index.value(), { 0, 0 }));
+		}
+
+		auto &info = this->target_class->attributes[this->target_bootstrap_attribute].info;
+		u2 count = (info[0] << 8) | info[1];
+		if (count == 0xFFFF) {
+			this->target_bootstrap_methods.erase(it);
+			ERR("BootstrapMethods is full, can't import bootstrap method '%hu'", index);
+			return std::unexpected(Error { ErrorKind::Unsupported, index });
+		}
+
+		info[0] = static_cast<u1>((count + 1) >> 8);
+		info[1] = static_cast<u1>(count + 1);
+		info.insert(info.end(), bytes.begin(), bytes.end());
+		this->target_class->mark_attributes_dirty();
+		it->second = count;
+	}
+
+	this->bootstrap_table.emplace(index, it->second);
+	return it->second;
+}
+
+std::expected<RemapTable, Error> jcfp::import_from(ConstantPool &target, ConstantPool &source, std::span<const u2> indices)
+{
+	ConstantPoolImporter importer = ConstantPoolImporter(target, source);
+	for (u2 index : indices) {
+		auto imported = importer.import(index);
+		if (!imported.has_value())
+			return std::unexpected(imported.error());
+	}
+
+	return importer.get_table();
+}
+
+std::expected<void, Error> ConstantPoolImporter::import_attribute(AttributeInfo &attribute)
+{
+	auto sites = find_references(this->source, attribute);
+	if (!sites.has_value())
+		return std::unexpected(sites.error());
+
+	// The `ldc` operands are imported first, so they are the most likely to fit in a byte
+	std::vector<u2> indices;
+	indices.reserve(sites.value().size() + 1);
+	for (auto &site : sites.value()) {
+		if (site.width == 1)
+			indices.push_back(attribute.info[site.offset]);
+	}
+
+	indices.push_back(attribute.attribute_name_index);
+	for (auto &site : sites.value()) {
+		if (site.width == 2)
+			indices.push_back((attribute.info[site.offset] << 8) | attribute.info[site.offset + 1]);
+	}
+
+	for (u2 index : indices) {
+		auto imported = this->import(index);
+		if (!imported.has_value())
+			return std::unexpected(imported.error());
+	}
+
+	return remap_references(attribute, sites.value(), this->table);
+}
+
+std::expected<void, Error> jcfp::import_attribute(ConstantPool &target, ConstantPool &source, AttributeInfo &attribute)
+{
+	return ConstantPoolImporter(target, source).import_attribute(attribute);
+}
+
+std::expected<void, Error> jcfp::import_attribute(ClassFile &target, ClassFile &source, AttributeInfo &attribute)
+{
+	return ConstantPoolImporter(target, source).import_attribute(attribute);
+}
+
+std::expected<size_t, Error> jcfp::compact_constant_pool(ClassFile &classfile)
+{
+	auto &constant_pool = classfile.constant_pool;
+	auto used = find_used_entries(classfile);
+	if (!used.has_value())
+		return std::unexpected(used.error());
+
+	auto canonical = EntryDeduplicator(constant_pool).find_canonical_entries(used.value());
+	if (!canonical.has_value())
+		return std::unexpected(canonical.error());
+
+	/*
+	 * Duplicates always map to an earlier entry, so no index grows and
+	 * every `ldc` operand still fits in a byte
+	 */
+	RemapTable table(constant_pool.count(), 0);
+	std::vector<bool> kept(constant_pool.count(), false);
+	u2 next_index = 1;
+	for (u2 i = 1; i < constant_pool.count(); ++i) {
+		u2 first = canonical.value()[i];
+		if (first == 0)
+			continue;
+
+		if (first != i) {
+			table[i] = table[first];
+			continue;
+		}
+
+		kept[i] = true;
+		table[i] = next_index++;
+		// The slot after a wide entry moves along with it
+		if (constant_pool.get_tag(i) == ConstantPoolEntry::Tag::Long ||
+		    constant_pool.get_tag(i) == ConstantPoolEntry::Tag::Double)
+			++next_index;
+	}
+
+	size_t removed = constant_pool.count() - next_index;
+	if (removed == 0)
+		return 0;
+
+	auto result = remap_references(classfile, table);
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	auto &entries = constant_pool.get_entries();
+	std::vector<ConstantPoolEntry> kept_entries;
+	kept_entries.reserve(next_index);
+	kept_entries.push_back(ConstantPoolEntry());
+	for (size_t i = 1; i < entries.size(); ++i) {
+		if (!kept[i])
+			continue;
+
+		bool is_wide = entries[i].is_wide_entry();
+		kept_entries.push_back(std::move(entries[i]));
+		if (is_wide)
+			kept_entries.push_back(ConstantPoolEntry());
+	}
+
+	LOG("Constant pool compacted (removed: %lu, entries: %lu)", removed, kept_entries.size());
+	classfile.constant_pool = ConstantPool(std::move(kept_entries));
+	classfile.constant_pool.mark_dirty();
+
+	return removed;
+}
@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/remapper.hpp>
+#include <jcfp/parallel.hpp>
+#include <jcfp/references.hpp>
+#include <jcfp/utils.hpp>
+#include <optional>
+#include <stdexcept>
+
+using namespace jcfp;
+using Tag = ConstantPoolEntry::Tag;
+
+namespace {
+	/*
+	 * Copies a descriptor or a generic signature, renaming the classes in
+	 * it. Throws std::out_of_range if it is malformed.
+	 */
+	class SignatureRewriter {
+	private:
+		const Mapping &mapping;
+		std::string_view input;
+		size_t pos = 0;
+		std::string output;
+	public:
+		SignatureRewriter(const Mapping &mapping, std::string_view input) : mapping(mapping), input(input)
+		{
+			this->output.reserve(input.size());
+		}
+	public:
+		std::string rewrite()
+		{
+			if (!this->input.empty() && this->peek() == '<')
+				this->formal_type_parameters();
+
+			// Method parameters, return type and exceptions, or supertypes, or a single type
+			while (this->pos < this->input.size()) {
+				char c = this->peek();
+				if (c == '(' || c == ')' || c == '^')
+					this->copy();
+				else
+					this->type();
+			}
+
+			return std::move(this->output);
+		}
+	private:
+		inline char peek()
+		{
+			if (this->pos >= this->input.size())
+				throw std::out_of_range("Truncated signature");
+			return this->input[this->pos];
+		}
+
+		inline void copy()
+		{
+			this->output += this->peek();
+			++this->pos;
+		}
+
+		// Reads up to (not including) one of the `stops`
+		inline std::string_view identifier(std::string_view stops)
+		{
+			size_t start = this->pos;
+			while (stops.find(this->peek()) == std::string_view::npos)
+				++this->pos;
+			return this->input.substr(start, this->pos - start);
+		}
+
+		void type()
+		{
+			switch (this->peek()) {
+			case 'L':
+				this->class_type();
+				break;
+			case 'T': // Type variable
+				this->copy();
+				this->output += this->identifier(";");
+				this->copy();
+				break;
+			case '[':
+				this->copy();
+				this->type();
+				break;
+			case 'B': case 'C': case 'D': case 'F': case 'I': case 'J': case 'S': case 'Z': case 'V':
+				this->copy();
+				break;
+			default:
+				throw std::out_of_range("Invalid type in signature");
+			}
+		}
+
+		void class_type()
+		{
+			this->copy(); // L
+			this->output += this->mapping.map_class(this->identifier(";<."));
+			for (;;) {
+				switch (this->peek()) {
+				case ';':
+					this->copy();
+					return;
+				case '<':
+					this->copy();
+					while (this->peek() != '>') {
+						char c = this->peek();
+						if (c == '*') {
+							this->copy();
+							continue;
+						}
+						if (c == '+' || c == '-')
+							this->copy();
+						this->type();
+					}
+					this->copy();
+					break;
+				case '.': // Inner class, by simple name
+					this->copy();
+					this->output += this->identifier(";<.");
+					break;
+				default:
+					throw std::out_of_range("Invalid class type in signature");
+				}
+			}
+		}
+
+		void formal_type_parameters()
+		{
+			this->copy(); // <
+			while (this->peek() != '>') {
+				this->output += this->identifier(":");
+				// Class bound (may be empty), then interface bounds
+				while (this->peek() == ':') {
+					this->copy();
+					if (this->peek() != ':' && this->peek() != '>')
+						this->type();
+				}
+			}
+			this->copy();
+		}
+	};
+
+	inline void write_index(AttributeInfo &attribute, size_t offset, u2 index)
+	{
+		attribute.info[offset] = static_cast<u1>(index >> 8);
+		attribute.info[offset + 1] = static_cast<u1>(index);
+	}
+
+	inline u2 read_index(const AttributeInfo &attribute, size_t offset)
+	{
+		return (attribute.info[offset] << 8) | attribute.info[offset + 1];
+	}
+
+	template <typename T>
+	inline void set_name_and_type(ConstantPool &constant_pool, u2 index, u2 name_and_type_index)
+	{
+		constant_pool.get<T>(index).name_and_type_index = name_and_type_index;
+	}
+}
+
+std::string Mapping::map_class(std::string_view name) const
+{
+	if (auto it = this->classes.find(name); it != this->classes.end())
+		return it->second;
+
+	const std::pair<std::string, std::string> *package = nullptr;
+	for (auto &candidate : this->packages) {
+		if (name.starts_with(candidate.first) && (!package || candidate.first.size() > package->first.size()))
+			package = &candidate;
+	}
+	if (package)
+		return package->second + std::string(name.substr(package->first.size()));
+
+	return std::string(name);
+}
+
+const std::string *Mapping::map_member(std::string_view owner, std::string_view name, std::string_view descriptor) const
+{
+	if (this->members.empty())
+		return nullptr;
+
+	std::string symbol;
+	symbol.reserve(owner.size() + name.size() + descriptor.size() + 2);
+	symbol.append(owner).append(".").append(name).append(":").append(descriptor);
+	auto it = this->members.find(symbol);
+	return it != this->members.end() ? &it->second : nullptr;
+}
+
+std::string Remapper::map_class_name(std::string_view name)
+{
+	if (name.starts_with('['))
+		return this->map_descriptor(name);
+	return this->mapping.map_class(name);
+}
+
+const std::string &Remapper::map_descriptor(std::string_view descriptor)
+{
+	auto &shard = this->shards[Hash{}(descriptor) % shard_count];
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (auto it = shard.descriptors.find(descriptor); it != shard.descriptors.end())
+			return it->second;
+	}
+
+	// Parsed without the lock, if another thread got there first its result is kept
+	std::string result;
+	try {
+		result = SignatureRewriter(this->mapping, descriptor).rewrite();
+	} catch (const std::out_of_range &) {
+		result = std::string(descriptor);
+	}
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	return shard.descriptors.try_emplace(std::string(descriptor), std::move(result)).first->second;
+}
+
+std::expected<void, Error> Remapper::remap(ClassFile &classfile)
+{
+	Pipeline pipeline;
+	pipeline.add<RemapPass>(*this);
+
+	auto result = pipeline.run(classfile);
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	return {};
+}
+
+std::expected<void, Error> Remapper::remap(std::vector<ClassFile> &classes, unsigned threads)
+{
+	LOG("Remapping classes (classes: %lu)...", classes.size());
+
+	std::vector<std::optional<Error>> errors(classes.size());
+	parallel_for(classes.size(), [&](size_t i) {
+		auto result = this->remap(classes[i]);
+		if (!result.has_value())
+			errors[i] = result.error();
+	}, threads);
+
+	for (auto &error : errors) {
+		if (error)
+			return std::unexpected(*error);
+	}
+
+	LOG("Classes remapped successfully");
+	return {};
+}
+
+void RemapPass::begin_class(PassContext &context)
+{
+	auto &constant_pool = context.classfile.constant_pool;
+	auto &entries = constant_pool.get_entries();
+
+	// The Class entries are renamed in place, but member references need their old names
+	this->class_names.assign(entries.size(), 0);
+	for (size_t i = 1; i < entries.size(); ++i) {
+		if (entries[i].tag == Tag::Class)
+			this->class_names[i] = entries[i].get<ConstantPoolEntry::ClassInfo>().name_index;
+	}
+
+	const std::string *name = constant_pool.find_class_name(context.classfile.this_class);
+	this->this_name = name ? *name : std::string();
+	this->utf8_indices.clear();
+	this->name_and_type_indices.clear();
+}
+
+u2 RemapPass::utf8_index(ConstantPool &constant_pool, const std::string &value)
+{
+	// Indexed on first use, most classes of a classpath don't need new entries
+	if (this->utf8_indices.empty()) {
+		auto &entries = constant_pool.get_entries();
+		for (size_t i = 1; i < entries.size(); ++i) {
+			if (entries[i].tag == Tag::Utf8)
+				this->utf8_indices.try_emplace(entries[i].get<ConstantPoolEntry::Utf8Info>().bytes.str(), i);
+		}
+	}
+
+	auto [it, inserted] = this->utf8_indices.try_emplace(value, 0);
+	if (inserted)
+		it->second = constant_pool.push_entry(ConstantPoolEntry::Utf8Info { value });
+	return it->second;
+}
+
+u2 RemapPass::name_and_type_index(ConstantPool &constant_pool, u2 name_index, u2 descriptor_index)
+{
+	if (this->name_and_type_indices.empty()) {
+		auto &entries = constant_pool.get_entries();
+		for (size_t i = 1; i < entries.size(); ++i) {
+			if (entries[i].tag != Tag::NameAndType)
+				continue;
+
+			auto &info = entries[i].get<ConstantPoolEntry::NameAndTypeInfo>();
+			this->name_and_type_indices.try_emplace((info.name_index << 16) | info.descriptor_index, i);
+		}
+	}
+
+	auto [it, inserted] = this->name_and_type_indices.try_emplace((name_index << 16) | descriptor_index, 0);
+	if (inserted)
+		it->second = constant_pool.push_entry(ConstantPoolEntry::NameAndTypeInfo { name_index, descriptor_index });
+	return it->second;
+}
+
+void RemapPass::on_constant(PassContext &context, u2 index, ConstantPoolEntry &entry)
+{
+	auto &constant_pool = context.classfile.constant_pool;
+	auto fail = [&]() { context.fail(Error { ErrorKind::Malformed, index }); };
+
+	// Adding entries moves the others, so `entry` is only read before that
+	switch (entry.tag) {
+	case Tag::Class: {
+		const std::string *name = constant_pool.find_utf8(entry.get<ConstantPoolEntry::ClassInfo>().name_index);
+		if (!name)
+			return fail();
+
+		std::string new_name = this->remapper.map_class_name(*name);
+		if (new_name == *name)
+			return;
+
+		u2 name_index = this->utf8_index(constant_pool, new_name);
+		constant_pool.get<ConstantPoolEntry::ClassInfo>(index).name_index = name_index;
+		context.mark_dirty();
+		break;
+	}
+	case Tag::Fieldref:
+	case Tag::Methodref:
+	case Tag::InterfaceMethodref: {
+		// Same layout for the three of them
+		auto [class_index, name_and_type_index] = entry.tag == Tag::Fieldref ?
+			std::pair(entry.get<ConstantPoolEntry::FieldrefInfo>().class_index, entry.get<ConstantPoolEntry::FieldrefInfo>().name_and_type_index) :
+			entry.tag == Tag::Methodref ?
+			std::pair(entry.get<ConstantPoolEntry::MethodrefInfo>().class_index, entry.get<ConstantPoolEntry::MethodrefInfo>().name_and_type_index) :
+			std::pair(entry.get<ConstantPoolEntry::InterfaceMethodrefInfo>().class_index, entry.get<ConstantPoolEntry::InterfaceMethodrefInfo>().name_and_type_index);
+		Tag tag = entry.tag;
+
+		if (class_index >= this->class_names.size() || name_and_type_index >= this->class_names.size() ||
+		    constant_pool.get_tag(name_and_type_index) != Tag::NameAndType)
+			return fail();
+
+		auto name_and_type = constant_pool.get<ConstantPoolEntry::NameAndTypeInfo>(name_and_type_index);
+		const std::string *owner = constant_pool.find_utf8(this->class_names[class_index]);
+		const std::string *name = constant_pool.find_utf8(name_and_type.name_index);
+		const std::string *descriptor = constant_pool.find_utf8(name_and_type.descriptor_index);
+		if (!owner || !name || !descriptor)
+			return fail();
+
+		const std::string *new_name = this->remapper.get_mapping().map_member(*owner, *name, *descriptor);
+		const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+		if (!new_name && new_descriptor == *descriptor)
+			return;
+
+		std::string name_copy = new_name ? *new_name : *name;
+		u2 name_index = this->utf8_index(constant_pool, name_copy);
+		u2 descriptor_index = this->utf8_index(constant_pool, new_descriptor);
+		u2 new_name_and_type_index = this->name_and_type_index(constant_pool, name_index, descriptor_index);
+		if (tag == Tag::Fieldref)
+			set_name_and_type<ConstantPoolEntry::FieldrefInfo>(constant_pool, index, new_name_and_type_index);
+		else if (tag == Tag::Methodref)
+			set_name_and_type<ConstantPoolEntry::MethodrefInfo>(constant_pool, index, new_name_and_type_index);
+		else
+			set_name_and_type<ConstantPoolEntry::InterfaceMethodrefInfo>(constant_pool, index, new_name_and_type_index);
+		context.mark_dirty();
+		break;
+	}
+	case Tag::MethodType: {
+		const std::string *descriptor = constant_pool.find_utf8(entry.get<ConstantPoolEntry::MethodTypeInfo>().descriptor_index);
+		if (!descriptor)
+			return fail();
+
+		const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+		if (new_descriptor == *descriptor)
+			return;
+
+		u2 descriptor_index = this->utf8_index(constant_pool, new_descriptor);
+		constant_pool.get<ConstantPoolEntry::MethodTypeInfo>(index).descriptor_index = descriptor_index;
+		context.mark_dirty();
+		break;
+	}
+	case Tag::Dynamic:
+	case Tag::InvokeDynamic: {
+		// The name is chosen by the bootstrap method, only the descriptor changes
+		Tag tag = entry.tag;
+		u2 name_and_type_index = tag == Tag::Dynamic ?
+			entry.get<ConstantPoolEntry::DynamicInfo>().name_and_type_index :
+			entry.get<ConstantPoolEntry::InvokeDynamicInfo>().name_and_type_index;
+		if (name_and_type_index == 0 || name_and_type_index >= this->class_names.size() ||
+		    constant_pool.get_tag(name_and_type_index) != Tag::NameAndType)
+			return fail();
+
+		auto name_and_type = constant_pool.get<ConstantPoolEntry::NameAndTypeInfo>(name_and_type_index);
+		const std::string *descriptor = constant_pool.find_utf8(name_and_type.descriptor_index);
+		if (!descriptor)
+			return fail();
+
+		const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+		if (new_descriptor == *descriptor)
+			return;
+
+		u2 descriptor_index = this->utf8_index(constant_pool, new_descriptor);
+		u2 new_name_and_type_index = this->name_and_type_index(constant_pool, name_and_type.name_index, descriptor_index);
+		if (tag == Tag::Dynamic)
+			constant_pool.get<ConstantPoolEntry::DynamicInfo>(index).name_and_type_index = new_name_and_type_index;
+		else
+			constant_pool.get<ConstantPoolEntry::InvokeDynamicInfo>(index).name_and_type_index = new_name_and_type_index;
+		context.mark_dirty();
+		break;
+	}
+	default:
+		// Utf8 and NameAndType entries are never modified, String literals keep their values
+		break;
+	}
+}
+
+template <typename Member>
+void RemapPass::remap_member(PassContext &context, Member &member)
+{
+	auto &constant_pool = context.classfile.constant_pool;
+	const std::string *name = constant_pool.find_utf8(member.name_index);
+	const std::string *descriptor = constant_pool.find_utf8(member.descriptor_index);
+	if (!name || !descriptor)
+		return context.fail(Error { ErrorKind::Malformed, member.name_index });
+
+	const std::string *new_name = this->remapper.get_mapping().map_member(this->this_name, *name, *descriptor);
+	const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+	if (new_descriptor != *descriptor) {
+		member.descriptor_index = this->utf8_index(constant_pool, new_descriptor);
+		context.mark_dirty();
+	}
+	if (new_name) {
+		member.name_index = this->utf8_index(constant_pool, *new_name);
+		context.mark_dirty();
+	}
+}
+
+void RemapPass::on_field(PassContext &context, FieldInfo &field)
+{
+	this->remap_member(context, field);
+}
+
+void RemapPass::on_method(PassContext &context, MethodInfo &method)
+{
+	this->remap_member(context, method);
+}
+
+void RemapPass::on_attribute(PassContext &context, AttributeInfo &attribute)
+{
+	auto &constant_pool = context.classfile.constant_pool;
+	auto remap_at = [&](size_t offset) {
+		if (offset + sizeof(u2) > attribute.info.size())
+			return context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+
+		const std::string *descriptor = constant_pool.find_utf8(read_index(attribute, offset));
+		if (!descriptor)
+			return context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+
+		const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+		if (new_descriptor == *descriptor)
+			return;
+
+		write_index(attribute, offset, this->utf8_index(constant_pool, new_descriptor));
+		context.mark_dirty();
+	};
+
+	const std::string *name = constant_pool.find_utf8(attribute.attribute_name_index);
+	if (!name)
+		return;
+
+	if (*name == "Signature") {
+		remap_at(0);
+		return;
+	}
+
+	if (*name == "EnclosingMethod")
+		return this->remap_enclosing_method(context, attribute);
+
+	if (*name == "Record")
+		return this->remap_record(context, attribute);
+
+	if (name->starts_with("Runtime") || *name == "AnnotationDefault") {
+		auto sites = find_references(constant_pool, attribute);
+		if (!sites.has_value())
+			return context.fail(sites.error());
+
+		for (auto &site : sites.value()) {
+			if (site.descriptor)
+				remap_at(site.offset);
+		}
+		return;
+	}
+
+	// LocalVariableTable or LocalVariableTypeTable, both with the descriptor/signature at the same place
+	if (attribute.info.size() < sizeof(u2))
+		return context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+
+	u2 count = read_index(attribute, 0);
+	for (u2 i = 0; i < count; ++i) {
+		// start_pc, length, name_index, descriptor_index, index
+		remap_at(sizeof(u2) + i * 5 * sizeof(u2) + 3 * sizeof(u2));
+	}
+}
+
+void RemapPass::remap_enclosing_method(PassContext &context, AttributeInfo &attribute)
+{
+	auto &constant_pool = context.classfile.constant_pool;
+	auto fail = [&]() { context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index }); };
+
+	// class_index, method_index (0 outside of a method)
+	if (attribute.info.size() != 2 * sizeof(u2))
+		return fail();
+
+	u2 class_index = read_index(attribute, 0);
+	u2 name_and_type_index = read_index(attribute, sizeof(u2));
+	if (name_and_type_index == 0)
+		return;
+
+	if (class_index >= this->class_names.size() || name_and_type_index >= this->class_names.size() ||
+	    constant_pool.get_tag(name_and_type_index) != Tag::NameAndType)
+		return fail();
+
+	auto name_and_type = constant_pool.get<ConstantPoolEntry::NameAndTypeInfo>(name_and_type_index);
+	const std::string *owner = constant_pool.find_utf8(this->class_names[class_index]);
+	const std::string *name = constant_pool.find_utf8(name_and_type.name_index);
+	const std::string *descriptor = constant_pool.find_utf8(name_and_type.descriptor_index);
+	if (!owner || !name || !descriptor)
+		return fail();
+
+	const std::string *new_name = this->remapper.get_mapping().map_member(*owner, *name, *descriptor);
+	const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+	if (!new_name && new_descriptor == *descriptor)
+		return;
+
+	std::string name_copy = new_name ? *new_name : *name;
+	u2 name_index = this->utf8_index(constant_pool, name_copy);
+	u2 descriptor_index = this->utf8_index(constant_pool, new_descriptor);
+	write_index(attribute, sizeof(u2), this->name_and_type_index(constant_pool, name_index, descriptor_index));
+	context.mark_dirty();
+}
+
+void RemapPass::remap_record(PassContext &context, AttributeInfo &attribute)
+{
+	auto &constant_pool = context.classfile.constant_pool;
+	auto fail = [&]() { context.fail(Error { ErrorKind::Malformed, attribute.attribute_name_index }); };
+
+	// The annotations of the components are found like the ones of any other attribute
+	auto sites = find_references(constant_pool, attribute);
+	if (!sites.has_value())
+		return context.fail(sites.error());
+
+	std::vector<size_t> offsets;
+	for (auto &site : sites.value()) {
+		if (site.descriptor)
+			offsets.push_back(site.offset);
+	}
+
+	// A reader with no length is not bounds checked
+	if (attribute.info.empty())
+		return fail();
+
+	try {
+		BufReader reader = BufReader(attribute.info.data(), attribute.info.size());
+		for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+			reader.skip(sizeof(u2)); // name_index
+			offsets.push_back(reader.pos()); // descriptor_index
+			reader.skip(sizeof(u2));
+
+			for (u2 j = 0, attributes = reader.read_be<u2>(); j < attributes; ++j) {
+				const std::string *nested_name = constant_pool.find_utf8(reader.read_be<u2>());
+				u4 length = reader.read_be<u4>();
+				if (nested_name && *nested_name == "Signature")
+					offsets.push_back(reader.pos());
+				reader.skip(length);
+			}
+		}
+	} catch (const std::out_of_range &) {
+		return fail();
+	}
+
+	for (size_t offset : offsets) {
+		if (offset + sizeof(u2) > attribute.info.size())
+			return fail();
+
+		const std::string *descriptor = constant_pool.find_utf8(read_index(attribute, offset));
+		if (!descriptor)
+			return fail();
+
+		const std::string &new_descriptor = this->remapper.map_descriptor(*descriptor);
+		if (new_descriptor == *descriptor)
+			continue;
+
+		write_index(attribute, offset, this->utf8_index(constant_pool, new_descriptor));
+		context.mark_dirty();
+	}
+}
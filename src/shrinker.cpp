@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/shrinker.hpp>
+#include <jcfp/interner.hpp>
+#include <jcfp/parallel.hpp>
+#include <jcfp/references.hpp>
+#include <jcfp/utils.hpp>
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <unordered_map>
+
+using namespace jcfp;
+
+namespace {
+	using Symbol = const std::string *;
+
+	struct MemberRef {
+		Symbol owner;
+		Symbol key; // `name:descriptor`
+	};
+
+	struct References {
+		std::vector<Symbol> classes;
+		std::vector<MemberRef> members;
+	};
+
+	struct MemberSummary {
+		Symbol key;
+		AccessFlags access_flags;
+		bool is_method;
+		References references;
+	};
+
+	// Everything the reachability pass needs from a class, so the classes are only read once
+	struct ClassSummary {
+		Symbol name = nullptr;
+		Symbol super_class = nullptr;
+		std::vector<Symbol> interfaces;
+		References references;
+		std::vector<MemberSummary> members;
+		std::optional<Error> error;
+	};
+
+	// Collects the classes and members used by a set of constant pool indices, transitively
+	class ReferenceCollector {
+	private:
+		ConstantPool &constant_pool;
+		StringInterner &interner;
+		std::vector<u4> seen;
+		u4 generation = 0;
+	public:
+		ReferenceCollector(ConstantPool &constant_pool, StringInterner &interner)
+			: constant_pool(constant_pool), interner(interner), seen(constant_pool.count(), 0) {}
+	public:
+		void collect(std::vector<u2> pending, References &references)
+		{
+			using Tag = ConstantPoolEntry::Tag;
+
+			++this->generation;
+			while (!pending.empty()) {
+				u2 index = pending.back();
+				pending.pop_back();
+				if (index == 0 || index >= this->seen.size() || this->seen[index] == this->generation)
+					continue;
+				this->seen[index] = this->generation;
+
+				switch (this->constant_pool.get_tag(index)) {
+				case Tag::Class:
+					if (auto name = this->constant_pool.find_class_name(index))
+						this->class_name(*name, references);
+					break;
+				case Tag::Fieldref:
+				case Tag::Methodref:
+				case Tag::InterfaceMethodref:
+					if (auto member_ref = this->constant_pool.find_member_ref(index)) {
+						auto [owner, name, descriptor] = member_ref.value();
+						std::string key = *name + ":" + *descriptor;
+						references.members.push_back(MemberRef { this->interner.intern(*owner), this->interner.intern(key) });
+						this->class_name(*owner, references);
+						this->descriptor(*descriptor, references);
+					}
+					break;
+				case Tag::NameAndType: {
+					auto &info = this->constant_pool.get<ConstantPoolEntry::NameAndTypeInfo>(index);
+					if (auto descriptor = this->constant_pool.find_utf8(info.descriptor_index))
+						this->descriptor(*descriptor, references);
+					break;
+				}
+				case Tag::MethodType: {
+					auto &info = this->constant_pool.get<ConstantPoolEntry::MethodTypeInfo>(index);
+					if (auto descriptor = this->constant_pool.find_utf8(info.descriptor_index))
+						this->descriptor(*descriptor, references);
+					break;
+				}
+				default:
+					for_each_reference(this->constant_pool.get_entry(index), [&pending](u2 &reference) {
+						pending.push_back(reference);
+					});
+					break;
+				}
+			}
+		}
+
+		// Adds every class named in a field or method descriptor
+		void descriptor(std::string_view descriptor, References &references)
+		{
+			for (size_t i = 0; i < descriptor.size(); ++i) {
+				if (descriptor[i] != 'L')
+					continue;
+
+				size_t end = descriptor.find(';', i);
+				if (end == std::string_view::npos)
+					return;
+
+				references.classes.push_back(this->interner.intern(descriptor.substr(i + 1, end - i - 1)));
+				i = end;
+			}
+		}
+	private:
+		void class_name(std::string_view name, References &references)
+		{
+			if (name.starts_with('['))
+				this->descriptor(name, references);
+			else
+				references.classes.push_back(this->interner.intern(name));
+		}
+	};
+
+	// Attributes that only describe other classes, and don't make them reachable
+	bool is_nest_attribute(const std::string &name)
+	{
+		return name == "InnerClasses" || name == "NestMembers" || name == "PermittedSubclasses";
+	}
+
+	std::optional<Error> summarize(ClassFile &classfile, ClassSummary &summary, StringInterner &interner)
+	{
+		auto &constant_pool = classfile.constant_pool;
+		auto name = constant_pool.find_class_name(classfile.this_class);
+		if (!name)
+			return Error { ErrorKind::Malformed, classfile.this_class };
+
+		summary.name = interner.intern(*name);
+		if (auto super_class = constant_pool.find_class_name(classfile.super_class))
+			summary.super_class = interner.intern(*super_class);
+		for (u2 index : classfile.interfaces) {
+			if (auto iface = constant_pool.find_class_name(index))
+				summary.interfaces.push_back(interner.intern(*iface));
+		}
+
+		ReferenceCollector collector = ReferenceCollector(constant_pool, interner);
+		auto roots = [&](std::vector<AttributeInfo> &attributes, bool skip_nest) -> std::expected<std::vector<u2>, Error> {
+			std::vector<u2> indices;
+			for (auto &attribute : attributes) {
+				auto attribute_name = constant_pool.find_utf8(attribute.attribute_name_index);
+				if (skip_nest && attribute_name && is_nest_attribute(*attribute_name))
+					continue;
+
+				auto sites = find_references(constant_pool, attribute);
+				if (!sites.has_value())
+					return std::unexpected(sites.error());
+				for (auto &site : sites.value()) {
+					const u1 *bytes = &attribute.info[site.offset];
+					indices.push_back(site.width == 1 ? bytes[0] : (bytes[0] << 8) | bytes[1]);
+				}
+			}
+			return indices;
+		};
+
+		auto class_roots = roots(classfile.attributes, true);
+		if (!class_roots.has_value())
+			return class_roots.error();
+		collector.collect(std::move(class_roots.value()), summary.references);
+
+		auto add_member = [&](auto &member, bool is_method) -> std::optional<Error> {
+			auto member_name = constant_pool.find_utf8(member.name_index);
+			auto descriptor = constant_pool.find_utf8(member.descriptor_index);
+			if (!member_name || !descriptor)
+				return Error { ErrorKind::Malformed, member.name_index };
+
+			MemberSummary member_summary = {
+				interner.intern(*member_name + ":" + *descriptor), member.access_flags, is_method, {}
+			};
+			collector.descriptor(*descriptor, member_summary.references);
+
+			auto member_roots = roots(member.attributes, false);
+			if (!member_roots.has_value())
+				return member_roots.error();
+			collector.collect(std::move(member_roots.value()), member_summary.references);
+
+			summary.members.push_back(std::move(member_summary));
+			return {};
+		};
+
+		for (auto &field : classfile.fields) {
+			if (auto error = add_member(field, false))
+				return error;
+		}
+
+		for (auto &method : classfile.methods) {
+			if (auto error = add_member(method, true))
+				return error;
+		}
+
+		return {};
+	}
+
+	class Reachability {
+	private:
+		std::vector<ClassSummary> &summaries;
+		StringInterner &interner;
+		std::unordered_map<Symbol, u4> class_ids;
+		std::vector<std::unordered_map<Symbol, u4>> member_ids; // By class, key -> local index
+		std::vector<u4> member_base;
+		std::unique_ptr<std::atomic<bool>[]> reached;
+		Symbol object;
+		Symbol clinit;
+	public:
+		std::vector<u1> is_definition; // False for the later definitions of a class
+	public:
+		Reachability(std::vector<ClassSummary> &summaries, StringInterner &interner)
+			: summaries(summaries), interner(interner)
+		{
+			size_t count = summaries.size();
+			this->member_ids.resize(count);
+			this->member_base.resize(count + 1, 0);
+			this->is_definition.resize(count, false);
+			this->object = interner.intern("java/lang/Object");
+			this->clinit = interner.intern("<clinit>:()V");
+
+			for (u4 i = 0; i < count; ++i) {
+				auto &summary = summaries[i];
+				this->member_base[i + 1] = this->member_base[i] + summary.members.size();
+				if (!this->class_ids.try_emplace(summary.name, i).second)
+					continue;
+
+				this->is_definition[i] = true;
+				for (u4 j = 0; j < summary.members.size(); ++j)
+					this->member_ids[i].try_emplace(summary.members[j].key, j);
+			}
+
+			this->reached = std::make_unique<std::atomic<bool>[]>(count + this->member_base[count]);
+		}
+	public:
+		inline u4 member_node(u4 class_id, u4 member) const
+		{
+			return this->summaries.size() + this->member_base[class_id] + member;
+		}
+
+		inline bool is_reached(u4 node) const
+		{
+			return this->reached[node].load(std::memory_order_relaxed);
+		}
+
+		std::optional<u4> find_class(std::string_view name)
+		{
+			auto it = this->class_ids.find(this->interner.intern(name));
+			if (it == this->class_ids.end())
+				return {};
+			return it->second;
+		}
+
+		std::optional<u4> find_member(std::string_view symbol)
+		{
+			size_t separator = symbol.find('.');
+			if (separator == std::string_view::npos)
+				return {};
+			return this->resolve(MemberRef {
+				this->interner.intern(symbol.substr(0, separator)),
+				this->interner.intern(symbol.substr(separator + 1))
+			});
+		}
+
+		// Reaches `node`, adding it to `frontier` the first time
+		inline void reach(u4 node, std::vector<u4> &frontier)
+		{
+			if (!this->reached[node].exchange(true, std::memory_order_relaxed))
+				frontier.push_back(node);
+		}
+
+		void reach_class(Symbol name, std::vector<u4> &frontier)
+		{
+			auto it = this->class_ids.find(name);
+			if (it != this->class_ids.end())
+				this->reach(it->second, frontier);
+		}
+
+		// Everything reached directly by `node`
+		void visit(u4 node, std::vector<u4> &frontier)
+		{
+			size_t count = this->summaries.size();
+			const References *references;
+
+			if (node < count) {
+				auto &summary = this->summaries[node];
+				if (summary.super_class)
+					this->reach_class(summary.super_class, frontier);
+				for (auto iface : summary.interfaces)
+					this->reach_class(iface, frontier);
+
+				auto clinit = this->member_ids[node].find(this->clinit);
+				if (clinit != this->member_ids[node].end())
+					this->reach(this->member_node(node, clinit->second), frontier);
+				references = &summary.references;
+			} else {
+				u4 member = node - count;
+				u4 class_id = std::upper_bound(this->member_base.begin(), this->member_base.end(), member) - this->member_base.begin() - 1;
+				this->reach(class_id, frontier);
+				references = &this->summaries[class_id].members[member - this->member_base[class_id]].references;
+			}
+
+			for (auto name : references->classes)
+				this->reach_class(name, frontier);
+			for (auto &member_ref : references->members) {
+				if (auto target = this->resolve(member_ref))
+					this->reach(target.value(), frontier);
+			}
+		}
+
+		/*
+		 * Virtual methods of reachable classes that override something
+		 * reachable (or possibly something outside of the batch)
+		 */
+		void visit_overrides(u4 class_id, std::vector<u4> &frontier)
+		{
+			auto &summary = this->summaries[class_id];
+			for (u4 j = 0; j < summary.members.size(); ++j) {
+				auto &member = summary.members[j];
+				u4 node = this->member_node(class_id, j);
+				if (!member.is_method || this->is_reached(node) ||
+				    (member.access_flags & (ACC_STATIC | ACC_PRIVATE)) || member.key->starts_with('<'))
+					continue;
+
+				if (this->overrides_reachable(class_id, member.key))
+					this->reach(node, frontier);
+			}
+		}
+	private:
+		// Finds the definition of a member, looking up the supertypes of its owner
+		std::optional<u4> resolve(const MemberRef &member_ref)
+		{
+			std::vector<Symbol> pending = { member_ref.owner };
+			std::vector<Symbol> visited;
+			while (!pending.empty()) {
+				Symbol name = pending.back();
+				pending.pop_back();
+				if (std::find(visited.begin(), visited.end(), name) != visited.end())
+					continue;
+				visited.push_back(name);
+
+				auto it = this->class_ids.find(name);
+				if (it == this->class_ids.end())
+					continue;
+
+				u4 class_id = it->second;
+				auto member = this->member_ids[class_id].find(member_ref.key);
+				if (member != this->member_ids[class_id].end())
+					return this->member_node(class_id, member->second);
+
+				auto &summary = this->summaries[class_id];
+				pending.insert(pending.end(), summary.interfaces.rbegin(), summary.interfaces.rend());
+				if (summary.super_class)
+					pending.push_back(summary.super_class);
+			}
+
+			return {};
+		}
+
+		bool overrides_reachable(u4 class_id, Symbol key)
+		{
+			static constexpr std::string_view object_methods[] = {
+				"equals:(Ljava/lang/Object;)Z",
+				"hashCode:()I",
+				"toString:()Ljava/lang/String;",
+				"finalize:()V",
+				"clone:()Ljava/lang/Object;",
+			};
+
+			auto &summary = this->summaries[class_id];
+			std::vector<Symbol> pending = summary.interfaces;
+			if (summary.super_class)
+				pending.push_back(summary.super_class);
+
+			std::vector<Symbol> visited;
+			while (!pending.empty()) {
+				Symbol name = pending.back();
+				pending.pop_back();
+				if (std::find(visited.begin(), visited.end(), name) != visited.end())
+					continue;
+				visited.push_back(name);
+
+				auto it = this->class_ids.find(name);
+				if (it == this->class_ids.end()) {
+					if (name != this->object)
+						return true; // Unknown supertype, it may declare the method
+					if (std::find(std::begin(object_methods), std::end(object_methods), *key) != std::end(object_methods))
+						return true;
+					continue;
+				}
+
+				u4 super_id = it->second;
+				auto member = this->member_ids[super_id].find(key);
+				if (member != this->member_ids[super_id].end() && this->is_reached(this->member_node(super_id, member->second)))
+					return true;
+
+				auto &super_summary = this->summaries[super_id];
+				pending.insert(pending.end(), super_summary.interfaces.begin(), super_summary.interfaces.end());
+				if (super_summary.super_class)
+					pending.push_back(super_summary.super_class);
+			}
+
+			return false;
+		}
+	};
+}
+
+std::expected<ShrinkStats, Error> Shrinker::shrink(std::vector<ClassFile> &classes, unsigned threads)
+{
+	StringInterner interner;
+	std::vector<ClassSummary> summaries(classes.size());
+
+	LOG("Shrinking classes (classes: %lu)...", classes.size());
+
+	parallel_for(classes.size(), [&](size_t i) {
+		summaries[i].error = summarize(classes[i], summaries[i], interner);
+	}, threads);
+
+	for (auto &summary : summaries) {
+		if (summary.error.has_value())
+			return std::unexpected(summary.error.value());
+	}
+
+	Reachability reachability = Reachability(summaries, interner);
+	std::vector<u4> frontier;
+	for (auto &name : this->kept_classes) {
+		auto class_id = reachability.find_class(name);
+		if (!class_id.has_value()) {
+			ERR("Entry point class '%s' not found", name.c_str());
+			continue;
+		}
+
+		reachability.reach(class_id.value(), frontier);
+		for (u4 j = 0; j < summaries[class_id.value()].members.size(); ++j)
+			reachability.reach(reachability.member_node(class_id.value(), j), frontier);
+	}
+
+	for (auto &symbol : this->kept_members) {
+		auto node = reachability.find_member(symbol);
+		if (!node.has_value()) {
+			ERR("Entry point member '%s' not found", symbol.c_str());
+			continue;
+		}
+		reachability.reach(node.value(), frontier);
+	}
+
+	// Level by level: every node of the frontier is visited in parallel
+	while (!frontier.empty()) {
+		while (!frontier.empty()) {
+			std::vector<std::vector<u4>> found(frontier.size());
+			parallel_for(frontier.size(), [&](size_t i) {
+				reachability.visit(frontier[i], found[i]);
+			}, threads);
+
+			frontier.clear();
+			for (auto &nodes : found)
+				frontier.insert(frontier.end(), nodes.begin(), nodes.end());
+		}
+
+		// Overrides can only be found once nothing else is left
+		std::vector<std::vector<u4>> found(classes.size());
+		parallel_for(classes.size(), [&](size_t i) {
+			if (reachability.is_definition[i] && reachability.is_reached(i))
+				reachability.visit_overrides(i, found[i]);
+		}, threads);
+
+		for (auto &nodes : found)
+			frontier.insert(frontier.end(), nodes.begin(), nodes.end());
+	}
+
+	// Shrink copies of the classes that change, so nothing is modified if any of them fails
+	struct ClassStats {
+		ShrinkStats stats;
+		bool removed = false;
+		std::optional<ClassFile> shrunk;
+		std::optional<Error> error;
+	};
+	std::vector<ClassStats> class_stats(classes.size());
+	parallel_for(classes.size(), [&](size_t i) {
+		auto &result = class_stats[i];
+		if (!reachability.is_definition[i])
+			return; // Duplicate definitions are left alone
+
+		if (!reachability.is_reached(i)) {
+			result.removed = true;
+			return;
+		}
+
+		// Fields come first in the member nodes, then methods
+		auto &classfile = classes[i];
+		u4 member = 0;
+		auto unreached = [&](size_t count) {
+			std::vector<bool> flags(count);
+			for (size_t j = 0; j < count; ++j)
+				flags[j] = !reachability.is_reached(reachability.member_node(i, member++));
+			return flags;
+		};
+		std::vector<bool> removed_fields = unreached(classfile.fields.size());
+		std::vector<bool> removed_methods = unreached(classfile.methods.size());
+
+		result.stats.fields_removed = std::count(removed_fields.begin(), removed_fields.end(), true);
+		result.stats.methods_removed = std::count(removed_methods.begin(), removed_methods.end(), true);
+		if (result.stats.fields_removed == 0 && result.stats.methods_removed == 0)
+			return;
+
+		ClassFile shrunk = classfile;
+		erase_flagged(shrunk.fields, removed_fields);
+		erase_flagged(shrunk.methods, removed_methods);
+
+		auto compacted = compact_constant_pool(shrunk);
+		if (!compacted.has_value()) {
+			result.error = compacted.error();
+			return;
+		}
+		result.stats.constants_removed = compacted.value();
+		result.shrunk = std::move(shrunk);
+	}, threads);
+
+	ShrinkStats stats;
+	std::vector<bool> removed_classes(classes.size());
+	for (size_t i = 0; i < class_stats.size(); ++i) {
+		auto &result = class_stats[i];
+		if (result.error.has_value())
+			return std::unexpected(result.error.value());
+
+		removed_classes[i] = result.removed;
+		stats.classes_removed += result.removed;
+		stats.fields_removed += result.stats.fields_removed;
+		stats.methods_removed += result.stats.methods_removed;
+		stats.constants_removed += result.stats.constants_removed;
+	}
+
+	for (size_t i = 0; i < classes.size(); ++i) {
+		if (class_stats[i].shrunk.has_value())
+			classes[i] = std::move(class_stats[i].shrunk.value());
+	}
+	erase_flagged(classes, removed_classes);
+
+	LOG("Classes shrunk (classes removed: %lu, fields removed: %lu, methods removed: %lu)",
+	    stats.classes_removed, stats.fields_removed, stats.methods_removed);
+
+	return stats;
+}
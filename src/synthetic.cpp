@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/synthetic.hpp>
+#include <jcfp/bytecode.hpp>
+#include <jcfp/utils.hpp>
+#include <random>
+
+using namespace jcfp;
+using Entry = ConstantPoolEntry;
+
+namespace {
+	/*
+	 * The output of std::mt19937_64 is fixed by the standard, but the
+	 * distributions are not, so the numbers are reduced by hand to get the
+	 * same classes everywhere
+	 */
+	class Random {
+	private:
+		std::mt19937_64 engine;
+	public:
+		Random(uint64_t seed) : engine(seed) {}
+	public:
+		inline uint64_t next()
+		{
+			return this->engine();
+		}
+
+		// In [0, bound)
+		inline uint64_t below(uint64_t bound)
+		{
+			return bound > 0 ? this->next() % bound : 0;
+		}
+
+		std::string identifier(size_t max_length)
+		{
+			static constexpr char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$";
+			std::string result(1 + this->below(max_length), '\0');
+			for (auto &c : result)
+				c = chars[this->below(sizeof(chars) - 1)];
+			return result;
+		}
+	};
+
+	// Entries every class needs, in this order
+	enum FixedEntry : u2 {
+		THIS_NAME = 1,
+		THIS_CLASS,
+		SUPER_NAME,
+		SUPER_CLASS,
+		CODE_NAME,
+		VOID_DESCRIPTOR,
+		ANNOTATIONS_NAME,
+		ANNOTATION_TYPE,
+		ANNOTATION_ELEMENT,
+		INT_CONSTANT,
+		LONG_CONSTANT, // Takes two slots
+		FIELD_DESCRIPTORS = LONG_CONSTANT + 2,
+	};
+
+	constexpr const char *field_descriptors[] = { "I", "J", "D", "Ljava/lang/String;", "[Ljava/lang/Object;" };
+	constexpr u2 fixed_entries = FIELD_DESCRIPTORS + sizeof(field_descriptors) / sizeof(field_descriptors[0]);
+
+	template <typename T>
+	inline void append_be(std::vector<u1> &bytes, T value)
+	{
+		T value_be = swap_be(value);
+		const u1 *ptr = reinterpret_cast<const u1 *>(&value_be);
+		bytes.insert(bytes.end(), ptr, ptr + sizeof(T));
+	}
+
+	// Pushes and pops constants until `code_length`, then returns
+	std::vector<u1> generate_code(Random &random, u2 code_length)
+	{
+		std::vector<u1> code;
+		code.reserve(code_length);
+		while (code.size() + 4 < code_length) {
+			switch (random.below(4)) {
+			case 0:
+				code.push_back(static_cast<u1>(Opcode::OP_ldc_w));
+				append_be<u2>(code, INT_CONSTANT);
+				code.push_back(static_cast<u1>(Opcode::OP_pop));
+				break;
+			case 1:
+				code.push_back(static_cast<u1>(Opcode::OP_ldc2_w));
+				append_be<u2>(code, LONG_CONSTANT);
+				code.push_back(static_cast<u1>(Opcode::OP_pop2));
+				break;
+			case 2:
+				code.push_back(static_cast<u1>(Opcode::OP_iconst_0));
+				code.push_back(static_cast<u1>(Opcode::OP_pop));
+				break;
+			default:
+				code.push_back(static_cast<u1>(Opcode::OP_nop));
+				break;
+			}
+		}
+
+		code.resize(code_length - 1, static_cast<u1>(Opcode::OP_nop));
+		code.push_back(static_cast<u1>(Opcode::OP_return));
+		return code;
+	}
+
+	AttributeInfo generate_code_attribute(Random &random, u2 code_length)
+	{
+		std::vector<u1> code = generate_code(random, code_length);
+		std::vector<u1> info;
+		info.reserve(code.size() + 12);
+		append_be<u2>(info, 2); // max_stack
+		append_be<u2>(info, 0); // max_locals
+		append_be<u4>(info, code.size());
+		info.insert(info.end(), code.begin(), code.end());
+		append_be<u2>(info, 0); // exception_table_length
+		append_be<u2>(info, 0); // attributes_count
+		return AttributeInfo(CODE_NAME, std::move(info));
+	}
+
+	// `@Synthetic(value = @Synthetic(value = ...))`, `depth` annotations deep
+	AttributeInfo generate_annotations(u2 depth)
+	{
+		std::vector<u1> info;
+		info.reserve(2 + depth * 7);
+		append_be<u2>(info, 1); // num_annotations
+		for (u2 i = 1; i < depth; ++i) {
+			append_be<u2>(info, ANNOTATION_TYPE);
+			append_be<u2>(info, 1); // num_element_value_pairs
+			append_be<u2>(info, ANNOTATION_ELEMENT);
+			info.push_back('@');
+		}
+		append_be<u2>(info, ANNOTATION_TYPE);
+		append_be<u2>(info, 0);
+		return AttributeInfo(ANNOTATIONS_NAME, std::move(info));
+	}
+
+	// Random constants, `wide_entries` of them Long or Double
+	void fill_constant_pool(Random &random, ConstantPool &constant_pool, u2 constant_pool_count, u2 wide_entries)
+	{
+		for (u2 i = 0; i < wide_entries && constant_pool.count() + 2 <= constant_pool_count; ++i) {
+			u4 high = random.next();
+			u4 low = random.next();
+			if (random.below(2) == 0)
+				constant_pool.push_entry(Entry::LongInfo { high, low });
+			else
+				constant_pool.push_entry(Entry::DoubleInfo { high, low });
+		}
+
+		while (constant_pool.count() < constant_pool_count) {
+			u2 count = constant_pool.count();
+			switch (random.below(5)) {
+			case 0:
+				constant_pool.push_entry(Entry::IntegerInfo { static_cast<u4>(random.next()) });
+				break;
+			case 1:
+				constant_pool.push_entry(Entry::FloatInfo { static_cast<u4>(random.next()) });
+				break;
+			case 2:
+				// References one of the Utf8 entries pushed before it, if any
+				if (constant_pool.get_tag(count - 1) == Entry::Tag::Utf8) {
+					constant_pool.push_entry(Entry::StringInfo { static_cast<u2>(count - 1) });
+					break;
+				}
+				[[fallthrough]];
+			default:
+				constant_pool.push_entry(Entry::Utf8Info { random.identifier(32) });
+				break;
+			}
+		}
+	}
+}
+
+std::expected<ClassFile, Error> jcfp::generate_class(const std::string &name, const SyntheticShape &shape)
+{
+	Random random = Random(shape.seed);
+
+	// Each field and method needs a name
+	if (static_cast<size_t>(fixed_entries) + shape.fields + shape.methods >= 0xFFFF) {
+		ERR("Too many members for a synthetic class (fields: %hu, methods: %hu)", shape.fields, shape.methods);
+		return std::unexpected(Error { ErrorKind::Unsupported, 0 });
+	}
+
+	LOG("Generating synthetic class '%s'...", name.c_str());
+
+	ConstantPool constant_pool = ConstantPool({ Entry() });
+	constant_pool.push_entry(Entry::Utf8Info { name });
+	constant_pool.push_entry(Entry::ClassInfo { THIS_NAME });
+	constant_pool.push_entry(Entry::Utf8Info { "java/lang/Object" });
+	constant_pool.push_entry(Entry::ClassInfo { SUPER_NAME });
+	constant_pool.push_entry(Entry::Utf8Info { "Code" });
+	constant_pool.push_entry(Entry::Utf8Info { "()V" });
+	constant_pool.push_entry(Entry::Utf8Info { "RuntimeInvisibleAnnotations" });
+	constant_pool.push_entry(Entry::Utf8Info { "LSynthetic;" });
+	constant_pool.push_entry(Entry::Utf8Info { "value" });
+	constant_pool.push_entry(Entry::IntegerInfo { static_cast<u4>(random.next()) });
+	constant_pool.push_entry(Entry::LongInfo { static_cast<u4>(random.next()), static_cast<u4>(random.next()) });
+	for (auto descriptor : field_descriptors)
+		constant_pool.push_entry(Entry::Utf8Info { descriptor });
+
+	std::vector<FieldInfo> fields;
+	fields.reserve(shape.fields);
+	for (u2 i = 0; i < shape.fields; ++i) {
+		u2 name_index = constant_pool.push_entry(Entry::Utf8Info { std::string("f").append(std::to_string(i)) });
+		u2 descriptor_index = FIELD_DESCRIPTORS + random.below(sizeof(field_descriptors) / sizeof(field_descriptors[0]));
+		fields.push_back(FieldInfo { ACC_PRIVATE, name_index, descriptor_index, {} });
+	}
+
+	u2 code_length = std::max<u2>(shape.code_length, 1);
+	std::vector<MethodInfo> methods;
+	methods.reserve(shape.methods);
+	for (u2 i = 0; i < shape.methods; ++i) {
+		u2 name_index = constant_pool.push_entry(Entry::Utf8Info { std::string("m").append(std::to_string(i)) });
+		methods.push_back(MethodInfo {
+			static_cast<AccessFlags>(ACC_PUBLIC | ACC_STATIC), name_index, VOID_DESCRIPTOR,
+			{ generate_code_attribute(random, code_length) }
+		});
+	}
+
+	fill_constant_pool(random, constant_pool, shape.constant_pool_count, shape.wide_entries);
+
+	std::vector<AttributeInfo> attributes;
+	if (shape.annotation_depth > 0)
+		attributes.push_back(generate_annotations(shape.annotation_depth));
+
+	return ClassFile(JCFP_CLASSFILE_MAGIC, 0, JAVA_SE_8, std::move(constant_pool),
+			 static_cast<AccessFlags>(ACC_PUBLIC | ACC_SUPER), THIS_CLASS, SUPER_CLASS, {},
+			 std::move(fields), std::move(methods), std::move(attributes));
+}
+
+SyntheticShape jcfp::random_shape(uint64_t seed)
+{
+	Random random = Random(seed);
+	SyntheticShape shape;
+	shape.seed = random.next();
+
+	// About one class in 16 is an outlier
+	bool outlier = random.below(16) == 0;
+	shape.fields = random.below(outlier ? 1024 : 16);
+	shape.methods = 1 + random.below(outlier ? 512 : 24);
+	shape.code_length = 1 + random.below(outlier ? 8192 : 256);
+	shape.constant_pool_count = 64 + random.below(outlier ? 16384 : 512);
+	shape.wide_entries = random.below(shape.constant_pool_count / 8);
+	shape.annotation_depth = random.below(outlier ? 32 : 2);
+	return shape;
+}
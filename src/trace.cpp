@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/trace.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+
+using namespace jcfp;
+
+std::atomic<Tracer *> jcfp::detail::active_tracer = nullptr;
+
+const char *jcfp::trace_phase_name(TracePhase phase)
+{
+	static constexpr const char *names[] = {
+		"header",
+		"constant_pool",
+		"fields",
+		"methods",
+		"attributes",
+		"encode",
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(TracePhase::MAX));
+
+	return phase < TracePhase::MAX ? names[static_cast<size_t>(phase)] : "unknown";
+}
+
+void TraceHistogram::on_phase(const TraceEvent &event)
+{
+	if (event.phase >= TracePhase::MAX)
+		return;
+
+	auto &stats = this->phases[static_cast<size_t>(event.phase)];
+	uint64_t duration = event.end_ns > event.begin_ns ? event.end_ns - event.begin_ns : 0;
+	size_t bucket = duration > 0 ? std::bit_width(duration) - 1 : 0;
+
+	stats.count.fetch_add(1, std::memory_order_relaxed);
+	stats.total_ns.fetch_add(duration, std::memory_order_relaxed);
+	stats.bytes.fetch_add(event.bytes, std::memory_order_relaxed);
+	stats.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::count(TracePhase phase) const
+{
+	return this->phases[static_cast<size_t>(phase)].count.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::total_ns(TracePhase phase) const
+{
+	return this->phases[static_cast<size_t>(phase)].total_ns.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::bytes(TracePhase phase) const
+{
+	return this->phases[static_cast<size_t>(phase)].bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::bucket(TracePhase phase, size_t index) const
+{
+	return this->phases[static_cast<size_t>(phase)].buckets[index].load(std::memory_order_relaxed);
+}
+
+uint64_t TraceHistogram::quantile_ns(TracePhase phase, double quantile) const
+{
+	uint64_t count = 0;
+	for (size_t i = 0; i < bucket_count; ++i)
+		count += this->bucket(phase, i);
+	if (count == 0)
+		return 0;
+
+	// Rank of the sample, counting from 1
+	uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * count + 0.5));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < bucket_count; ++i) {
+		seen += this->bucket(phase, i);
+		if (seen >= rank)
+			return i + 1 < bucket_count ? (uint64_t(1) << (i + 1)) - 1 : UINT64_MAX;
+	}
+
+	return UINT64_MAX;
+}
+
+std::string TraceHistogram::to_string() const
+{
+	std::string result;
+	for (size_t i = 0; i < static_cast<size_t>(TracePhase::MAX); ++i) {
+		TracePhase phase = static_cast<TracePhase>(i);
+		uint64_t count = this->count(phase);
+		if (count == 0)
+			continue;
+
+		double seconds = this->total_ns(phase) / 1e9;
+		double megabytes = this->bytes(phase) / (1024.0 * 1024.0);
+		char line[256];
+		snprintf(line, sizeof(line),
+			 "%s: count=%lu total=%.3fms throughput=%.1fMB/s p50<=%luns p90<=%luns p99<=%luns\n",
+			 trace_phase_name(phase), count, seconds * 1e3, seconds > 0 ? megabytes / seconds : 0.0,
+			 this->quantile_ns(phase, 0.5), this->quantile_ns(phase, 0.9), this->quantile_ns(phase, 0.99));
+		result += line;
+	}
+
+	return result;
+}
+
+void TraceHistogram::reset()
+{
+	for (auto &stats : this->phases) {
+		stats.count.store(0, std::memory_order_relaxed);
+		stats.total_ns.store(0, std::memory_order_relaxed);
+		stats.bytes.store(0, std::memory_order_relaxed);
+		for (auto &bucket : stats.buckets)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2025  Rdbo
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jcfp/validator.hpp>
+#include <jcfp/bytecode.hpp>
+#include <jcfp/references.hpp>
+#include <jcfp/utils.hpp>
+#include <initializer_list>
+#include <optional>
+
+using namespace jcfp;
+using Tag = ConstantPoolEntry::Tag;
+
+namespace {
+	class Validator {
+	private:
+		std::vector<ConstantPoolEntry> &entries;
+		ConstantPool &constant_pool;
+	public:
+		Validator(ClassFile &classfile)
+			: entries(classfile.constant_pool.get_entries()), constant_pool(classfile.constant_pool) {}
+	public:
+		// True if `index` is an entry with one of the `tags`
+		inline bool is(u2 index, std::initializer_list<Tag> tags)
+		{
+			if (index == 0 || index >= this->entries.size())
+				return false;
+
+			for (Tag tag : tags) {
+				if (this->entries[index].tag == tag)
+					return true;
+			}
+			return false;
+		}
+
+		inline std::expected<void, Error> expect(u2 index, std::initializer_list<Tag> tags)
+		{
+			if (this->is(index, tags))
+				return {};
+
+			ERR("Invalid constant pool reference to index '%hu'", index);
+			return std::unexpected(Error { ErrorKind::Malformed, index });
+		}
+
+		std::expected<void, Error> constant_pool_entries()
+		{
+			if (this->entries.empty() || this->entries[0].tag != Tag::Empty)
+				return std::unexpected(Error { ErrorKind::Malformed, 0 });
+
+			for (u2 i = 1; i < this->entries.size(); ++i) {
+				auto result = this->entry(i);
+				if (!result.has_value())
+					return result;
+
+				if (this->entries[i].is_wide_entry()) {
+					// The next slot is unusable, and must exist
+					if (static_cast<size_t>(i) + 1 >= this->entries.size() || this->entries[i + 1].tag != Tag::Empty)
+						return std::unexpected(Error { ErrorKind::Malformed, i });
+					++i;
+				}
+			}
+
+			return {};
+		}
+
+		std::expected<void, Error> attributes(const std::vector<AttributeInfo> &attributes, int depth = 0)
+		{
+			for (auto &attribute : attributes) {
+				auto result = this->expect(attribute.attribute_name_index, { Tag::Utf8 });
+				if (!result.has_value())
+					return result;
+
+				// The sites of a Code attribute include the ones of its nested attributes
+				if (depth == 0) {
+					result = this->sites(attribute);
+					if (!result.has_value())
+						return result;
+				}
+
+				auto &name = this->constant_pool.get<ConstantPoolEntry::Utf8Info>(attribute.attribute_name_index).bytes.str();
+				try {
+					result = this->attribute_tags(attribute, name);
+					if (!result.has_value())
+						return result;
+
+					// Code can't nest in Code, but a malformed class could try
+					if (name != "Code" || depth > 0)
+						continue;
+
+					CodeAttr code = CodeAttr(attribute);
+					for (auto &entry : code.exception_table) {
+						if (entry.catch_type != 0 && !this->is(entry.catch_type, { Tag::Class }))
+							return std::unexpected(Error { ErrorKind::Malformed, entry.catch_type });
+					}
+
+					result = this->attributes(code.attributes, depth + 1);
+					if (!result.has_value())
+						return result;
+				} catch (const std::out_of_range &) {
+					return std::unexpected(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+				}
+			}
+
+			return {};
+		}
+
+		template <typename T>
+		std::expected<void, Error> members(const std::vector<T> &members)
+		{
+			for (auto &member : members) {
+				auto result = this->expect(member.name_index, { Tag::Utf8 });
+				if (result.has_value())
+					result = this->expect(member.descriptor_index, { Tag::Utf8 });
+				if (result.has_value())
+					result = this->attributes(member.attributes);
+				if (!result.has_value())
+					return result;
+			}
+
+			return {};
+		}
+	private:
+		// Every index found in the body must point to an entry, with the right tag where the site fixes it
+		std::expected<void, Error> sites(const AttributeInfo &attribute)
+		{
+			auto sites = find_references(this->constant_pool, attribute);
+			if (!sites.has_value()) {
+				// Unknown layout, there is nothing to check
+				if (sites.error().kind == ErrorKind::Unsupported)
+					return {};
+				return std::unexpected(Error { ErrorKind::Malformed, attribute.attribute_name_index });
+			}
+
+			for (auto &site : sites.value()) {
+				const u1 *bytes = &attribute.info[site.offset];
+				u2 index = site.width == 1 ? bytes[0] : (bytes[0] << 8) | bytes[1];
+				if (index >= this->entries.size() || this->entries[index].tag == Tag::Empty ||
+				    (site.descriptor && this->entries[index].tag != Tag::Utf8)) {
+					ERR("Invalid constant pool reference to index '%hu'", index);
+					return std::unexpected(Error { ErrorKind::Malformed, index });
+				}
+			}
+
+			return {};
+		}
+
+		// Tags of the indices of the attributes with a fixed layout. Throws std::out_of_range.
+		std::expected<void, Error> attribute_tags(const AttributeInfo &attribute, const std::string &name)
+		{
+			if (name == "Code")
+				return this->code_tags(CodeAttr(attribute));
+
+			// A reader with no length is not bounds checked
+			if (attribute.info.empty())
+				return {};
+
+			BufReader reader = BufReader(attribute.info.data(), attribute.info.size());
+			auto expect = [&](std::initializer_list<Tag> tags) { return this->expect(reader.read_be<u2>(), tags); };
+			auto optional = [&](std::initializer_list<Tag> tags) -> std::expected<void, Error> {
+				u2 index = reader.read_be<u2>();
+				return index == 0 ? std::expected<void, Error>() : this->expect(index, tags);
+			};
+			auto table = [&](std::initializer_list<Tag> tags) -> std::expected<void, Error> {
+				for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+					auto result = expect(tags);
+					if (!result.has_value())
+						return result;
+				}
+				return {};
+			};
+
+			if (name == "ConstantValue")
+				return expect({ Tag::Integer, Tag::Float, Tag::Long, Tag::Double, Tag::String });
+			if (name == "Signature" || name == "SourceFile")
+				return expect({ Tag::Utf8 });
+			if (name == "NestHost" || name == "ModuleMainClass")
+				return expect({ Tag::Class });
+			if (name == "Exceptions" || name == "NestMembers" || name == "PermittedSubclasses")
+				return table({ Tag::Class });
+			if (name == "ModulePackages")
+				return table({ Tag::Package });
+
+			if (name == "EnclosingMethod") {
+				auto result = expect({ Tag::Class });
+				if (result.has_value())
+					result = optional({ Tag::NameAndType });
+				return result;
+			}
+
+			if (name == "InnerClasses") {
+				for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+					auto result = expect({ Tag::Class }); // inner_class_info
+					if (result.has_value())
+						result = optional({ Tag::Class }); // outer_class_info
+					if (result.has_value())
+						result = optional({ Tag::Utf8 }); // inner_name
+					if (!result.has_value())
+						return result;
+					reader.skip(sizeof(u2)); // inner_class_access_flags
+				}
+				return {};
+			}
+
+			if (name == "BootstrapMethods") {
+				for (u2 i = 0, count = reader.read_be<u2>(); i < count; ++i) {
+					auto result = expect({ Tag::MethodHandle });
+					if (result.has_value())
+						result = table({ Tag::Integer, Tag::Float, Tag::Long, Tag::Double, Tag::String,
+								 Tag::Class, Tag::MethodHandle, Tag::MethodType, Tag::Dynamic });
+					if (!result.has_value())
+						return result;
+				}
+				return {};
+			}
+
+			return {};
+		}
+
+		std::expected<void, Error> code_tags(const CodeAttr &code)
+		{
+			std::optional<Error> error;
+			std::span<const u1> bytecode = { &code.info[code.code_offset], code.code_length };
+			bool valid = for_each_instruction(bytecode, [&](size_t pc, Opcode opcode) {
+				auto expect = [&](std::initializer_list<Tag> tags) {
+					u2 index = (bytecode[pc + 1] << 8) | bytecode[pc + 2];
+					if (!error.has_value() && !this->is(index, tags))
+						error = Error { ErrorKind::Malformed, index };
+				};
+
+				switch (opcode) {
+				case Opcode::OP_ldc:
+					if (!error.has_value() && !this->is(bytecode[pc + 1], { Tag::Integer, Tag::Float, Tag::String, Tag::Class,
+												 Tag::MethodHandle, Tag::MethodType, Tag::Dynamic }))
+						error = Error { ErrorKind::Malformed, bytecode[pc + 1] };
+					break;
+				case Opcode::OP_ldc_w:
+					expect({ Tag::Integer, Tag::Float, Tag::String, Tag::Class, Tag::MethodHandle, Tag::MethodType, Tag::Dynamic });
+					break;
+				case Opcode::OP_ldc2_w:
+					expect({ Tag::Long, Tag::Double, Tag::Dynamic });
+					break;
+				case Opcode::OP_getstatic:
+				case Opcode::OP_putstatic:
+				case Opcode::OP_getfield:
+				case Opcode::OP_putfield:
+					expect({ Tag::Fieldref });
+					break;
+				case Opcode::OP_invokevirtual:
+					expect({ Tag::Methodref });
+					break;
+				case Opcode::OP_invokespecial:
+				case Opcode::OP_invokestatic:
+					expect({ Tag::Methodref, Tag::InterfaceMethodref });
+					break;
+				case Opcode::OP_invokeinterface:
+					expect({ Tag::InterfaceMethodref });
+					break;
+				case Opcode::OP_invokedynamic:
+					expect({ Tag::InvokeDynamic });
+					break;
+				case Opcode::OP_new:
+				case Opcode::OP_anewarray:
+				case Opcode::OP_checkcast:
+				case Opcode::OP_instanceof:
+				case Opcode::OP_multianewarray:
+					expect({ Tag::Class });
+					break;
+				default:
+					break;
+				}
+			});
+
+			if (!valid)
+				return std::unexpected(Error { ErrorKind::Malformed, code.attribute_name_index });
+			if (error.has_value()) {
+				ERR("Invalid constant pool reference to index '%zu'", error.value().offset);
+				return std::unexpected(error.value());
+			}
+			return {};
+		}
+
+		template <typename T>
+		inline const T &info(u2 index)
+		{
+			return std::get<T>(this->entries[index].info);
+		}
+
+		std::expected<void, Error> entry(u2 index)
+		{
+			using Entry = ConstantPoolEntry;
+
+			auto refs = [&](u2 class_index, u2 name_and_type_index) {
+				auto result = this->expect(class_index, { Tag::Class });
+				if (result.has_value())
+					result = this->expect(name_and_type_index, { Tag::NameAndType });
+				return result;
+			};
+
+			switch (this->entries[index].tag) {
+			case Tag::Utf8:
+			case Tag::Integer:
+			case Tag::Float:
+			case Tag::Long:
+			case Tag::Double:
+				return {};
+			case Tag::Class:
+				return this->expect(this->info<Entry::ClassInfo>(index).name_index, { Tag::Utf8 });
+			case Tag::Fieldref:
+				return refs(this->info<Entry::FieldrefInfo>(index).class_index,
+					    this->info<Entry::FieldrefInfo>(index).name_and_type_index);
+			case Tag::Methodref:
+				return refs(this->info<Entry::MethodrefInfo>(index).class_index,
+					    this->info<Entry::MethodrefInfo>(index).name_and_type_index);
+			case Tag::InterfaceMethodref:
+				return refs(this->info<Entry::InterfaceMethodrefInfo>(index).class_index,
+					    this->info<Entry::InterfaceMethodrefInfo>(index).name_and_type_index);
+			case Tag::String:
+				return this->expect(this->info<Entry::StringInfo>(index).string_index, { Tag::Utf8 });
+			case Tag::NameAndType: {
+				auto result = this->expect(this->info<Entry::NameAndTypeInfo>(index).name_index, { Tag::Utf8 });
+				if (result.has_value())
+					result = this->expect(this->info<Entry::NameAndTypeInfo>(index).descriptor_index, { Tag::Utf8 });
+				return result;
+			}
+			case Tag::MethodHandle: {
+				auto &info = this->info<Entry::MethodHandleInfo>(index);
+				// REF_getField to REF_putStatic point to fields, the rest to methods
+				if (info.reference_kind >= 1 && info.reference_kind <= 4)
+					return this->expect(info.reference_index, { Tag::Fieldref });
+				if (info.reference_kind >= 5 && info.reference_kind <= 9)
+					return this->expect(info.reference_index, { Tag::Methodref, Tag::InterfaceMethodref });
+				return std::unexpected(Error { ErrorKind::Malformed, index });
+			}
+			case Tag::MethodType:
+				return this->expect(this->info<Entry::MethodTypeInfo>(index).descriptor_index, { Tag::Utf8 });
+			case Tag::Dynamic:
+				return this->expect(this->info<Entry::DynamicInfo>(index).name_and_type_index, { Tag::NameAndType });
+			case Tag::InvokeDynamic:
+				return this->expect(this->info<Entry::InvokeDynamicInfo>(index).name_and_type_index, { Tag::NameAndType });
+			case Tag::Module:
+				return this->expect(this->info<Entry::ModuleInfo>(index).name_index, { Tag::Utf8 });
+			case Tag::Package:
+				return this->expect(this->info<Entry::PackageInfo>(index).name_index, { Tag::Utf8 });
+			default:
+				// Empty slots are only allowed after wide entries
+				return std::unexpected(Error { ErrorKind::Malformed, index });
+			}
+		}
+	};
+}
+
+std::expected<ValidatedConstantPool, Error> jcfp::validate(ClassFile &classfile)
+{
+	LOG("Validating ClassFile...");
+
+	Validator validator = Validator(classfile);
+	auto result = validator.constant_pool_entries();
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	result = validator.expect(classfile.this_class, { Tag::Class });
+	if (result.has_value() && classfile.super_class != 0)
+		result = validator.expect(classfile.super_class, { Tag::Class });
+	for (u2 interface : classfile.interfaces) {
+		if (result.has_value())
+			result = validator.expect(interface, { Tag::Class });
+	}
+
+	if (result.has_value())
+		result = validator.members(classfile.fields);
+	if (result.has_value())
+		result = validator.members(classfile.methods);
+	if (result.has_value())
+		result = validator.attributes(classfile.attributes);
+	if (!result.has_value())
+		return std::unexpected(result.error());
+
+	LOG("ClassFile validated successfully");
+
+	return ValidatedConstantPool(classfile.constant_pool.get_entries());
+}
@@ -1,9 +1,84 @@
 #include <jcfp/jcfp.hpp>
+#include <jcfp/event_parser.hpp>
+#include <jcfp/incremental_parser.hpp>
+#include <jcfp/sink.hpp>
+#include <jcfp/jar_writer.hpp>
+#include <jcfp/interner.hpp>
+#include <jcfp/class_hierarchy.hpp>
+#include <jcfp/reference_graph.hpp>
+#include <jcfp/references.hpp>
+#include <jcfp/shrinker.hpp>
+#include <jcfp/strip.hpp>
+#include <jcfp/synthetic.hpp>
+#include <jcfp/trace.hpp>
+#include <jcfp/validator.hpp>
+#include <jcfp/frozen.hpp>
+#include <jcfp/parallel.hpp>
+#include <jcfp/pipeline.hpp>
+#include <jcfp/remapper.hpp>
+#include <jcfp/fingerprint.hpp>
+#include <jcfp/diff.hpp>
 #include <iostream>
 #include <algorithm>
 
 using namespace jcfp;
 
+struct CountingHandler {
+        size_t constants = 0;
+        size_t fields = 0;
+        size_t methods = 0;
+        size_t class_attributes = 0;
+        size_t length = 0;
+
+        void on_constant(u2, const ConstantPoolEntry &) { ++constants; }
+        void on_field(u2, const MemberHeader &) { ++fields; }
+        void on_method(u2, const MemberHeader &) { ++methods; }
+        void on_attribute(AttributeOwner owner, u2, std::span<const u1>)
+        {
+                if (owner.kind == AttributeOwner::Class)
+                        ++class_attributes;
+        }
+        void on_end(size_t length) { this->length = length; }
+};
+
+// Counts the methods and the method calls seen by a Pipeline
+struct InvokeCounterPass : public Pass {
+        size_t methods = 0;
+        size_t invokes = 0;
+
+        u4 interests() const override { return INTEREST_MEMBERS | INTEREST_BYTECODE; }
+        std::bitset<256> opcodes() const override
+        {
+                std::bitset<256> opcodes;
+                opcodes.set(static_cast<u1>(Opcode::OP_invokevirtual));
+                opcodes.set(static_cast<u1>(Opcode::OP_invokespecial));
+                opcodes.set(static_cast<u1>(Opcode::OP_invokestatic));
+                return opcodes;
+        }
+        void on_method(PassContext &, MethodInfo &) override { ++methods; }
+        void on_instruction(PassContext &, std::span<u1>, size_t, Opcode) override { ++invokes; }
+};
+
+// Builds an empty class with the given supertypes
+static ClassFile make_class(std::string name, std::string super_class, std::vector<std::string> interfaces,
+                            AccessFlags access_flags = ACC_PUBLIC)
+{
+        ConstantPool constant_pool = ConstantPool({ ConstantPoolEntry() });
+        auto add_class = [&](std::string class_name) {
+                u2 name_index = constant_pool.push_entry(ConstantPoolEntry::Utf8Info { std::move(class_name) });
+                return constant_pool.push_entry(ConstantPoolEntry::ClassInfo { name_index });
+        };
+
+        u2 this_class = add_class(name);
+        u2 super_index = super_class.empty() ? 0 : add_class(super_class);
+        std::vector<u2> interface_indices;
+        for (auto &iface : interfaces)
+                interface_indices.push_back(add_class(iface));
+
+        return ClassFile(JCFP_CLASSFILE_MAGIC, 0, static_cast<MajorVersion>(52), std::move(constant_pool),
+                         access_flags, this_class, super_index, std::move(interface_indices), {}, {}, {});
+}
+
 int main()
 {
         u1 buf[10240];
@@ -131,5 +206,795 @@ int main()
 
         std::cout << "SourceFile length: " << cf.find_attribute("SourceFile").value().info.size() << std::endl;
 
+        std::cout << std::endl;
+        std::cout << "Selective parsing test" << std::endl;
+        ParseOptions options;
+        options.flags = PARSE_FIELDS | PARSE_METHODS | PARSE_CLASS_ATTRIBUTES;
+        options.attribute_names = { "SourceFile" };
+        auto partial_result = ClassFile::parse(buf, size, options);
+        if (!partial_result.has_value()) {
+                std::cerr << "Failed to parse ClassFile selectively" << std::endl;
+                return 1;
+        }
+        auto &partial = partial_result.value();
+        bool method_attrs_skipped = true;
+        for (auto &method : partial.methods) {
+                if (!method.attributes.empty())
+                        method_attrs_skipped = false;
+        }
+        verify = partial.fields.size() == cf.fields.size() &&
+                 partial.methods.size() == cf.methods.size() &&
+                 method_attrs_skipped &&
+                 partial.get_attribute_names() == std::vector<std::string> { "SourceFile" };
+        // The name of the last attribute (SourceFile) points to a Class entry
+        std::vector<u1> bad_name = std::vector<u1>(buf, buf + size);
+        bad_name[size - 8] = 0;
+        bad_name[size - 7] = 2;
+        auto bad_name_result = ClassFile::parse(bad_name, options);
+        IncrementalParser bad_name_parser = IncrementalParser(options);
+        verify = verify && cf.constant_pool.get_tag(2) != ConstantPoolEntry::Tag::Utf8 &&
+                 !bad_name_result.has_value() && bad_name_result.error().kind == ErrorKind::Malformed &&
+                 !bad_name_parser.feed(bad_name.data(), bad_name.size()).has_value();
+        std::cout << "Selective Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Event parser test" << std::endl;
+        CountingHandler handler;
+        size_t wide_entries = 0;
+        for (auto &entry : cf.constant_pool.get_entries()) {
+                if (entry.is_wide_entry())
+                        ++wide_entries;
+        }
+        verify = parse_events(buf, size, handler).has_value() &&
+                 handler.constants == cf.constant_pool.count() - 1 - wide_entries &&
+                 handler.fields == cf.fields.size() &&
+                 handler.methods == cf.methods.size() &&
+                 handler.class_attributes == cf.attributes.size() &&
+                 handler.length == size;
+        // A constant pool with a single entry of tag 0
+        std::vector<u1> empty_tag = { 0xCA, 0xFE, 0xBA, 0xBE, 0, 0, 0, 52, 0, 2, 0 };
+        auto empty_tag_events = parse_events(empty_tag.data(), empty_tag.size(), handler);
+        auto empty_tag_class = ClassFile::parse(empty_tag);
+        verify = verify && !empty_tag_events.has_value() && empty_tag_events.error().kind == ErrorKind::InvalidTag &&
+                 !empty_tag_class.has_value() && empty_tag_class.error().kind == ErrorKind::InvalidTag;
+        std::cout << "Events Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Incremental parser test" << std::endl;
+        IncrementalParser parser;
+        std::expected<FeedStatus, Error> status = FeedStatus::NeedMoreData;
+        for (size_t i = 0; i < size && status.has_value() && status.value() == FeedStatus::NeedMoreData; i += 7) {
+                status = parser.feed(&buf[i], std::min(static_cast<size_t>(7), size - i));
+        }
+        auto incremental = parser.take();
+        verify = status.has_value() && status.value() == FeedStatus::Done &&
+                 incremental.has_value() && incremental.value().encode() == std::vector<u1>(buf, buf + size);
+        IncrementalParser empty_tag_parser;
+        options = ParseOptions();
+        options.flags |= PARSE_RETAIN_SOURCE;
+        IncrementalParser retaining_parser = IncrementalParser(options);
+        auto retaining_status = retaining_parser.feed(buf, size);
+        verify = verify && !empty_tag_parser.feed(empty_tag.data(), empty_tag.size()).has_value() &&
+                 !retaining_status.has_value() && retaining_status.error().kind == ErrorKind::Unsupported;
+        std::cout << "Incremental Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Constant pool tags test" << std::endl;
+        ConstantPool pool;
+        pool.push_entry(ConstantPoolEntry());
+        u2 name = pool.push_entry(ConstantPoolEntry::Utf8Info { "java.base" });
+        pool.push_entry(ConstantPoolEntry(ConstantPoolEntry::EntryVariant(ConstantPoolEntry::MethodTypeInfo { name })));
+        pool.push_entry(ConstantPoolEntry::LongInfo { 1, 2 });
+        pool.push_entry(ConstantPoolEntry::DynamicInfo { 0, name });
+        pool.push_entry(ConstantPoolEntry::ModuleInfo { name });
+        pool.push_entry(ConstantPoolEntry::PackageInfo { name });
+        std::vector<u1> pool_bytes = pool.encode();
+        auto pool_result = ConstantPool::parse(pool_bytes);
+        verify = pool_result.has_value() && pool_result.value().encode() == pool_bytes &&
+                 pool_result.value().get_tag(2) == ConstantPoolEntry::MethodType &&
+                 pool_result.value().get_tag(5) == ConstantPoolEntry::Dynamic &&
+                 pool_result.value().get_tag(7) == ConstantPoolEntry::Package;
+        pool_bytes[2] = 2; // Invalid tag
+        verify = verify && !ConstantPool::parse(pool_bytes).has_value();
+        std::cout << "Tags Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Lazy constant pool test" << std::endl;
+        options = ParseOptions();
+        options.flags |= PARSE_LAZY_CONSTANT_POOL;
+        auto lazy_result = ClassFile::parse(buf, size, options);
+        if (!lazy_result.has_value()) {
+                std::cerr << "Failed to parse ClassFile lazily" << std::endl;
+                return 1;
+        }
+        auto &lazy = lazy_result.value();
+        verify = lazy.constant_pool.is_lazy_entry(lazy.this_class) && lazy.encode() == std::vector<u1>(buf, buf + size);
+        auto &this_class = lazy.constant_pool.get<ConstantPoolEntry::ClassInfo>(lazy.this_class);
+        verify = verify && !lazy.constant_pool.is_lazy_entry(lazy.this_class) &&
+                 this_class.name_index == cf.constant_pool.get<ConstantPoolEntry::ClassInfo>(cf.this_class).name_index;
+        lazy.constant_pool.insert_entry(2, entry);
+        lazy.relocate(+1, 2);
+        lazy.constant_pool.remove_entry(2);
+        lazy.relocate(-1, 2);
+        verify = verify && lazy.encode() == std::vector<u1>(buf, buf + size);
+        std::cout << "Lazy Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Dirty tracking test" << std::endl;
+        options = ParseOptions();
+        options.flags |= PARSE_RETAIN_SOURCE;
+        auto retained_result = ClassFile::parse(buf, size, options);
+        if (!retained_result.has_value()) {
+                std::cerr << "Failed to parse ClassFile with source" << std::endl;
+                return 1;
+        }
+        auto &retained = retained_result.value();
+        verify = retained.encode() == std::vector<u1>(buf, buf + size);
+        retained.methods[0].access_flags = ACC_PRIVATE;
+        retained.methods[0].mark_dirty();
+        ClassFile modified = cf;
+        modified.methods[0].access_flags = ACC_PRIVATE;
+        verify = verify && retained.encode() == modified.encode();
+        retained.constant_pool.insert_entry(2, entry);
+        retained.relocate(+1, 2);
+        modified.constant_pool.insert_entry(2, entry);
+        modified.relocate(+1, 2);
+        verify = verify && retained.encode() == modified.encode();
+        // Filtered out attributes must not come back from the source
+        options.attribute_names = { "Code" };
+        auto filtered_retained = ClassFile::parse(buf, size, options);
+        options.flags &= ~PARSE_RETAIN_SOURCE;
+        auto filtered = ClassFile::parse(buf, size, options);
+        verify = verify && filtered_retained.has_value() && filtered.has_value() &&
+                 filtered_retained.value().attributes.empty() &&
+                 filtered_retained.value().encode() == filtered.value().encode();
+        // A member moved to another class can't be copied from its old source
+        options = ParseOptions();
+        options.flags |= PARSE_RETAIN_SOURCE;
+        ClassFile donor = ClassFile::parse(buf, size, options).value();
+        ClassFile host = ClassFile::parse(make_class("Host", "java/lang/Object", {}).encode(), options).value();
+        host.methods.push_back(donor.methods[1]);
+        ClassFile rebuilt_host = host;
+        rebuilt_host.mark_dirty();
+        verify = verify && host.encode() == rebuilt_host.encode();
+        std::cout << "Dirty Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Sink test" << std::endl;
+        CountingSink counting_sink;
+        cf.encode(counting_sink);
+        Fnv1aSink encoded_hash;
+        cf.encode(encoded_hash);
+        Fnv1aSink original_hash;
+        original_hash.write_bytes(buf, size);
+        verify = counting_sink.size() == size && encoded_hash.digest() == original_hash.digest();
+        FILE *tmp = tmpfile();
+        {
+                FdSink fd_sink(fileno(tmp));
+                cf.encode(fd_sink);
+                verify = verify && fd_sink.flush();
+        }
+        std::vector<u1> written(size);
+        rewind(tmp);
+        verify = verify && fread(written.data(), 1, size, tmp) == size && written == std::vector<u1>(buf, buf + size);
+        fclose(tmp);
+        std::cout << "Sink Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "JAR writer test" << std::endl;
+        JarWriter jar_writer(JarWriter::Compression::Store);
+        jar_writer.add("Dummy.class", cf);
+        jar_writer.add("Copy.class", std::vector<u1>(buf, buf + size));
+        auto jar = jar_writer.finish();
+        verify = jar.has_value();
+        if (verify) {
+                auto &bytes = jar.value();
+                size_t data_offset = 30 + std::string("Dummy.class").size();
+                verify = bytes.size() > data_offset + size &&
+                         std::equal(buf, buf + size, bytes.begin() + data_offset) &&
+                         bytes[bytes.size() - 22] == 0x50 && bytes[bytes.size() - 22 + 1] == 0x4b &&
+                         bytes[bytes.size() - 22 + 10] == 2; // Total entries
+                f = fopen("Dummy.jar", "w");
+                fwrite(bytes.data(), 1, bytes.size(), f);
+                fclose(f);
+        }
+        // A name that doesn't fit in the u2 length fails without touching the entries
+        JarWriter long_name_writer(JarWriter::Compression::Store);
+        long_name_writer.add("Dummy.class", cf);
+        long_name_writer.add(std::string(0x10000, 'a'), std::vector<u1>(buf, buf + size));
+        auto long_name_jar = long_name_writer.finish();
+        verify = verify && !long_name_jar.has_value() && long_name_jar.error().kind == ErrorKind::Unsupported &&
+                 long_name_writer.count() == 2;
+        std::cout << "JAR Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "String interner test" << std::endl;
+        StringInterner interner;
+        options = ParseOptions();
+        options.interner = &interner;
+        auto interned_a = ClassFile::parse(buf, size, options);
+        options.flags |= PARSE_LAZY_CONSTANT_POOL;
+        auto interned_b = ClassFile::parse(buf, size, options);
+        verify = interned_a.has_value() && interned_b.has_value();
+        if (verify) {
+                auto &name_a = interned_a.value().constant_pool.get<ConstantPoolEntry::Utf8Info>(cf.methods[0].name_index).bytes;
+                auto &name_b = interned_b.value().constant_pool.get<ConstantPoolEntry::Utf8Info>(cf.methods[0].name_index).bytes;
+                verify = name_a.is_interned() && &name_a.str() == &name_b.str() &&
+                         interner.intern("<init>") == &name_a.str() &&
+                         interned_a.value().encode() == std::vector<u1>(buf, buf + size) &&
+                         interned_b.value().encode() == std::vector<u1>(buf, buf + size);
+        }
+        std::cout << "Interner Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Class hierarchy test" << std::endl;
+        std::vector<ClassFile> classes;
+        classes.push_back(make_class("java/lang/Object", "", {}));
+        classes.push_back(make_class("A", "java/lang/Object", { "I" }));
+        classes.push_back(make_class("B", "A", { "J" }));
+        classes.push_back(make_class("C", "A", {}));
+        classes.push_back(make_class("J", "java/lang/Object", { "I" }, static_cast<AccessFlags>(ACC_INTERFACE | ACC_ABSTRACT)));
+        classes.push_back(make_class("D", "Missing", {}));
+        auto hierarchy = ClassHierarchy::build(classes, &interner, 2);
+        auto class_id = [&](const char *name) { return hierarchy.find(name).value(); };
+        verify = hierarchy.size() == 8 && !hierarchy.is_loaded(class_id("I")) && hierarchy.is_interface(class_id("I")) &&
+                 hierarchy.is_subtype(class_id("B"), class_id("A")) &&
+                 hierarchy.is_subtype(class_id("B"), class_id("java/lang/Object")) &&
+                 hierarchy.is_subtype(class_id("B"), class_id("I")) &&
+                 hierarchy.is_subtype(class_id("J"), class_id("I")) &&
+                 !hierarchy.is_subtype(class_id("A"), class_id("B")) &&
+                 !hierarchy.is_subtype(class_id("C"), class_id("J")) &&
+                 !hierarchy.is_subtype(class_id("D"), class_id("java/lang/Object")) &&
+                 hierarchy.subtypes(class_id("A")).size() == 2 &&
+                 hierarchy.supertypes(class_id("B")).size() == 2 &&
+                 hierarchy.all_interfaces(class_id("B")).size() == 2 &&
+                 hierarchy.common_super_class(class_id("B"), class_id("C")) == class_id("A") &&
+                 hierarchy.common_super_class(class_id("J"), class_id("C")) == class_id("java/lang/Object") &&
+                 !hierarchy.common_super_class(class_id("D"), class_id("C")).has_value();
+        std::cout << "Hierarchy Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Reference graph test" << std::endl;
+        std::vector<ClassFile> graph_classes = { cf, make_class("Other", "Dummy", {}) };
+        auto graph = ReferenceGraph::build(graph_classes, nullptr, 2);
+        auto init = graph.find("Dummy.<init>:()V");
+        auto main_method = graph.find("Dummy.main:([Ljava/lang/String;)V");
+        auto println = graph.find("java/io/PrintStream.println:(Ljava/lang/String;)V");
+        auto dummy = graph.find("Dummy");
+        verify = init && main_method && println && dummy &&
+                 graph.kind(init.value()) == ReferenceGraph::SymbolKind::Method &&
+                 graph.callees(init.value()).size() == 8 &&
+                 graph.callees(main_method.value()).size() == 2 &&
+                 graph.callers(println.value()).size() == 1 &&
+                 graph.callers(println.value())[0] == main_method.value() &&
+                 graph.referenced_classes(dummy.value()).size() == 6 &&
+                 graph.referencing_classes(dummy.value()).size() == 1;
+        std::cout << "Graph Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Constant pool compaction test" << std::endl;
+        ClassFile padded = cf;
+        padded.constant_pool.push_entry(entry);
+        padded.constant_pool.push_entry(ConstantPoolEntry(ConstantPoolEntry::LongInfo { 0, 1 }));
+        auto &main_code = padded.methods[1].attributes[0];
+        main_code.attribute_name_index = padded.constant_pool.push_entry(padded.constant_pool.get_entry(main_code.attribute_name_index));
+        padded.mark_dirty();
+        auto removed = compact_constant_pool(padded);
+        verify = removed.has_value() && removed.value() == 4 &&
+                 padded.encode() == std::vector<u1>(buf, buf + size);
+        std::cout << "Compaction Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Shrinker test" << std::endl;
+        std::vector<ClassFile> shrunk_classes = { cf, make_class("Other", "Dummy", {}), make_class("Unused", "java/lang/Object", {}) };
+        Shrinker shrinker;
+        shrinker.keep_class("Dummy");
+        auto shrink_stats = shrinker.shrink(shrunk_classes, 2);
+        verify = shrink_stats.has_value() && shrink_stats.value().classes_removed == 2 &&
+                 shrunk_classes.size() == 1 && shrunk_classes[0].encode() == std::vector<u1>(buf, buf + size);
+
+        shrunk_classes = { cf };
+        Shrinker main_shrinker;
+        main_shrinker.keep_member("Dummy.main:([Ljava/lang/String;)V");
+        shrink_stats = main_shrinker.shrink(shrunk_classes, 2);
+        verify = verify && shrink_stats.has_value() &&
+                 shrink_stats.value().fields_removed == 4 && shrink_stats.value().methods_removed == 1 &&
+                 shrink_stats.value().constants_removed > 0 &&
+                 shrunk_classes[0].methods.size() == 1 &&
+                 ClassFile::parse(shrunk_classes[0].encode()).has_value();
+        // Attributes with an unknown layout can't be compacted, so nothing must change
+        ClassFile opaque = cf;
+        u2 opaque_name = opaque.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "Opaque" });
+        opaque.attributes.push_back(AttributeInfo(opaque_name, { 0, 1 }));
+        opaque.mark_attributes_dirty();
+        shrunk_classes = { opaque, make_class("Unused", "java/lang/Object", {}) };
+        shrink_stats = main_shrinker.shrink(shrunk_classes, 2);
+        verify = verify && !shrink_stats.has_value() && shrink_stats.error().kind == ErrorKind::Unsupported &&
+                 shrunk_classes.size() == 2 && shrunk_classes[0].encode() == opaque.encode();
+        std::cout << "Shrinker Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Constant pool import test" << std::endl;
+        ClassFile target = make_class("Target", "java/lang/Object", {});
+        AttributeInfo imported_code = cf.methods[1].attributes[0];
+        auto imported = import_attribute(target.constant_pool, cf.constant_pool, imported_code);
+        u2 target_count = target.constant_pool.count();
+        AttributeInfo reimported_code = cf.methods[1].attributes[0];
+        auto reimported = import_attribute(target.constant_pool, cf.constant_pool, reimported_code);
+        auto imported_sites = find_references(target.constant_pool, imported_code);
+        verify = imported.has_value() && reimported.has_value() && imported_sites.has_value() &&
+                 target.constant_pool.count() == target_count && reimported_code.info == imported_code.info &&
+                 *target.constant_pool.find_utf8(imported_code.attribute_name_index) == "Code";
+        if (verify) {
+                // Every operand must name the same constant as in the original class
+                auto original_sites = find_references(cf.constant_pool, cf.methods[1].attributes[0]).value();
+                auto &original_code = cf.methods[1].attributes[0];
+                verify = original_sites.size() == imported_sites.value().size();
+                for (size_t i = 0; verify && i < original_sites.size(); ++i) {
+                        auto read_index = [](AttributeInfo &attribute, ReferenceSite site) -> u2 {
+                                const u1 *bytes = &attribute.info[site.offset];
+                                return site.width == 1 ? bytes[0] : (bytes[0] << 8) | bytes[1];
+                        };
+                        auto original_entry = cf.constant_pool.get_entry(read_index(original_code, original_sites[i]));
+                        auto imported_entry = target.constant_pool.get_entry(read_index(imported_code, imported_sites.value()[i]));
+                        verify = original_entry.tag == imported_entry.tag;
+                }
+                // `main` is getstatic, ldc, invokevirtual println, return
+                auto println = target.constant_pool.find_member_ref((imported_code.info[8 + 6] << 8) | imported_code.info[8 + 7]);
+                verify = verify && println && *println.value().name == "println";
+        }
+        // An invokedynamic site brings its bootstrap method along, the target already has an unrelated one
+        auto add_handle = [](ClassFile &classfile, std::string owner, std::string name) {
+                auto &pool = classfile.constant_pool;
+                u2 class_index = pool.push_entry(ConstantPoolEntry::ClassInfo { pool.push_entry(ConstantPoolEntry::Utf8Info { owner }) });
+                u2 name_and_type = pool.push_entry(ConstantPoolEntry::NameAndTypeInfo {
+                        pool.push_entry(ConstantPoolEntry::Utf8Info { name }), pool.push_entry(ConstantPoolEntry::Utf8Info { "()V" }) });
+                u2 method_ref = pool.push_entry(ConstantPoolEntry::MethodrefInfo { class_index, name_and_type });
+                return pool.push_entry(ConstantPoolEntry::MethodHandleInfo { 6, method_ref }); // REF_invokeStatic
+        };
+        auto add_bootstrap_methods = [](ClassFile &classfile, std::vector<u1> info) {
+                u2 name_index = classfile.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "BootstrapMethods" });
+                classfile.attributes.push_back(AttributeInfo(name_index, std::move(info)));
+        };
+        ClassFile lambdas = make_class("Lambdas", "java/lang/Object", {});
+        u2 unused_handle = add_handle(lambdas, "Boot", "a");
+        u2 lambda_handle = add_handle(lambdas, "Boot", "b");
+        u2 argument = lambdas.constant_pool.push_entry(ConstantPoolEntry::StringInfo {
+                lambdas.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "arg" }) });
+        u2 call_site = lambdas.constant_pool.push_entry(ConstantPoolEntry::InvokeDynamicInfo { 1, lambdas.constant_pool.push_entry(
+                ConstantPoolEntry::NameAndTypeInfo { lambdas.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "run" }),
+                                                     lambdas.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "()Ljava/lang/Runnable;" }) }) });
+        add_bootstrap_methods(lambdas, { 0, 2, 0, static_cast<u1>(unused_handle), 0, 0,
+                                         0, static_cast<u1>(lambda_handle), 0, 1, 0, static_cast<u1>(argument) });
+        u2 code_name = lambdas.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "Code" });
+        AttributeInfo lambda_code = AttributeInfo(code_name, { 0, 1, 0, 0, 0, 0, 0, 5, 0xba, 0, static_cast<u1>(call_site), 0, 0, 0, 0, 0, 0 });
+        ClassFile lambda_target = make_class("LambdaTarget", "java/lang/Object", {});
+        add_bootstrap_methods(lambda_target, { 0, 1, 0, static_cast<u1>(add_handle(lambda_target, "Other", "c")), 0, 0 });
+        AttributeInfo moved_code = lambda_code;
+        ConstantPoolImporter lambda_importer = ConstantPoolImporter(lambda_target, lambdas);
+        auto moved = lambda_importer.import_attribute(moved_code);
+        AttributeInfo moved_again = lambda_code;
+        auto moved_again_result = lambda_importer.import_attribute(moved_again);
+        // A new importer finds the bootstrap method already in the target
+        AttributeInfo moved_fresh = lambda_code;
+        auto moved_fresh_result = import_attribute(lambda_target, lambdas, moved_fresh);
+        AttributeInfo pool_only = lambda_code;
+        auto pool_only_result = import_attribute(lambda_target.constant_pool, lambdas.constant_pool, pool_only);
+        verify = verify && moved.has_value() && moved_again_result.has_value() && moved_again.info == moved_code.info &&
+                 moved_fresh_result.has_value() && moved_fresh.info == moved_code.info &&
+                 !pool_only_result.has_value() && pool_only_result.error().kind == ErrorKind::Unsupported &&
+                 pool_only.info == lambda_code.info;
+        if (verify) {
+                auto &pool = lambda_target.constant_pool;
+                auto &moved_site = pool.get<ConstantPoolEntry::InvokeDynamicInfo>((moved_code.info[9] << 8) | moved_code.info[10]);
+                auto bootstrap_methods = lambda_target.find_attribute("BootstrapMethods").value().info;
+                // count, then the unrelated method (2 u2), then the imported one
+                u2 handle = (bootstrap_methods[6] << 8) | bootstrap_methods[7];
+                u2 moved_argument = (bootstrap_methods[10] << 8) | bootstrap_methods[11];
+                auto lambda_ref = pool.find_member_ref(pool.get<ConstantPoolEntry::MethodHandleInfo>(handle).reference_index);
+                verify = moved_site.bootstrap_method_attr_index == 1 && bootstrap_methods.size() == 12 && bootstrap_methods[1] == 2 &&
+                         lambda_ref && *lambda_ref.value().name == "b" &&
+                         *pool.find_utf8(pool.get<ConstantPoolEntry::StringInfo>(moved_argument).string_index) == "arg";
+        }
+        std::cout << "Import Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Debug attribute stripping test" << std::endl;
+        ByteStream stripped_stream;
+        auto stripped_count = strip_attributes(buf, size, stripped_stream);
+        auto stripped = stripped_stream.collect();
+        auto stripped_cf = ClassFile::parse(stripped);
+        ByteStream restripped_stream;
+        auto restripped_count = strip_attributes(stripped.data(), stripped.size(), restripped_stream);
+        // Each `Code` attribute loses a LineNumberTable with 2 lines (16 bytes)
+        verify = stripped_count.has_value() && stripped_count.value() == 2 && stripped.size() == size - 32 &&
+                 stripped_cf.has_value() && stripped_cf.value().attributes.size() == 1 &&
+                 CodeAttr(stripped_cf.value().methods[1].attributes[0]).attributes.empty() &&
+                 restripped_count.has_value() && restripped_count.value() == 0 &&
+                 restripped_stream.collect() == stripped &&
+                 !strip_attributes(buf, size - 10, restripped_stream).has_value();
+        std::cout << "Strip Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Synthetic class test" << std::endl;
+        SyntheticShape shape;
+        shape.seed = 42;
+        shape.constant_pool_count = 0xFFFF;
+        shape.wide_entries = 0x1000;
+        shape.fields = 2000;
+        shape.code_length = 0xFFFF;
+        shape.annotation_depth = 32;
+        shape.methods = 4; // 64 KiB of code each
+        auto synthetic = generate_class("Synthetic", shape);
+        auto synthetic_again = generate_class("Synthetic", shape);
+        verify = synthetic.has_value() && synthetic_again.has_value();
+        if (verify) {
+                auto synthetic_bytes = synthetic.value().encode();
+                auto reparsed = ClassFile::parse(synthetic_bytes);
+                auto annotation_sites = find_references(synthetic.value().constant_pool, synthetic.value().attributes[0]);
+                verify = synthetic_bytes == synthetic_again.value().encode() &&
+                         synthetic.value().constant_pool.count() == 0xFFFF &&
+                         reparsed.has_value() && reparsed.value().encode() == synthetic_bytes &&
+                         reparsed.value().fields.size() == 2000 &&
+                         CodeAttr(reparsed.value().methods[3].attributes[0]).code_length == 0xFFFF &&
+                         annotation_sites.has_value() && annotation_sites.value().size() == 32 * 2 - 1;
+        }
+        std::cout << "Synthetic Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Trace histogram test" << std::endl;
+        TraceHistogram histogram;
+        histogram.on_phase(TraceEvent { TracePhase::Fields, 100, 100, 0 });
+        histogram.on_phase(TraceEvent { TracePhase::Fields, 100, 105, 10 });
+        histogram.on_phase(TraceEvent { TracePhase::Fields, 100, 1100, 20 });
+        verify = histogram.count(TracePhase::Fields) == 3 && histogram.total_ns(TracePhase::Fields) == 1005 &&
+                 histogram.bytes(TracePhase::Fields) == 30 &&
+                 histogram.bucket(TracePhase::Fields, 0) == 1 && histogram.bucket(TracePhase::Fields, 2) == 1 &&
+                 histogram.bucket(TracePhase::Fields, 9) == 1 &&
+                 histogram.quantile_ns(TracePhase::Fields, 0.5) == 7 &&
+                 histogram.quantile_ns(TracePhase::Fields, 1.0) == 1023 &&
+                 histogram.quantile_ns(TracePhase::Methods, 0.5) == 0;
+#ifdef JCFP_TRACING
+        histogram.reset();
+        set_tracer(&histogram);
+        auto traced = ClassFile::parse(buf, size);
+        auto traced_bytes = traced.value().encode();
+        set_tracer(nullptr);
+        verify = verify && histogram.count(TracePhase::ConstantPool) == 1 && histogram.count(TracePhase::Attributes) == 1 &&
+                 histogram.bytes(TracePhase::Encode) == size &&
+                 histogram.bytes(TracePhase::ConstantPool) + histogram.bytes(TracePhase::Header) +
+                 histogram.bytes(TracePhase::Fields) + histogram.bytes(TracePhase::Methods) +
+                 histogram.bytes(TracePhase::Attributes) == size - 8;
+#endif
+        std::cout << "Trace Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Memory usage test" << std::endl;
+        ClassFile measured = ClassFile::parse(buf, size).value();
+        measured.attributes.reserve(16);
+        auto usage = measured.memory_usage();
+        measured.shrink_to_fit();
+        auto shrunk_usage = measured.memory_usage();
+        size_t attribute_bytes = 0;
+        for (auto &method : measured.methods)
+                attribute_bytes += method.attributes[0].info.size();
+        attribute_bytes += measured.attributes[0].info.size();
+        verify = usage.slack >= 15 * sizeof(AttributeInfo) && shrunk_usage.slack < usage.slack &&
+                 shrunk_usage.total() < usage.total() && shrunk_usage.attribute_blobs == attribute_bytes &&
+                 shrunk_usage.constant_pool_entries == measured.constant_pool.count() * sizeof(ConstantPoolEntry) &&
+                 shrunk_usage.utf8_payloads > 0 && shrunk_usage.source == 0 &&
+                 measured.encode() == std::vector<u1>(buf, buf + size);
+        std::cout << "Memory Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Validator test" << std::endl;
+        options = ParseOptions();
+        options.flags |= PARSE_LAZY_CONSTANT_POOL;
+        ClassFile validated = ClassFile::parse(buf, size, options).value();
+        auto validated_pool = validate(validated);
+        verify = validated_pool.has_value() && validated_pool->class_name(validated.this_class) == "Dummy";
+        for (u2 i = 1; verify && i < validated.constant_pool.count(); ++i) {
+                if (validated_pool->tag(i) != ConstantPoolEntry::Tag::Methodref)
+                        continue;
+                auto expected_ref = validated.constant_pool.find_member_ref(i);
+                auto member_ref = validated_pool->member_ref(i);
+                verify = expected_ref && *member_ref.class_name == *expected_ref->class_name &&
+                         *member_ref.name == *expected_ref->name && *member_ref.descriptor == *expected_ref->descriptor;
+        }
+        ClassFile invalid = make_class("A", "java/lang/Object", {});
+        invalid.super_class = 1; // Utf8 instead of Class
+        auto invalid_result = validate(invalid);
+        verify = verify && !invalid_result.has_value() && invalid_result.error().kind == ErrorKind::Malformed &&
+                 invalid_result.error().offset == 1;
+        // Indices inside attribute bodies are checked too: `main` invoking a Class, SourceFile naming a Class or nothing
+        ClassFile bad_operand = cf;
+        bad_operand.methods[1].attributes[0].info[8 + 6] = static_cast<u1>(cf.this_class >> 8);
+        bad_operand.methods[1].attributes[0].info[8 + 7] = static_cast<u1>(cf.this_class);
+        bad_operand.methods[1].mark_dirty();
+        auto bad_operand_result = validate(bad_operand);
+        ClassFile bad_source_file = cf;
+        auto &source_file = bad_source_file.attributes[0];
+        source_file.info = { static_cast<u1>(cf.this_class >> 8), static_cast<u1>(cf.this_class) };
+        auto bad_source_file_result = validate(bad_source_file);
+        source_file.info = { 0xFF, 0xFF };
+        auto missing_source_file_result = validate(bad_source_file);
+        verify = verify && *cf.constant_pool.find_utf8(source_file.attribute_name_index) == "SourceFile" &&
+                 !bad_operand_result.has_value() && bad_operand_result.error().offset == cf.this_class &&
+                 !bad_source_file_result.has_value() && bad_source_file_result.error().offset == cf.this_class &&
+                 !missing_source_file_result.has_value() && missing_source_file_result.error().offset == 0xFFFF;
+        std::cout << "Validator Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Frozen class test" << std::endl;
+        options = ParseOptions();
+        options.flags |= PARSE_LAZY_CONSTANT_POOL | PARSE_RETAIN_SOURCE;
+        const FrozenClassFile frozen = FrozenClassFile::freeze(ClassFile::parse(buf, size, options).value());
+        FrozenClassFile edited = frozen;
+        edited.edit_method(0).access_flags = static_cast<AccessFlags>(edited.methods[0]->access_flags | ACC_FINAL);
+        std::vector<u1> edited_bytes = edited.encode();
+        verify = frozen.encode() == std::vector<u1>(buf, buf + size) && frozen.methods.size() >= 2 &&
+                 !edited.methods[0].is_shared_with(frozen.methods[0]) &&
+                 edited.methods[1].is_shared_with(frozen.methods[1]) &&
+                 edited.constant_pool.is_shared_with(frozen.constant_pool) &&
+                 edited.attributes[0].is_shared_with(frozen.attributes[0]) &&
+                 !(frozen.methods[0]->access_flags & ACC_FINAL) && edited_bytes != frozen.encode() &&
+                 edited.thaw().encode() == edited_bytes;
+        std::vector<std::vector<u1>> clone_bytes(16);
+        parallel_for(clone_bytes.size(), [&](size_t i) {
+                FrozenClassFile clone = frozen;
+                clone.edit_method(0).access_flags = edited.methods[0]->access_flags;
+                clone_bytes[i] = clone.encode();
+        }, 4);
+        for (auto &bytes : clone_bytes)
+                verify = verify && bytes == edited_bytes;
+        std::cout << "Frozen Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Pipeline test" << std::endl;
+        std::vector<std::string_view> pipeline_strip_names(std::begin(debug_attributes), std::end(debug_attributes));
+        pipeline_strip_names.push_back("SourceFile");
+        ByteStream pipeline_expected_stream;
+        strip_attributes(buf, size, pipeline_expected_stream, pipeline_strip_names);
+        ClassFile pipeline_expected = ClassFile::parse(pipeline_expected_stream.collect()).value();
+        compact_constant_pool(pipeline_expected);
+        ClassFile pipelined = ClassFile::parse(buf, size).value();
+        auto invoke_counter = std::make_unique<InvokeCounterPass>();
+        InvokeCounterPass *counter = invoke_counter.get();
+        Pipeline pipeline;
+        pipeline.add<StripAttributesPass>(std::vector<std::string>(pipeline_strip_names.begin(), pipeline_strip_names.end()))
+                .add(std::move(invoke_counter));
+        auto pipeline_removed = pipeline.run(pipelined);
+        verify = pipeline_removed.has_value() && pipeline_removed.value() >= 3 && pipelined.attributes.empty() &&
+                 counter->methods == pipelined.methods.size() && counter->invokes > 0 &&
+                 pipelined.encode() == pipeline_expected.encode();
+        ClassFile unchanged = ClassFile::parse(buf, size).value();
+        Pipeline counting_pipeline;
+        counting_pipeline.add<InvokeCounterPass>();
+        auto unchanged_removed = counting_pipeline.run(unchanged);
+        verify = verify && unchanged_removed.has_value() && unchanged_removed.value() == 0 &&
+                 unchanged.encode() == std::vector<u1>(buf, buf + size);
+        std::cout << "Pipeline Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Remapper test" << std::endl;
+        Mapping mapping;
+        mapping.add_class("Dummy", "shaded/Dummy2");
+        mapping.add_package("java/io/", "shaded/io/");
+        mapping.add_member("Dummy.someNumber:Ljava/lang/Integer;", "a");
+        mapping.add_member("java/io/PrintStream.println:(Ljava/lang/String;)V", "print0");
+        Remapper remapper = Remapper(mapping);
+        ClassFile remapped = ClassFile::parse(buf, size).value();
+        // The "abc" literal now shares its Utf8 with the class name
+        u2 dummy_name_index = remapped.constant_pool.get<ConstantPoolEntry::ClassInfo>(remapped.this_class).name_index;
+        for (u2 i = 1; i < remapped.constant_pool.count(); ++i) {
+                if (remapped.constant_pool.get_tag(i) != ConstantPoolEntry::Tag::String)
+                        continue;
+                auto &literal = remapped.constant_pool.get<ConstantPoolEntry::StringInfo>(i);
+                if (*remapped.constant_pool.find_utf8(literal.string_index) == "abc")
+                        literal.string_index = dummy_name_index;
+        }
+        remapped.constant_pool.mark_dirty();
+        // @File(value = Reader.class, kind = File.X), and an EnclosingMethod with a remapped descriptor
+        auto utf8 = [&](std::string value) { return remapped.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { value }); };
+        auto be = [](u2 index) { return std::vector<u1> { static_cast<u1>(index >> 8), static_cast<u1>(index) }; };
+        u2 file_type = utf8("Ljava/io/File;");
+        std::vector<u1> annotations = { 0, 1 };
+        for (auto part : { be(file_type), be(2), be(utf8("value")), std::vector<u1> { 'c' }, be(utf8("Ljava/io/Reader;")),
+                           be(utf8("kind")), std::vector<u1> { 'e' }, be(file_type), be(utf8("X")) })
+                annotations.insert(annotations.end(), part.begin(), part.end());
+        size_t added_attributes = remapped.attributes.size();
+        remapped.attributes.push_back(AttributeInfo(utf8("RuntimeVisibleAnnotations"), annotations));
+        u2 enclosing_method = remapped.constant_pool.push_entry(ConstantPoolEntry::NameAndTypeInfo { utf8("run"), utf8("(Ljava/io/File;)V") });
+        std::vector<u1> enclosing = be(remapped.this_class);
+        for (u1 byte : be(enclosing_method))
+                enclosing.push_back(byte);
+        remapped.attributes.push_back(AttributeInfo(utf8("EnclosingMethod"), enclosing));
+        // record(File file), with the signature List<File>
+        std::vector<u1> record = { 0, 1 };
+        for (auto part : { be(utf8("file")), be(file_type), be(1), be(utf8("Signature")), std::vector<u1> { 0, 0, 0, 2 },
+                           be(utf8("Ljava/util/List<Ljava/io/File;>;")) })
+                record.insert(record.end(), part.begin(), part.end());
+        remapped.attributes.push_back(AttributeInfo(utf8("Record"), record));
+        remapped.mark_attributes_dirty();
+        auto remap_result = remapper.remap(remapped);
+        auto read_utf8 = [&](AttributeInfo &attribute, size_t offset) {
+                return *remapped.constant_pool.find_utf8((attribute.info[offset] << 8) | attribute.info[offset + 1]);
+        };
+        auto find_literal = [](ClassFile &classfile, std::string_view value) {
+                for (u2 i = 1; i < classfile.constant_pool.count(); ++i) {
+                        if (classfile.constant_pool.get_tag(i) == ConstantPoolEntry::Tag::String &&
+                            *classfile.constant_pool.find_utf8(classfile.constant_pool.get<ConstantPoolEntry::StringInfo>(i).string_index) == value)
+                                return true;
+                }
+                return false;
+        };
+        auto find_member_ref = [](ClassFile &classfile, std::string_view owner, std::string_view name, std::string_view descriptor) {
+                for (u2 i = 1; i < classfile.constant_pool.count(); ++i) {
+                        auto member_ref = classfile.constant_pool.find_member_ref(i);
+                        if (member_ref && *member_ref->class_name == owner && *member_ref->name == name &&
+                            *member_ref->descriptor == descriptor)
+                                return true;
+                }
+                return false;
+        };
+        verify = remap_result.has_value() &&
+                 *remapped.constant_pool.find_class_name(remapped.this_class) == "shaded/Dummy2" &&
+                 *remapped.constant_pool.find_utf8(remapped.fields[0].name_index) == "a" &&
+                 *remapped.constant_pool.find_utf8(remapped.fields[1].name_index) == "someBigNumber" &&
+                 find_literal(remapped, "Dummy") && !find_literal(remapped, "abc") &&
+                 find_member_ref(remapped, "shaded/io/PrintStream", "print0", "(Ljava/lang/String;)V") &&
+                 find_member_ref(remapped, "java/lang/System", "out", "Lshaded/io/PrintStream;") &&
+                 find_member_ref(remapped, "shaded/Dummy2", "a", "Ljava/lang/Integer;") &&
+                 read_utf8(remapped.attributes[added_attributes], 2) == "Lshaded/io/File;" &&
+                 read_utf8(remapped.attributes[added_attributes], 6) == "value" &&
+                 read_utf8(remapped.attributes[added_attributes], 9) == "Lshaded/io/Reader;" &&
+                 read_utf8(remapped.attributes[added_attributes], 14) == "Lshaded/io/File;" &&
+                 read_utf8(remapped.attributes[added_attributes], 16) == "X" &&
+                 *remapped.constant_pool.find_utf8(remapped.constant_pool.get<ConstantPoolEntry::NameAndTypeInfo>(
+                         (remapped.attributes[added_attributes + 1].info[2] << 8) |
+                         remapped.attributes[added_attributes + 1].info[3]).descriptor_index) == "(Lshaded/io/File;)V" &&
+                 read_utf8(remapped.attributes[added_attributes + 2], 2) == "file" &&
+                 read_utf8(remapped.attributes[added_attributes + 2], 4) == "Lshaded/io/File;" &&
+                 read_utf8(remapped.attributes[added_attributes + 2], 14) == "Ljava/util/List<Lshaded/io/File;>;" &&
+                 ClassFile::parse(remapped.encode()).has_value() && validate(remapped).has_value() &&
+                 remapper.map_descriptor("<T:Ljava/io/Reader;>(TT;[Ljava/io/File;)Ljava/util/List<+Ljava/io/File;>;^Ljava/io/IOException;") ==
+                 "<T:Lshaded/io/Reader;>(TT;[Lshaded/io/File;)Ljava/util/List<+Lshaded/io/File;>;^Lshaded/io/IOException;" &&
+                 remapper.map_class_name("[[Ljava/io/File;") == "[[Lshaded/io/File;" &&
+                 remapper.map_descriptor("(Ljava/io/File") == "(Ljava/io/File";
+        std::vector<ClassFile> classpath(8, ClassFile::parse(buf, size).value());
+        auto classpath_result = remapper.remap(classpath, 4);
+        verify = verify && classpath_result.has_value();
+        for (auto &classfile : classpath)
+                verify = verify && *classfile.constant_pool.find_class_name(classfile.this_class) == "shaded/Dummy2" &&
+                         classfile.encode() == classpath[0].encode();
+        std::cout << "Remapper Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Fingerprint test" << std::endl;
+        std::vector<u1> original_bytes = std::vector<u1>(buf, buf + size);
+        auto original_fingerprint = fingerprint(original_bytes);
+        // Swapping two entries changes every index, but not the structure
+        ClassFile swapped = ClassFile::parse(buf, size).value();
+        RemapTable swap_table(swapped.constant_pool.count());
+        for (u2 i = 1; i < swap_table.size(); ++i)
+                swap_table[i] = i;
+        std::swap(swap_table[1], swap_table[2]);
+        auto swap_result = remap_references(swapped, swap_table);
+        std::swap(swapped.constant_pool.get_entries()[1], swapped.constant_pool.get_entries()[2]);
+        swapped.constant_pool.mark_dirty();
+        swapped.mark_dirty();
+        auto swapped_bytes = swapped.encode();
+        // Only the bytecode of `main` changes
+        ClassFile new_body = ClassFile::parse(buf, size).value();
+        new_body.methods[1].attributes[0].info[1] += 1; // max_stack
+        new_body.methods[1].mark_dirty();
+        ClassFile exposed = ClassFile::parse(buf, size).value();
+        exposed.fields[0].access_flags = static_cast<AccessFlags>(exposed.fields[0].access_flags ^ ACC_PUBLIC);
+        exposed.fields[0].mark_dirty();
+        auto same = [](std::expected<uint64_t, Error> a, std::expected<uint64_t, Error> b) {
+                return a.has_value() && b.has_value() && a.value() == b.value();
+        };
+        // An unknown attribute nested in `main`'s Code must not make the rest of the Code raw
+        auto with_opaque = [](ClassFile classfile) {
+                auto &code = classfile.methods[1].attributes[0];
+                CodeAttr layout = CodeAttr(code);
+                size_t attributes_offset = layout.code_offset + layout.code_length + sizeof(u2) + layout.exception_table.size() * 8;
+                u2 opaque_name = classfile.constant_pool.push_entry(ConstantPoolEntry::Utf8Info { "Opaque" });
+                code.info[attributes_offset + 1] += 1;
+                for (u1 byte : { static_cast<u1>(opaque_name >> 8), static_cast<u1>(opaque_name), u1(0), u1(0), u1(0), u1(2), u1(1), u1(2) })
+                        code.info.push_back(byte);
+                classfile.methods[1].mark_dirty();
+                return classfile.encode();
+        };
+        ClassFile original_class = ClassFile::parse(buf, size).value();
+        ClassFile stripped_class = ClassFile::parse(stripped).value();
+        verify = same(fingerprint(with_opaque(swapped)), fingerprint(with_opaque(original_class))) &&
+                 same(fingerprint(with_opaque(stripped_class), FINGERPRINT_IGNORE_DEBUG),
+                      fingerprint(with_opaque(original_class), FINGERPRINT_IGNORE_DEBUG));
+        verify = verify && original_fingerprint.has_value() && swap_result.has_value() && swapped_bytes != original_bytes &&
+                 same(fingerprint(swapped_bytes), original_fingerprint) &&
+                 same(fingerprint(swapped), original_fingerprint) &&
+                 !same(fingerprint(stripped), original_fingerprint) &&
+                 same(fingerprint(stripped, FINGERPRINT_IGNORE_DEBUG), fingerprint(original_bytes, FINGERPRINT_IGNORE_DEBUG)) &&
+                 !same(fingerprint(new_body), original_fingerprint) &&
+                 same(fingerprint(new_body, FINGERPRINT_ABI), fingerprint(original_bytes, FINGERPRINT_ABI)) &&
+                 !same(fingerprint(exposed, FINGERPRINT_ABI), fingerprint(original_bytes, FINGERPRINT_ABI)) &&
+                 !fingerprint(buf, size - 10).has_value() &&
+                 fingerprint(buf + 1, size - 1).error().kind == ErrorKind::WrongMagic;
+        std::cout << "Fingerprint Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
+        std::cout << std::endl;
+        std::cout << "Diff test" << std::endl;
+        auto same_delta = diff(original_bytes, original_bytes);
+        auto body_delta = diff(cf, new_body);
+        auto new_body_bytes = new_body.encode();
+        // A new constant at the end of the pool, and a field renamed to it
+        ClassFile renamed = ClassFile::parse(buf, size).value();
+        renamed.fields[1].name_index = renamed.constant_pool.push_entry(ConstantPoolEntry(ConstantPoolEntry::Utf8Info { "renamedField" }));
+        renamed.fields[1].mark_dirty();
+        auto renamed_bytes = renamed.encode();
+        auto renamed_delta = diff(original_bytes, renamed_bytes);
+        verify = same_delta.has_value() && same_delta.value().size() < 24 &&
+                 patch(original_bytes, same_delta.value()) == original_bytes &&
+                 body_delta.has_value() && body_delta.value().size() < size / 20 &&
+                 patch(original_bytes, body_delta.value()) == new_body_bytes &&
+                 renamed_delta.has_value() && renamed_delta.value().size() < size / 10 &&
+                 patch(original_bytes, renamed_delta.value()) == renamed_bytes &&
+                 !patch(new_body_bytes, body_delta.value()).has_value() &&
+                 !patch(original_bytes, std::span(body_delta.value()).first(body_delta.value().size() - 1)).has_value() &&
+                 !diff(buf, size - 10, buf, size).has_value();
+        if (verify)
+                std::cout << "Delta sizes: " << body_delta.value().size() << " and " << renamed_delta.value().size() <<
+                             " bytes, for a class of " << size << " bytes" << std::endl;
+        std::cout << "Diff Verify: " << (verify ? "OK" : "BAD") << std::endl;
+        if (!verify)
+                return 1;
+
         return 0;
 }